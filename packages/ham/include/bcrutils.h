@@ -10,9 +10,15 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "model.h"
+#include "hmmbundle.h"
 #include "text.h"
+#include "profiler.h"
 
 using namespace std;
 namespace ham {
@@ -132,21 +138,35 @@ public:
 // ----------------------------------------------------------------------------------------
 class HMMHolder {
 public:
-  HMMHolder(string hmm_dir, GermLines &gl, Track *track): hmm_dir_(hmm_dir), gl_(gl), track_(track) {}
+  HMMHolder(string hmm_dir, GermLines &gl, Track *track, string bundle_fname="");  // if <bundle_fname> is set, we load models from there (see hamutil --action compile-hmms) rather than from the yamls in <hmm_dir>
   ~HMMHolder();
-  Model *Get(string gene);
+  Model *Get(string gene);  // if a prefetch thread is reading <gene>, this waits for it, and otherwise reads it here if we don't already have it
+  void Prefetch(vector<string> genes, size_t n_threads);  // start reading <genes>, in order, on <n_threads> background threads (doesn't wait for them to finish)
   Track *track() { return track_; }
   // Rescale, within each hmm, the emission probabilities to reflect <overall_mute_freq> instead of the mute freq which was recorded in the hmm file.
   // If <overall_mute_freq> is -INFINITY, we re-rescale them to what they were originally
   void RescaleOverallMuteFreqs(map<string, set<string> > &only_genes, double overall_mute_freq);  // WOE BETIDE THEE WHO FORGETETH TO RE-RESET THESE
   void UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes);
-  void CacheAll();  // read all available hmms into memory
+  void CacheAll(size_t n_threads=1);  // read all available hmms into memory
   string NameString(map<string, set<string> > *only_genes=nullptr, int max_to_print=-1);  // if more than <max_to_print> for any region, only print the number of genes for each region
 private:
+  Model *Read(string gene);  // from the bundle if it's there, otherwise from the yaml file
+  void PrefetchLoop();  // runs in each of <prefetch_threads_>
+  void StopPrefetching();
   string hmm_dir_;
   GermLines &gl_;
+  HMMBundle *bundle_;  // null if we're reading yamls
   map<string, Model*> hmms_; // map of gene name to hmm pointer
   Track *track_;  // each of the models has a track... but they should all be the same, so just toss one here for easy access
+
+  // NOTE everything that touches <hmms_> has to hold <mutex_>, since the prefetch threads add to it (but Model objects themselves are only ever used by the caller's thread)
+  mutex mutex_;
+  condition_variable loaded_cv_;  // notified whenever a gene finishes loading
+  condition_variable prefetch_cv_;  // prefetch threads wait on this for more genes
+  set<string> loading_;  // genes that a prefetch thread is currently reading
+  deque<string> prefetch_queue_;
+  vector<thread> prefetch_threads_;
+  bool stop_prefetching_;
 };
 
 // ----------------------------------------------------------------------------------------
@@ -176,14 +196,7 @@ private:
   RecoEvent best_event_;  // most likely event, among those in events_ (this event has its per_gene_support_ set). Set by Finalize().
 };
 
-void StreamHeader(ofstream &ofs, string algorithm);
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence> &seqs, string errors);
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence*> &pseqs, string errors);
-string PerGeneSupportString(vector<SupportPair> &support);
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence> &seqs, string errors);
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence*> &pseqs, string errors);
-void StreamForwardOutput(ofstream &ofs, vector<Sequence> &seqs, double total_score, string errors);
-void StreamForwardOutput(ofstream &ofs, vector<Sequence*> &pseqs, double total_score, string errors);
+string CsvHeader(string algorithm);  // header line for bcrham's (non-partition) csv output
 
 string SeqStr(vector<Sequence*> &pseqs, string delimiter = " ");
 string SeqStr(vector<Sequence> &seqs, string delimiter = " ");
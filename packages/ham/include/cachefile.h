@@ -0,0 +1,101 @@
+#ifndef HAM_CACHEFILE_H
+#define HAM_CACHEFILE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <stdint.h>
+#include <math.h>
+
+#include "text.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// everything we know about one sequence set (i.e. one line of the csv cache file, or one record in the binary one)
+class CacheEntry {
+public:
+  CacheEntry(string key="") : key_(key), logprob_(-INFINITY), naive_hfrac_(-1.), has_logprob_(false), has_naive_hfrac_(false) {}
+  void Update(CacheEntry &other);  // set anything that's set in <other> (i.e. the same thing that happens when a later line in the csv has the same key as an earlier one)
+  bool failed() { return errors_.find("no_path") != string::npos; }
+  bool empty() { return !has_logprob_ && !has_naive_hfrac_ && naive_seq_ == "" && errors_ == ""; }
+
+  string key_;
+  double logprob_, naive_hfrac_;
+  bool has_logprob_, has_naive_hfrac_;
+  string naive_seq_;  // empty if not set
+  string errors_;
+};
+
+// ----------------------------------------------------------------------------------------
+// binary cache file layout (all offsets are from the start of the file, and everything is in native byte order, which we check with <byte_order>):
+//   BinaryCacheHeader
+//   BinaryCacheRecord[n_records]
+//   uint64_t[n_hash_slots]  open-addressing hash table: (index of the record) + 1, or zero for an empty slot, with linear probing starting from key_hash % n_hash_slots
+//   string table            keys and error strings, not null-terminated
+//   naive seq table         for each naive seq: uint32_t n_runs, n_runs x (uint32_t start, length, character) for non-ACGT stretches (usually N padding), then 2-bit packed bases
+// Nothing needs to be parsed on opening, so a reader just mmaps the file and looks up keys as they're needed.
+#define BINARY_CACHE_MAGIC "HAMCACHE"
+#define BINARY_CACHE_VERSION 1
+#define BINARY_CACHE_BYTE_ORDER 0x01020304
+
+struct BinaryCacheHeader {
+  char magic[8];
+  uint32_t version, byte_order;
+  uint64_t n_records, n_hash_slots;
+  uint64_t n_logprobs, n_naive_seqs;  // just so we can print the same summary that we print for csv files without having to look at every record
+  uint64_t records_offset, hash_offset, strings_offset, seqs_offset, file_size;
+};
+
+enum BinaryCacheFlags { HAS_LOGPROB = 1, HAS_NAIVE_HFRAC = 2, HAS_NAIVE_SEQ = 4 };
+
+struct BinaryCacheRecord {
+  uint64_t key_hash;  // StableHash() of the key, so most probes don't need to look at the string table
+  uint64_t key_offset, errors_offset, naive_seq_offset;  // offsets into the string table (key and errors) and naive seq table
+  uint32_t key_length, errors_length, naive_seq_length, flags;
+  double logprob, naive_hfrac;
+};
+
+// ----------------------------------------------------------------------------------------
+class BinaryCacheReader {
+public:
+  BinaryCacheReader(string fname);
+  BinaryCacheReader(const BinaryCacheReader&) = delete;
+  BinaryCacheReader &operator=(const BinaryCacheReader&) = delete;
+  ~BinaryCacheReader();
+  size_t size() { return header_->n_records; }
+  size_t n_logprobs() { return header_->n_logprobs; }
+  size_t n_naive_seqs() { return header_->n_naive_seqs; }
+  bool Find(const string &key, CacheEntry &entry);  // if <key> is in the file, fill <entry> and return true
+  void Get(size_t irecord, CacheEntry &entry);
+  set<string> FailedKeys();  // keys whose errors include "no_path"
+
+private:
+  void CheckHeader();
+  void CheckRecord(const BinaryCacheRecord &record);
+  string String(uint64_t offset, uint32_t length) { return string(strings_ + offset, length); }
+  string NaiveSeq(const BinaryCacheRecord &record);
+
+  string fname_;
+  int fd_;
+  size_t map_size_;
+  const char *data_;
+  const BinaryCacheHeader *header_;
+  const BinaryCacheRecord *records_;
+  const uint64_t *hash_slots_;
+  const char *strings_, *seqs_;
+};
+
+bool IsBinaryCacheFile(string fname);  // check the magic string at the start of the file
+void WriteBinaryCacheFile(string fname, vector<CacheEntry> &entries);  // keys in <entries> must be unique
+void ReadCsvCacheFile(string fname, map<string, CacheEntry> &entries, bool skip_partial_last_line=false);  // add the lines in <fname> to <entries> (updating entries that are already there). Set <skip_partial_last_line> for journals, whose writer may have been killed mid-line.
+bool TrimPartialLastLine(string fname);  // if <fname> doesn't end with a newline, truncate it after the last one (so we can append to it). Returns true if we trimmed anything.
+void WriteCsvCacheHeader(ofstream &ofs);
+void WriteCsvCacheLine(ofstream &ofs, CacheEntry &entry);
+}
+#endif
@@ -13,6 +13,7 @@
 #include "mathutils.h"
 #include "bcrutils.h"
 #include "args.h"
+#include "profiler.h"
 
 using namespace std;
 namespace ham {
@@ -26,6 +27,8 @@ public:
   Result Run(vector<Sequence*> pseqvector, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);  // run all over the kspace specified by bounds in kmin and kmax
   Result Run(vector<Sequence> seqvector, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);
   Result Run(Sequence seq, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);
+  Result Run(Sequences &seqs, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);  // if you want to set a profile in <seqs>, you need to call this one directly
+  uint64_t n_cells() { return n_cells_; }  // total dp cells calculated over all calls to Run() (see Trellis::n_cells())
   void HandleFishyAnnotations(Result &multi_seq_result, vector<Sequence*> pqry_seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq);
   void HandleFishyAnnotations(Result &multi_seq_result, vector<Sequence> qry_seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq);
   // void StreamOutput(double test);  // print csv event info to stderr
@@ -36,13 +39,13 @@ private:
   void RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes);
   KSet FindPartialCacheMatch(string region, string gene, KSet kset);
   void InitCache(string gene);
-  void FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin);
+  uint64_t FillTrellis(KSet kset, SequencesView query_seqs, string gene, string &origin);  // returns the number of dp cells we calculated
   RecoEvent FillRecoEvent(Sequences &seqs, KSet kset, map<string, string> &best_genes, double score);
   vector<string> GetQueryStrs(Sequences &seqs, KSet kset, string region);
 
   void PrintPath(KSet kset, vector<string> query_strs, string gene, double score, string extra_str = "");
-  Sequences GetSubSeqs(Sequences &seqs, KSet kset, string region);
-  map<string, Sequences> GetSubSeqs(Sequences &seqs, KSet kset);  // get the subsequences for the v, d, and j regions given a k_v and k_d
+  SequencesView GetSubSeqs(Sequences &seqs, KSet kset, string region);
+  map<string, SequencesView> GetSubSeqs(Sequences &seqs, KSet kset);  // get the subsequences for the v, d, and j regions given a k_v and k_d
   void SetInsertions(string region, vector<string> path_names, RecoEvent *event);
   size_t GetInsertStart(string side, size_t path_length, size_t insert_length);
   string GetInsertion(string side, vector<string> names);
@@ -60,6 +63,7 @@ private:
   map<string, map<KSet, TracebackPath> > paths_;
   map<string, map<KSet, double> > scores_;
   map<string, double> per_gene_support_;  // log prob of the best (full) annotation for each gene
+  uint64_t n_cells_;  // NOTE not cleared in Clear()
 };
 }
 #endif
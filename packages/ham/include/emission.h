@@ -18,6 +18,7 @@ class Emission {
 public:
   Emission();
   void Parse(YAML::Node config, Track *track);
+  void Load(Track *track, vector<double> log_probs);  // from an hmm bundle, i.e. already checked and logged
   void ReplaceLogProbs(vector<double> new_log_probs) { scores_.ReplaceLogProbs(new_log_probs); }
   void UnReplaceLogProbs() { scores_.UnReplaceLogProbs(); }
   ~Emission();
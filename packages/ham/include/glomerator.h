@@ -6,13 +6,20 @@
 #include <vector>
 #include <iomanip>
 #include <ctime>
+#include <chrono>
 #include <algorithm>
 #include <functional>
+#include <list>
+#include <unordered_set>
 #include <pthread.h>
+#include <unistd.h>
 
 #include "args.h"
 #include "dphandler.h"
 #include "clusterpath.h"
+#include "naiveseqindex.h"
+#include "cachefile.h"
+#include "outputwriter.h"
 #include "text.h"
 
 using namespace std;
@@ -55,7 +62,7 @@ public:
 // ----------------------------------------------------------------------------------------
 class Glomerator {
 public:
-  Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track);
+  Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track, map<string, CacheEntry> *warm_cache=nullptr);  // <warm_cache>: values from previous runs in the same process (see bcrham --server), which we add to when we're done
   ~Glomerator();
   void Cluster();
   double LogProbOfPartition(Partition &clusters, bool debug=false);
@@ -74,16 +81,30 @@ public:
 
   void WritePartitions(ClusterPath &cp);
   void WriteAnnotations(ClusterPath &cp);
+
+  // totals so far (e.g. for hambench)
+  int n_merges() { return n_hfrac_merges_ + n_lratio_merges_; }
+  int n_fwd_calculated() { return n_fwd_calculated_; }
+  int n_vtb_calculated() { return n_vtb_calculated_; }
+  int n_hfrac_calculated() { return n_hfrac_calculated_; }
+  uint64_t n_dp_cells() { return n_dp_cells_; }
 private:
   void ReadCacheFile();
-  void WriteCacheLine(ofstream &ofs, string query);
+  void LoadFromInputCache(string key);  // if we have a binary input cache or a warm cache, copy anything they have for <key> into our maps
+  void LoadCacheEntry(CacheEntry &entry, bool initial);
+  void UpdateWarmCache();
+  CacheEntry GetCacheEntry(string query);
   void WriteCacheFile();
+  void OpenCacheJournal();
+  void JournalKey(string key);
+  void FlushCacheJournal();
 
   void PrintPartition(Partition &clusters, string extrastr);
   string CacheSizeString();
   string FinalString(bool newline=false);
   string GetStatusStr(time_t current_time);
   void WriteStatus();  // write some progress info to file
+  void WriteMetrics(time_t current_time, bool done=false);  // write a line of json to --metrics-file
 
   string ParentalString(pair<string, string> *parents);
   int CountMembers(string namestr);
@@ -97,6 +118,9 @@ private:
 
   double CalculateHfrac(string &seq_a, string &seq_b);
   double NaiveHfrac(string key_a, string key_b);
+  void AddPairCacheKey(string key_a, string key_b, string joint_key);
+  void EvictDeadClusters(Query &qmerge);
+  void EnforceRssBudget();
 
   string ChooseSubsetOfNames(string queries, int n_max);
   string GetNaiveSeqNameToCalculate(string actual_queries);  // convert between the actual queries/key we're interested in and the one we're going to calculate
@@ -108,6 +132,10 @@ private:
   // double NormFactor(string name);
   double GetLogProb(string queries);
   double GetLogProbRatio(string key_a, string key_b);
+  vector<uint32_t> &GetProfile(string queries);
+  void CacheProfile(string queries, vector<uint32_t> profile);
+  void EraseProfile(string queries);
+  Sequences GetDPSeqs(string queries);
   string CalculateNaiveSeq(string key, RecoEvent *event=nullptr);
   double CalculateLogProb(string queries);
 
@@ -132,6 +160,9 @@ private:
 
   bool LikelihoodRatioTooSmall(double lratio, int candidate_cluster_size);
   Partition GetSeededClusters(Partition &partition);
+  void InitNaiveSeqIndex(Partition &partition);
+  void UpdateNaiveSeqIndex(Query &qmerge);
+  void GetInnerLoopRange(ClusterPath *path, Partition &outer_clusters, Partition::iterator it_a, Partition &candidates, Partition::iterator &it_b, Partition::iterator &it_end);
   pair<double, Query> FindHfracMerge(ClusterPath *path);
   pair<double, Query> FindLRatioMerge(ClusterPath *path);
   pair<double, Query> *ChooseRandomMerge(vector<pair<double, Query> > &potential_merges);
@@ -160,12 +191,24 @@ private:
   map<string, double> lratios_;
   map<string, string> naive_seqs_;
   map<string, string> errors_;
+  map<string, vector<uint32_t> > profiles_;  // per-position symbol counts for clusters whose emissions we calculate from profiles (see Sequences::BuildProfile())
+  list<string> profile_order_;  // keys in <profiles_>, least recently used first, so we can evict the stalest ones (only filled if --profile-cache-mb is set)
+  map<string, list<string>::iterator> profile_order_positions_;  // position of each key in <profile_order_>
+  size_t profile_bytes_;  // approximate memory used by <profiles_>
+  map<string, map<string, string> > pair_cache_keys_;  // pair_cache_keys_[cluster][other cluster] : joint key for the pair in <naive_hfracs_> and <lratios_> (only filled if we're evicting dead clusters)
 
   set<string> failed_queries_;
 
+  NaiveSeqIndex naive_seq_index_;  // index over the naive seqs of the clusters in the current partition, so we don't have to loop over all pairs
+  bool use_naive_seq_index_;  // set in Cluster(), once the index is filled
+
   set<string> initial_log_probs_, initial_naive_hfracs_, initial_naive_seqs_;  // keep track of the ones we read from the initial cache file so we can write only the new ones to the output cache file
+  BinaryCacheReader *input_cache_;  // mmap'd binary input cache file (null if the input cache file is csv, in which case we read the whole thing into the maps above)
+  map<string, CacheEntry> *warm_cache_;  // owned by the caller (null unless we're in a server)
+  ofstream journal_ofs_;  // append-only csv journal of newly-calculated values (see --cache-journal)
+  set<string> journal_pending_;  // keys with new values that we haven't yet written to <journal_ofs_>
 
-  int n_fwd_calculated_, n_vtb_calculated_, n_hfrac_calculated_, n_hfrac_merges_, n_lratio_merges_;
+  int n_fwd_calculated_, n_vtb_calculated_, n_hfrac_calculated_, n_hfrac_merges_, n_lratio_merges_, n_pairs_evicted_, n_budget_clears_, n_profiles_evicted_;
 
   double asym_factor_;
 
@@ -174,6 +217,12 @@ private:
   Partition *current_partition_;  // (a.t.m. only used for writing to status file)
   time_t last_status_write_time_;  // last time that we wrote our progress to a file
   FILE *progress_file_;
+
+  uint64_t n_dp_cells_;  // summed over all the DPHandlers we've run
+  FILE *metrics_file_;  // null unless --metrics-file is set
+  chrono::steady_clock::time_point start_time_, last_metrics_time_;  // NOTE not time_t, since its one-second resolution would give us zero-length intervals
+  int last_metrics_n_merges_;  // values at the last metrics line, so we can get rates since then
+  uint64_t last_metrics_n_dp_cells_;
 };
 
 }
@@ -0,0 +1,101 @@
+#ifndef HAM_HMMBUNDLE_H
+#define HAM_HMMBUNDLE_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "model.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// hmm bundle file layout (offsets are from the start of the file, and everything is in native byte order, which we check with <byte_order>):
+//   HMMBundleHeader
+//   HMMBundleModel[n_models]            sorted by name, so we can binary search
+//   HMMBundleState[n_states]            each model's states are contiguous, in the same order as in Model::states_, followed by the model's init state
+//   HMMBundleTransition[n_transitions]  CSR: each state's transitions (not including the one to end) are contiguous, sorted by to-state index
+//   double[n_emissions]                 <n_symbols> emission log probs for each state that has emissions
+//   HMMBundleString[n_symbols]          the track's symbols (all models in a bundle have to have the same track)
+//   string table                        names, germline nucleotides, etc., not null-terminated
+// Everything's already in log space and checked for normalization, so a reader just mmaps the file and turns records into Models as they're asked for.
+#define HMM_BUNDLE_MAGIC "HAMHMMBN"
+#define HMM_BUNDLE_VERSION 1
+#define HMM_BUNDLE_BYTE_ORDER 0x01020304
+
+struct HMMBundleString {
+  uint64_t offset;  // into string table
+  uint32_t length, unused;
+};
+
+struct HMMBundleHeader {
+  char magic[8];
+  uint32_t version, byte_order;
+  uint64_t n_models, n_states, n_transitions, n_emissions, n_symbols;
+  uint64_t models_offset, states_offset, transitions_offset, emissions_offset, symbols_offset, strings_offset, file_size;
+  HMMBundleString track_name;
+};
+
+struct HMMBundleModel {
+  HMMBundleString name, ambiguous_char;
+  double overall_prob, original_overall_mute_freq;
+  uint64_t first_state;  // index in the state table
+  uint64_t n_states;  // not including init, which comes right after the others
+};
+
+enum HMMBundleStateFlags { HAS_END_TRANSITION = 1, HAS_EMISSIONS = 2 };
+
+struct HMMBundleState {
+  HMMBundleString name, germline_nuc, ambiguous_char;
+  double ambiguous_emission_logprob, end_transition_logprob;
+  uint64_t first_transition, n_transitions;  // in the transition table
+  uint64_t first_emission;  // in the emission table (if HAS_EMISSIONS)
+  uint32_t flags, unused;
+};
+
+struct HMMBundleTransition {
+  uint64_t to_state;  // index within the model (i.e. State::index())
+  double log_prob;
+};
+
+// ----------------------------------------------------------------------------------------
+class HMMBundle {
+public:
+  HMMBundle(string fname);
+  HMMBundle(const HMMBundle&) = delete;
+  HMMBundle &operator=(const HMMBundle&) = delete;
+  ~HMMBundle();
+  string fname() { return fname_; }
+  size_t n_models() { return header_->n_models; }
+  int Find(const string &name);  // index of the model called <name> (i.e. the sanitized gene name), or -1 if it isn't in the bundle
+  // NOTE the accessors check that whatever the record points to is inside the file, so a corrupt bundle throws instead of reading off the end of the map
+  const HMMBundleModel &model(size_t imodel);
+  const HMMBundleState &state(size_t istate);
+  const HMMBundleTransition &transition(size_t itrans);
+  const double *emissions(const HMMBundleState &st);
+  size_t n_symbols() { return header_->n_symbols; }
+  string String(const HMMBundleString &str);
+  Track *NewTrack(string ambiguous_char);  // caller owns the result
+
+private:
+  void CheckHeader();
+  void CheckTable(string name, uint64_t offset, uint64_t n_entries, size_t entry_size);
+  string fname_;
+  int fd_;
+  size_t map_size_;
+  const char *data_;
+  const HMMBundleHeader *header_;
+  const HMMBundleModel *models_;
+  const HMMBundleState *states_;
+  const HMMBundleTransition *transitions_;
+  const double *emissions_;
+  const HMMBundleString *symbols_;
+  const char *strings_;
+};
+
+bool IsHMMBundleFile(string fname);
+void WriteHMMBundle(string fname, vector<Model*> &models);  // models have to be finalized, and not rescaled
+}
+#endif
@@ -222,6 +222,7 @@ void addVector(vector<T>& lhs, vector<T>& rhs) {
 
 // ----------------------------------------------------------------------------------------
 double AddWithMinusInfinities(double first, double second);
+bool InBounds(uint64_t offset, uint64_t length, uint64_t size);  // is [offset, offset + length) inside something of size <size>?
 
 }
 
@@ -2,17 +2,22 @@
 #define HAM_MODEL_H
 
 #include <fstream>
+#include <limits>
 #include "state.h"
 #include "yaml-cpp/yaml.h"
 
 using namespace std;
 namespace ham {
+class HMMBundle;
+
+typedef int16_t TracebackIndex;  // type of the state indices in Trellis's traceback tables (small, since they're (sequence length) x (n states) and get cached), so Finalize() throws if a model has more states than it can index
 
 class Model {
 public:
   Model();
   ~Model();
   void Parse(string);
+  void Load(HMMBundle &bundle, size_t imodel);  // instead of Parse(), set everything from the <imodel>th model in <bundle>
   void AddState(State*);
   void RescaleOverallMuteFreq(double overall_mute_freq);  // Rescale emissions to reflect <overall_mute_freq>, unless <overall_mute_freq> is -INFINITY, in which case we *re*-rescale them to what they were originally
   void UnRescaleOverallMuteFreq();  // Undo the above
@@ -24,15 +29,17 @@ public:
   size_t n_states() { return states_.size(); }
   State *state(string name) { assert(states_by_name_.count(name)); return states_by_name_[name]; }
   State *state(size_t ist) { assert(ist < states_.size()); return states_[ist]; }
-  bitset<STATE_MAX> *initial_to_states() { return initial_->to_states(); }  // get vector of states to which the initial state may transition
+  vector<size_t> *initial_to_states() { return initial_->to_state_indices(); }  // get (sorted) indices of states to which the initial state may transition
   State *init_state() { return initial_; }
   double overall_prob() { return overall_prob_; }
   double original_overall_mute_freq() { return original_overall_mute_freq_; }
+  string ambiguous_char() { return ambiguous_char_; }
 
 private:
+  void SortStates();
   void FinalizeState(State *st);
   void CheckTopology();
-  void AddToStateIndices(State* st, vector<uint16_t>& visited); // that's 'to-state', as in, 'here we push back the to-state indices onto <visited>'
+  void AddToStateIndices(State* st, vector<size_t>& visited); // that's 'to-state', as in, 'here we push back the to-state indices onto <visited>'
 
   string name_;
   double overall_prob_;  // overall probability of this hmm/gene (not the same 'overall' as <overall_mute_freq_>)
@@ -0,0 +1,62 @@
+#ifndef HAM_NAIVESEQINDEX_H
+#define HAM_NAIVESEQINDEX_H
+
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// banded index over naive sequences, so we can find the pairs of clusters that might have naive hamming fraction below some bound without looping over all pairs.
+// Each naive sequence is chopped into <n_bands> bands, and we look up other sequences that match exactly in enough of them. If there's <n_mismatches> mismatches
+// between two sequences, and they have <n_wild_a> and <n_wild_b> bands with ambiguous characters (which we can't hash, and which CalculateHfrac() skips), then by the
+// pigeonhole principle they match exactly in at least <n_bands> - <n_mismatches> - <n_wild_a> - <n_wild_b> bands.
+// We use as many bands as we can without them getting too short (so sequences that only share, e.g., a j gene don't match in enough bands), and allow for a few
+// wild bands in each sequence (typically N padding at the ends). Sequences with more wild bands than that go in <overflow_>, and get compared to everybody.
+// Buckets are by cdr3 length, same as the full loop. Naive seqs in a cdr3 class should all be the same length, but if one isn't, it also goes in <overflow_> (so
+// that Glomerator::NaiveHfrac() gets called on it, and complains, same as without the index).
+// The upshot is that Candidates() returns a superset of the pairs within the bound (you still need to calculate the actual hfrac for each candidate).
+class NaiveSeqIndex {
+public:
+  NaiveSeqIndex(double max_hfrac, string ambig_char, size_t min_band_length=8);
+  void Add(string key, string &naive_seq, size_t cdr3_length);
+  void Remove(string key);
+  bool Contains(string key) { return bucket_keys_.count(key) > 0; }
+  set<string> Candidates(string key);  // keys that might be within <max_hfrac_> of <key> (not including <key> itself)
+  size_t size() { return bucket_keys_.size(); }
+  size_t n_buckets() { return buckets_.size(); }
+
+private:
+  typedef size_t BucketKey;  // cdr3 length: sequences in different buckets are never compared
+  class Bucket {
+  public:
+    Bucket() : seq_length_(0), n_bands_(0), band_length_(0), max_mismatches_(0), max_wild_bands_(0) {}
+    size_t seq_length_;  // length of the first naive seq we added (any others with different length go in <overflow_>)
+    size_t n_bands_, band_length_;  // if <n_bands_> is zero, the bands would be too short to be of any use, so every member of the bucket is a candidate for every other
+    size_t max_mismatches_;
+    size_t max_wild_bands_;  // sequences with more wild bands than this go in <overflow_>
+    vector<unordered_map<size_t, set<string> > > band_members_;  // band_members_[iband][hash of band] : keys with that band
+    set<string> overflow_;
+    set<string> members_;
+  };
+
+  size_t BandStart(Bucket &bucket, size_t iband) { return iband * bucket.band_length_; }
+  size_t BandLength(Bucket &bucket, size_t iband, size_t seq_length);  // last band gets the remainder
+  void InitBucket(Bucket &bucket, size_t seq_length);
+
+  double max_hfrac_;
+  string ambig_char_;
+  size_t min_band_length_;
+  map<BucketKey, Bucket> buckets_;
+  map<string, BucketKey> bucket_keys_;  // which bucket each key is in
+  map<string, map<size_t, size_t> > band_hashes_;  // band_hashes_[key][iband] : hash of each band (bands with ambiguous characters aren't included)
+};
+
+}
+#endif
@@ -0,0 +1,127 @@
+#ifndef HAM_OUTPUTWRITER_H
+#define HAM_OUTPUTWRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "bcrutils.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// one line of bcrham's annotation (or forward log prob) output file: a viterbi annotation, a forward log prob, or a failure
+class AnnotationRecord {
+public:
+  AnnotationRecord() : has_event_(false), logprob_(-INFINITY) {}
+  AnnotationRecord(vector<Sequence> &seqs, string errors);  // failure (no event)
+  AnnotationRecord(vector<Sequence> &seqs, double total_score, string errors);  // forward
+  AnnotationRecord(RecoEvent &event, vector<Sequence> &seqs, string errors);  // viterbi
+
+  string unique_ids_;  // colon-separated
+  string errors_;
+  bool has_event_;  // false for failures
+  double logprob_;
+  vector<string> seqs_;  // only for viterbi
+  vector<string> genes_;  // v, d, j (only for viterbi, as are the rest of these)
+  vector<string> insertions_;  // fv, vd, dj, jf
+  vector<uint32_t> deletions_;  // v_5p, v_3p, d_5p, d_3p, j_5p, j_3p
+  vector<vector<pair<string, double> > > per_gene_support_;  // v, d, j
+};
+
+// ----------------------------------------------------------------------------------------
+// binary annotation file layout (native byte order, checked with <byte_order>; strings are a uint32_t length followed by the characters):
+//   header:  magic string, uint32_t version, uint32_t byte_order, uint32_t algorithm (0 viterbi, 1 forward)
+//   then, for each record, a uint32_t record length followed by:
+//     unique_ids string, errors string, uint8_t has_event, double logprob
+//     for viterbi only: uint32_t n_seqs + seq strings, and if has_event: 3 gene strings, 4 insertion strings, 6 uint32_t deletions, and
+//       for each of v, d, j: uint32_t n + n x (gene string, double logprob)
+#define BINARY_ANNOTATION_MAGIC "HAMANNOT"
+#define BINARY_ANNOTATION_VERSION 1
+#define BINARY_ANNOTATION_BYTE_ORDER 0x01020304
+
+// ----------------------------------------------------------------------------------------
+// Writes annotation or log prob output (for bcrham, and Glomerator::WriteAnnotations()) in either csv (with header CsvHeader()) or binary. Records are formatted directly into a large in-memory
+// buffer, and full buffers are handed off to a background thread that does the writing, so the dp thread only waits on the filesystem if it gets <max_pending_> buffers ahead.
+class AnnotationWriter {
+public:
+  AnnotationWriter(string fname, string algorithm, string format="csv", size_t buffer_bytes=(1 << 22));
+  AnnotationWriter(const AnnotationWriter&) = delete;
+  AnnotationWriter &operator=(const AnnotationWriter&) = delete;
+  ~AnnotationWriter();
+  void Write(AnnotationRecord &record);
+  void Close();  // flush everything and wait for the writer thread (throws if anything went wrong while writing)
+
+private:
+  void AppendCsv(AnnotationRecord &record);
+  void AppendBinary(AnnotationRecord &record);
+  void AppendDouble(double val, const char *fmt);
+  template <typename T> void Pack(T val);
+  void PackString(const string &str);
+  void HandOff();  // move <buffer_> onto <queue_> for the writer thread
+  void WriterLoop();  // runs in <thread_>
+
+  string fname_;
+  string algorithm_;
+  string format_;
+  size_t buffer_bytes_;
+  size_t max_pending_;
+  FILE *fp_;
+  string buffer_;
+  deque<string> queue_;
+  mutex mutex_;
+  condition_variable queue_cv_;  // writer thread waits on this for new buffers
+  condition_variable space_cv_;  // dp thread waits on this if <queue_> is full
+  bool done_;
+  bool closed_;
+  string write_error_;
+  thread thread_;
+};
+
+// ----------------------------------------------------------------------------------------
+// for several threads that finish queries out of order: Write() can be called from any thread with the query's index in the input file, and records get passed on to
+// <writer> in input order (so the output is the same as with one thread)
+class OrderedAnnotationWriter {
+public:
+  OrderedAnnotationWriter(AnnotationWriter &writer) : writer_(writer), next_index_(0) {}
+  void Write(size_t index, AnnotationRecord &record);
+  size_t n_pending() { return pending_.size(); }  // nonzero at the end means we skipped an index
+
+private:
+  AnnotationWriter &writer_;
+  mutex mutex_;
+  size_t next_index_;  // index of the next record that <writer_> should get
+  map<size_t, AnnotationRecord> pending_;  // finished records that are waiting on an earlier one NOTE with --schedule largest-first this can grow to most of the output, since the first query in the input is often one of the last to run
+};
+
+// ----------------------------------------------------------------------------------------
+// reads back the binary format (e.g. for hamutil --action annotations-to-csv)
+class AnnotationReader {
+public:
+  AnnotationReader(string fname);
+  string algorithm() { return algorithm_; }
+  bool Next(AnnotationRecord &record);  // false at end of file
+
+private:
+  template <typename T> T Unpack();
+  string UnpackString();
+
+  string fname_;
+  ifstream ifs_;
+  string algorithm_;
+  string buffer_;
+  size_t ipos_;
+};
+
+bool IsBinaryAnnotationFile(string fname);
+}
+#endif
@@ -0,0 +1,76 @@
+#ifndef HAM_PROFILER_H
+#define HAM_PROFILER_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#include "text.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Opt-in instrumentation (bcrham --timing-report): per-phase wall and cpu time, trellis counts by origin (scratch, chunk, or cached) for each gene (and
+// summed over each region), the number of dp cells calculated, allocation counts, and whatever totals other classes want to add (e.g. Glomerator's
+// merge counts). There's one per process, and Get() returns null unless someone called Enable(), so instrumented code does:
+//     if(Profiler *prof = Profiler::Get()) ...
+// NOTE phases can overlap (e.g. hmms get read lazily during the "partition" phase), so phase times don't add up to the total.
+class Profiler {
+public:
+  static Profiler *Get() { return instance_; }
+  static void Enable();  // call before starting any threads
+
+  void AddPhase(string name, double wall_seconds, double cpu_seconds);
+  void CountTrellis(string region, string gene, string origin, uint64_t n_cells, double seconds);
+  void AddCounter(string name, double val);
+  void WriteReport(string fname);  // json (see the comment in profiler.cc)
+
+  static atomic<uint64_t> n_allocations_, n_allocated_bytes_;  // counted by bcrham's operator new (only while enabled), so they stay zero in other programs
+  static bool counting_allocations_;
+
+private:
+  struct TrellisCounts {
+    TrellisCounts() : n_scratch(0), n_chunk(0), n_cached(0), n_cells(0), seconds(0.) {}
+    void Add(string origin, uint64_t cells, double secs);
+    string Json();
+    uint64_t n_scratch, n_chunk, n_cached, n_cells;
+    double seconds;
+  };
+  struct PhaseTimes {
+    PhaseTimes() : n_calls(0), wall_seconds(0.), cpu_seconds(0.) {}
+    uint64_t n_calls;
+    double wall_seconds, cpu_seconds;
+  };
+
+  Profiler();
+  static Profiler *instance_;
+  mutex mutex_;
+  chrono::steady_clock::time_point start_time_;
+  double start_cpu_seconds_;
+  map<string, PhaseTimes> phases_;
+  map<string, TrellisCounts> region_counts_, gene_counts_;
+  TrellisCounts total_counts_;
+  map<string, double> counters_;
+};
+
+// ----------------------------------------------------------------------------------------
+// adds the time between construction and destruction (or Stop()) to the phase <name> (does nothing unless the profiler is enabled)
+class PhaseTimer {
+public:
+  PhaseTimer(string name);
+  ~PhaseTimer() { Stop(); }
+  void Stop();  // only the first call does anything
+private:
+  string name_;
+  bool enabled_;
+  chrono::steady_clock::time_point start_;
+  double start_cpu_seconds_;
+};
+
+double CpuSeconds();  // cpu time used so far by the whole process (i.e. summed over threads)
+}
+#endif
@@ -0,0 +1,89 @@
+#ifndef HAM_QUERYFILE_H
+#define HAM_QUERYFILE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+
+#include "sequences.h"
+#include "bcrutils.h"
+#include "args.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// everything that's in one line of the bcrham input file
+class QueryRecord {
+public:
+  QueryRecord() : k_v_min_(0), k_v_max_(0), k_d_min_(0), k_d_max_(0), cdr3_length_(0), mut_freq_(0.) {}
+  KBounds kbounds() { return KBounds(KSet(k_v_min_, k_d_min_), KSet(k_v_max_, k_d_max_)); }
+  double EstimatedCost();  // rough relative run time, for scheduling (not in any particular units)
+
+  vector<Sequence> seqs_;
+  int k_v_min_, k_v_max_, k_d_min_, k_d_max_, cdr3_length_;
+  double mut_freq_;
+  vector<string> only_genes_;
+};
+
+// ----------------------------------------------------------------------------------------
+// binary query file layout (everything in native byte order, which we check with <byte_order>, and strings are a uint32_t length followed by the characters):
+//   header:  magic string, uint32_t version, uint32_t byte_order, uint32_t n_symbols + symbol strings, ambiguous char string, uint32_t n_genes + gene name strings
+//   then, for each query, a uint32_t record length followed by:
+//     int32_t k_v_min, k_v_max, k_d_min, k_d_max, cdr3_length
+//     double mut_freq
+//     uint32_t n_seqs, then for each sequence: name string, uint32_t length, and <length> uint8_t digitized symbols (track indices, with the track's ambiguous index for ambiguous bases)
+//     uint32_t n_only_genes, then that many uint32_t indices into the header's gene names
+// Since sequences are already digitized and genes are integers, reading a query is a single read() plus some memcpy'ing, and we never need more than one query in memory.
+#define BINARY_QUERY_MAGIC "HAMQUERY"
+#define BINARY_QUERY_VERSION 1
+#define BINARY_QUERY_BYTE_ORDER 0x01020304
+
+// ----------------------------------------------------------------------------------------
+class QueryFileReader {
+public:
+  QueryFileReader(string fname, Track *track);
+  bool Next(QueryRecord &record);  // read the next query into <record>, or return false if we're at the end of the file
+  size_t n_read() { return n_read_; }
+  vector<string> &gene_names() { return gene_names_; }  // every gene in any query's only_genes (from the header)
+
+private:
+  uint32_t ReadUint32();  // from <ifs_> (only used for the header)
+  string ReadString();
+  void CheckRemaining(size_t n_bytes);
+  template <typename T> T Unpack();  // from <buffer_>, starting at <ipos_>
+  string UnpackString();
+
+  string fname_;
+  ifstream ifs_;
+  Track *track_;
+  vector<string> gene_names_;
+  string buffer_;  // current record
+  size_t ipos_;  // current position in <buffer_>
+  size_t n_read_;
+};
+
+// ----------------------------------------------------------------------------------------
+class QueryFileWriter {
+public:
+  QueryFileWriter(string fname, Track *track, vector<string> gene_names);
+  void Write(QueryRecord &record);
+  void Close() { ofs_.close(); }
+
+private:
+  template <typename T> void Pack(T val);  // into <buffer_>
+  void PackString(const string &str);
+
+  string fname_;
+  ofstream ofs_;
+  map<string, uint32_t> gene_indices_;
+  string buffer_;
+};
+
+bool IsBinaryQueryFile(string fname);  // check the magic string at the start of the file
+void ReadTextQuery(Args &args, size_t iqry, Track *track, QueryRecord &record);  // fill <record> from the <iqry>th line of a text input file (which <args> has already split into columns)
+}
+#endif
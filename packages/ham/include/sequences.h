@@ -9,40 +9,59 @@ namespace ham {
 // ----------------------------------------------------------------------------------------
 class Sequence {
   friend class Sequences;
+  friend class SequencesView;
 public:
   Sequence();  // NOTE don't use this! It's only so I can use stl maps without crashing
   Sequence(Track* trk, string name, string &undigitized);
   Sequence(Track* trk, string name, string &undigitized, size_t pos, size_t len);  // create the subsequence from <pos> of length <len>
+  Sequence(Track* trk, string name, vector<uint8_t> &digitized);  // for sequences that were digitized ahead of time (e.g. read from a binary query file)
   Sequence(Sequence &rhs, size_t pos, size_t len);
   Sequence(const Sequence &rhs);
   ~Sequence();
 
   inline string name() const { return name_; }
   inline void set_name(string name)  { name_ = name; }
-  inline uint8_t operator[](size_t index) { return seqq_.at(index); }  // digitized value at position <index>
-  inline uint8_t value(size_t pos) const { return seqq_[pos]; }  // get digitized value at <pos>
-  inline string symbol(size_t pos) const { return track_->symbol(seqq_[pos]); }  // get undigitized value at <pos>
-  inline size_t size() const { return seqq_.size(); }
+  inline uint8_t operator[](size_t index) { if(index >= size()) throw out_of_range("index " + to_string(index) + " out of range for " + name_); return value(index); }  // digitized value at position <index>
+  inline uint8_t value(size_t pos) const { return packed_ ? PackedValue(pos) : seqq_[pos]; }  // get digitized value at <pos>
+  inline string symbol(size_t pos) const { return track_->symbol(value(pos)); }  // get undigitized value at <pos>
+  inline size_t size() const { return packed_ ? packed_length_ : seqq_.size(); }
   inline Track* track() const { return track_; }
-  inline vector<uint8_t> *seqq() { return &seqq_; }
-  inline string undigitized() const { return undigitized_; }
+  vector<uint8_t> *seqq();  // NOTE throws if we're packed
+  string undigitized() const;
   Sequence GetSubSequence(size_t pos, size_t len);
 
+  // Optionally store the sequence as two bits per base, with a separate bitmap for ambiguous bases, and without the undigitized string (i.e. about a fifth the memory).
+  // This only works for alphabets with at most four symbols, and values are slower to get at, so it's meant for sequences that we're storing rather than running dp on
+  // (Sequences::AddSeq() unpacks its copy).
+  void Pack();
+  void Unpack();
+  bool packed() const { return packed_; }
+
   void Print(string separator = " "); // if separator is specified, print it between each element in the sequence
 private:
   void Digitize();  // convert the string in <undigitized_> to a vector<uint8_t> in <seqq_>
   void CheckPosLen(string name, string undigitized, size_t pos, size_t len);
+  inline uint8_t PackedValue(size_t pos) const {
+    if(ambiguous_bits_.size() > 0 && (ambiguous_bits_[pos / 64] >> (pos % 64)) & 1)
+      return track_->ambiguous_index();
+    return (packed_seqq_[pos / 4] >> (2 * (pos % 4))) & 3;
+  }
   string name_;
   string header_;
-  string undigitized_;  // undigitized sequence
+  string undigitized_;  // undigitized sequence (empty if we're packed)
   Track* track_; // track describing alphabet and type. NOTE we don't own this pointer, i.e. we don't delete it when we die
-  vector<uint8_t> seqq_; // digitized Sequence
+  vector<uint8_t> seqq_; // digitized Sequence (empty if we're packed)
+  bool packed_;
+  size_t packed_length_;
+  vector<uint8_t> packed_seqq_;  // four values per byte, starting from the low bits
+  vector<uint64_t> ambiguous_bits_;  // one bit per position, set for ambiguous bases (empty if there aren't any)
 };
 
 // ----------------------------------------------------------------------------------------
 class Sequences {
+  friend class SequencesView;
 public:
-  Sequences() : sequence_length_(0) {}
+  Sequences() : sequence_length_(0), n_profile_symbols_(0) {}
   // Sequences(const Sequences &rhs);
   Sequences(Sequences &rhs, size_t pos, size_t len);  // copy <seqs> from <pos> to <pos> + <len>
   // Sequences(vector<Sequence> &seqs);
@@ -55,6 +74,14 @@ public:
   size_t n_seqs() const { return seqs_.size(); }
   size_t GetSequenceLength() { return sequence_length_;}
   Sequences Union(Sequences &otherseqs);  // return union set of self and <otherseqs>
+
+  // The profile is the number of sequences with each symbol at each position (with the ambiguous symbol in the last slot), laid out as profile_[pos * n_profile_symbols() + symbol].
+  // Since emissions are independent under the star tree, this is all we need to calculate a column's emission log prob, and the profile of a merged cluster is just the sum of its parents' profiles.
+  vector<uint32_t> BuildProfile();  // count symbols in <seqs_>
+  void SetProfile(const vector<uint32_t> &profile);  // use <profile> for emissions, rather than looping over the sequences
+  bool has_profile() { return profile_.size() > 0; }
+  size_t n_profile_symbols() { return n_profile_symbols_; }
+  uint32_t *profile(size_t pos) { return &profile_[pos * n_profile_symbols_]; }
   // Sequences GetSubSequences(size_t pos, size_t len);
 
   void Print();
@@ -77,6 +104,34 @@ public:
 private:
   vector<Sequence> seqs_;
   size_t sequence_length_; // length of the sequences (required to be the same for all)
+  vector<uint32_t> profile_;  // empty unless SetProfile() was called
+  size_t n_profile_symbols_;
+};
+
+// ----------------------------------------------------------------------------------------
+// Non-owning view of positions [<offset_>, <offset_> + <length_>) in each of a Sequences's sequences (and its profile, if it has one), so DPHandler can slice
+// out each region's subsequences for every kset without copying anything.
+// NOTE we don't own <seqs_>, so the view is only good as long as the Sequences it points to is still around and unmodified (e.g. in DPHandler, for the duration of Run())
+class SequencesView {
+public:
+  SequencesView() : seqs_(nullptr), offset_(0), length_(0) {}
+  SequencesView(Sequences &seqs) : seqs_(&seqs), offset_(0), length_(seqs.GetSequenceLength()) {}
+  SequencesView(Sequences &seqs, size_t pos, size_t len);
+
+  inline uint8_t value(size_t iseq, size_t ipos) const { return seqs_->seqs_[iseq].seqq_[offset_ + ipos]; }  // digitized value of <iseq>th sequence at position <ipos> (relative to the start of the view)
+  size_t n_seqs() const { return seqs_ == nullptr ? 0 : seqs_->n_seqs(); }
+  size_t GetSequenceLength() const { return length_; }
+  bool has_profile() const { return seqs_->profile_.size() > 0; }
+  size_t n_profile_symbols() const { return seqs_->n_profile_symbols_; }
+  uint32_t *profile(size_t pos) { return seqs_->profile(offset_ + pos); }
+  string undigitized(size_t iseq) const { return seqs_->seqs_[iseq].undigitized_.substr(offset_, length_); }  // NOTE copies (only use it where you need a string, e.g. for cache keys)
+  bool IsPrefixOf(size_t iseq, const string &str) const { return str.size() >= length_ && str.compare(0, length_, seqs_->seqs_[iseq].undigitized_, offset_, length_) == 0; }  // does <str> start with the <iseq>th sequence in the view?
+  string name_str(string delimiter = " ") { return seqs_->name_str(delimiter); }
+
+private:
+  Sequences *seqs_;
+  size_t offset_;
+  size_t length_;
 };
 
 }
@@ -0,0 +1,87 @@
+#ifndef HAM_SIMULATOR_H
+#define HAM_SIMULATOR_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+
+#include "bcrutils.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// one simulated clonal family: a single rearrangement (i.e. naive sequence), plus the mutated sequences that descend from it
+class SimulatedFamily {
+public:
+  SimulatedFamily() : k_v_(0), k_d_(0), cdr3_length_(0), mut_freq_(0.) {}
+  size_t n_seqs() { return seqs_.size(); }
+
+  string name_;
+  map<string, string> genes_;  // v, d, j
+  map<string, size_t> deletions_;  // v_3p, d_5p, d_3p, j_5p (we don't do 5' v or 3' j deletions, or fv/jf insertions)
+  map<string, string> insertions_;  // vd, dj
+  string naive_seq_;
+  size_t k_v_, k_d_;  // true values, i.e. the lengths of the v (plus vd insertion) and d (plus dj insertion) parts of <naive_seq_>
+  int cdr3_length_;
+  double mut_freq_;  // mean observed fraction of mutated positions in <seqs_>
+  vector<string> names_;
+  vector<string> seqs_;
+};
+
+// ----------------------------------------------------------------------------------------
+// distribution of clonal family sizes: "constant" (always <mean>), "geometric" (with mean <mean>), or "power-law" (P(n) proportional to n^-<exponent>), all capped at <max_size>
+class FamilySizeDistribution {
+public:
+  FamilySizeDistribution(string name, double mean, double exponent, size_t max_size);
+  size_t Draw(mt19937 &rng);
+
+private:
+  string name_;
+  double mean_;
+  size_t max_size_;
+  geometric_distribution<size_t> geometric_;
+  discrete_distribution<size_t> power_law_;  // index i is size i + 1
+};
+
+// ----------------------------------------------------------------------------------------
+// Makes synthetic rearrangements from the germline genes in <gl> (e.g. for hambench and hamsim). This is nowhere near as realistic as partis's python simulation: deletion and
+// insertion lengths are uniform, and mutations are uniform over positions and bases. But it only needs germline sets, it's fast, and it's reproducible for a given seed.
+class Simulator {
+public:
+  Simulator(GermLines &gl, map<string, vector<string> > available_genes, unsigned seed);  // <available_genes>: for each region, the genes to choose from (e.g. the ones that have hmms)
+  SimulatedFamily Rearrange(string vgene="", string dgene="", string jgene="");  // new naive sequence (with no mutated seqs yet) using the specified genes, or random ones if they're empty
+  void AddStarTreeSeqs(SimulatedFamily &family, size_t n_seqs, double mut_freq);  // add <n_seqs> sequences that each independently mutate each position of the naive sequence with probability <mut_freq>
+  void AddTreeSeqs(SimulatedFamily &family, size_t n_seqs, double mut_freq);  // add <n_seqs> sequences at the leaves of a random binary tree whose root-to-leaf mutation probabilities sum to <mut_freq> (so, unlike a star tree, they share mutations)
+  string Mutate(const string &seq, double mut_freq);  // mutate each position with probability <mut_freq>
+  KBounds GetKBounds(SimulatedFamily &family, size_t half_width);  // true k_v and k_d, plus or minus <half_width> (but no lower than 1)
+  vector<string> OnlyGenes(SimulatedFamily &family, size_t n_extra);  // the true genes, plus <n_extra> other random genes from each region
+  size_t LeftPadding(SimulatedFamily &family);  // number of ambiguous bases that PadSeq() adds on the left, i.e. how far to shift k_v
+  string PadSeq(SimulatedFamily &family, const string &seq, string ambig_base);  // pad <seq> (one of <family>'s) so it's the same length, with the cysteine at the same position, as every other padded seq with the same cdr3 length
+  void WriteInputFile(string fname, vector<SimulatedFamily> &families, size_t k_half_width, size_t n_extra_genes, string ambig_base);  // bcrham (text) input file with one line per (padded) sequence, i.e. for partitioning
+  void WriteInputHeader(ostream &os);
+  void WriteInputLines(ostream &os, SimulatedFamily &family, size_t k_half_width, size_t n_extra_genes, string ambig_base);  // so you can write families one at a time, rather than keeping them all in memory
+  mt19937 &rng() { return rng_; }
+  map<string, vector<string> > &available_genes() { return available_genes_; }
+
+private:
+  string ChooseGene(string region);
+  size_t Uniform(size_t lo, size_t hi);  // uniform in [lo, hi] (NOTE inclusive)
+  string RandomBases(size_t length);
+  void AddSubtreeSeqs(SimulatedFamily &family, const string &seq, size_t n_leaves, double depth);  // recursive part of AddTreeSeqs()
+  void SetMutFreq(SimulatedFamily &family);
+
+  GermLines &gl_;
+  map<string, vector<string> > available_genes_;
+  mt19937 rng_;
+  size_t n_families_;  // number we've made so far (for naming)
+  size_t n_seqs_;
+  size_t max_cyst_, max_j_3p_;  // largest cysteine position among the available v genes, and largest number of bases from the start of the tryptophan to the end of an available j gene (for padding)
+};
+
+map<string, vector<string> > GenesWithHmms(GermLines &gl, string hmmdir);  // genes in <gl> that have a yaml in <hmmdir>, by region (e.g. for Simulator's <available_genes>)
+}
+#endif
@@ -6,7 +6,6 @@
 #include <set>
 #include <stdint.h>
 #include <stdlib.h>
-#include <bitset>
 
 #include "text.h"
 #include "emission.h"
@@ -16,53 +15,77 @@
 using namespace std;
 namespace ham {
 class Transition;
+class HMMBundle;
 
 class State {
 public:
   State();
   void Parse(YAML::Node node, vector<string> state_names, Track *track);
+  void Load(HMMBundle &bundle, size_t istate, vector<string> &state_names, Track *track);  // <state_names> are the names of the model's states, in bundle order
   void RescaleOverallMuteFreq(double factor);  // Rescale emissions by the ratio <factor>
   void UnRescaleOverallMuteFreq();  // undo the above
   ~State();
 
   inline string name() { return name_; }
   inline string abbreviation() { return name_.substr(0, 1); }
+  inline string germline_nuc() { return germline_nuc_; }
+  inline string ambiguous_char() { return ambiguous_char_; }
+  inline double ambiguous_emission_logprob() { return ambiguous_emission_logprob_; }
+  inline Emission *emission() { return &emission_; }
   inline size_t index() { return index_; }  // index of this state in the HMM model
   inline vector<Transition*> *transitions() { return transitions_; }
-  inline bitset<STATE_MAX> *to_states() { return &to_states_; }
-  inline bitset<STATE_MAX> *from_states() { return &from_states_; }
-  inline vector<size_t> *from_state_indices() { return &from_state_indices_; }
+  inline vector<size_t> *to_state_indices() { return &to_state_indices_; }  // sorted indices of the states to which we can transition
+  inline vector<size_t> *from_state_indices() { return &from_state_indices_; }  // sorted indices of the states from which we can transition to here
+  inline vector<double> *from_state_logprobs() { return &from_state_logprobs_; }
   inline Transition *transition(size_t iter) { return (*transitions_)[iter]; }
   inline Transition *trans_to_end() { return trans_to_end_; }
 
-  double EmissionLogprob(uint8_t ch);
-  double EmissionLogprob(Sequences *seqs, size_t pos);
-  inline double transition_logprob(size_t to_state) { return (*transitions_)[to_state]->log_prob(); }
-  double end_transition_logprob();
+  inline double EmissionLogprob(uint8_t ch) { return (has_ambiguous_ && ch == emission_.track()->ambiguous_index()) ? ambiguous_emission_logprob_ : emission_.score(ch); }
+  double EmissionLogprob(SequencesView *seqs, size_t pos);  // any number of sequences (or a profile)
+  template <int N_SEQS> inline double EmissionLogprob(SequencesView *seqs, size_t pos);  // same, but specialized at compile time for one or two sequences (see Trellis)
+  double transition_logprob(size_t to_state);  // NOTE this is a binary search, so don't use it in the dp loops (use from_state_logprobs() instead)
+  inline double end_transition_logprob() { return trans_to_end_ == nullptr ? -INFINITY : trans_to_end_->log_prob(); }  // inline, since the dp calls it for every transition
 
   // property-setters for use in model::finalize()
-  inline void AddToState(State *st) { to_states_[st->index()] = 1; }  // set bit in <to_states_> corresponding to <st>
-  inline void AddFromState(State *st) { from_states_[st->index()] = 1; }  // set bit in <from_states_> corresponding to <st>
+  inline void AddToState(State *st) { to_state_indices_.push_back(st->index()); }  // add <st> to the states we can reach (sorted in SortStateIndices())
+  inline void AddFromState(State *st) { from_state_indices_.push_back(st->index()); }  // add <st> to the states from which we can be reached (sorted in SortStateIndices())
   inline void SetIndex(size_t val) { index_ = val; }
   void ReorderTransitions(map<string, State*>& state_indices);
 
-  void SetFromStateIndices();
+  void SortStateIndices();  // sort (and remove duplicates from) <to_state_indices_> and <from_state_indices_>
+  void SetFromStateLogprobs(vector<State*> &states);  // call after SortStateIndices() (<states> is the model's states, i.e. indexed by State::index())
 
   void Print();
 private:
   string name_, germline_nuc_;
   double ambiguous_emission_logprob_;
   string ambiguous_char_;
-  vector<Transition*> *transitions_;
+  bool has_ambiguous_;  // i.e. ambiguous_char_ != "" (so we don't compare strings in the dp loops)
+  vector<Transition*> *transitions_;  // after ReorderTransitions(), sorted by to-state index (only the transitions that exist, since a dense vector over all states is quadratic in the number of states)
   Transition *trans_to_end_;
   Emission emission_;
 
   // hmm model-level information (assigned in model::finalize)
   size_t index_;  // position of this state in the vector model::states_ (set in model::finalize)
-  bitset<STATE_MAX> to_states_;
-  bitset<STATE_MAX> from_states_;
-  vector<size_t> from_state_indices_;  // same information as <from_states_>, but hopefully faster to iterate over
+  // NOTE these used to be bitsets of length STATE_MAX (a compile-time cap on the number of states), but they're very sparse, and the dp only ever iterates over them
+  vector<size_t> to_state_indices_;
+  vector<size_t> from_state_indices_;
+  vector<double> from_state_logprobs_;  // log prob of the transition to this state from each state in <from_state_indices_>
 };
 
+// ----------------------------------------------------------------------------------------
+// NOTE does the same additions in the same order as the general version (that starts from 0. and adds each sequence's log prob with AddWithMinusInfinities(), and 0. + x == x),
+// so with strict ieee math it gives exactly the same values. But SConscript builds with -Ofast, which lets the compiler reassociate sums once they're inlined, so the last
+// few bits of a log prob can differ from the out-of-line version (we see differences of up to about 1e-12 in forward log probs).
+template <int N_SEQS> inline double State::EmissionLogprob(SequencesView *seqs, size_t pos) {
+  if(N_SEQS == 1)
+    return EmissionLogprob(seqs->value(0, pos));
+  if(N_SEQS == 2) {
+    double first(EmissionLogprob(seqs->value(0, pos))), second(EmissionLogprob(seqs->value(1, pos)));
+    return (first == -INFINITY || second == -INFINITY) ? -INFINITY : first + second;  // i.e. AddWithMinusInfinities(), but inlined
+  }
+  return EmissionLogprob(seqs, pos);
+}
+
 }
 #endif
@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <stdint.h>
 
 using namespace std;
 namespace ham {
@@ -16,5 +17,8 @@ bool InString(string query, string liststr, string delimiter=":");
 string JoinStrings(vector<string> &strlist, string delimiter=":");
 vector<int> Intify(vector<string> strlist);
 vector<double> Floatify(vector<string> strlist);
+uint64_t StableHash(const string &str, uint64_t seed=0);  // unlike std::hash, same value on every platform/compiler
+string JsonString(const string &str);  // <str> quoted and escaped for json
+string JsonDouble(double val);  // json has no inf or nan, so those become null
 }
 #endif
@@ -14,12 +14,12 @@ namespace ham {
 // ----------------------------------------------------------------------------------------
 class Track {
 public:
-  Track() {}
+  Track() { UpdateCharIndices(); }
   Track(string name, vector<string> symbols, string ambiguous_char = "");
   void set_name(string nm) { name_ = nm; }
   void AddSymbol(string symbol);
   void AddSymbols(vector<string> &symbols);
-  void SetAmbiguous(string amb) { ambiguous_char_ = amb; }
+  void SetAmbiguous(string amb) { ambiguous_char_ = amb; UpdateCharIndices(); }
   string ambiguous_char() { return ambiguous_char_; }
   uint8_t ambiguous_index() { return ambiguous_index_; }
 
@@ -27,15 +27,22 @@ public:
   size_t alphabet_size() { return alphabet_.size(); }
   string symbol(size_t iter) { return alphabet_.at(iter); }  // return <iter>th element of <alphabet_> (which is probably a letter, but could be several letters or something else). NOTE throws std:out_of_range exception if <iter> is invalide
   uint8_t symbol_index(const string &symbol);
+  void Digitize(const string &undigitized, uint8_t *digitized);  // convert each symbol in <undigitized> to its index, writing them to <digitized> (which needs room for undigitized.size() values)
   string Stringify();
 private:
+  void UpdateCharIndices();  // rebuild <char_indices_> (call whenever the alphabet or ambiguous char changes)
   string name_;
   vector<string> alphabet_;  // vector of this track's allowed symbols (eg {A,C,G,T})
   map<string, uint8_t> symbol_indices_;
   string ambiguous_char_;
   const static uint8_t max_alphabet_size_ = 255;
   const static uint8_t ambiguous_index_ = max_alphabet_size_ - 1;
+  const static uint8_t invalid_index_ = max_alphabet_size_;  // marks characters that aren't in <char_indices_>
+  // If every symbol (and the ambiguous char) is one character, as for nucleotides, we can digitize with a lookup table instead of going through <symbol_indices_>.
+  bool single_char_symbols_;
+  uint8_t char_indices_[256];  // index of each single-character symbol, indexed by the character's (unsigned) value (<invalid_index_> for characters that aren't symbols)
 };
 
+Track NucleotideTrack(string ambiguous_char);  // the ACGT track that bcrham uses for its input (so everything that reads or writes bcrham query and cache files digitizes the same way)
 }
 #endif
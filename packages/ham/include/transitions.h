@@ -14,7 +14,7 @@ class Transition {
   // friend class model;
   // friend class State;
 public:
-  Transition(string to_state, double prob);
+  Transition(string to_state, double prob, bool is_log_prob=false);  // <is_log_prob> is for when we're loading already-logged values from an hmm bundle
 
   void set_to_state(State* st) { to_state_ = st; }
   string &to_state_name() { return to_state_name_; }
@@ -4,6 +4,7 @@
 #include <vector>
 #include <stdint.h>
 #include <iomanip>
+#include <algorithm>
 
 #include "sequences.h"
 #include "model.h"
@@ -12,19 +13,19 @@
 using namespace std;
 namespace ham {
 
-typedef vector<vector<int16_t> > int_2D;
+typedef vector<vector<TracebackIndex> > int_2D;
 
 // ----------------------------------------------------------------------------------------
 class Trellis {
 public:
-  Trellis(Model *hmm, Sequence seq, Trellis *cached_trellis = nullptr);
-  Trellis(Model *hmm, Sequences seqs, Trellis *cached_trellis = nullptr);
+  Trellis(Model *hmm, SequencesView seqs, Trellis *cached_trellis = nullptr);  // NOTE <seqs> has to stay around until you're done running Viterbi()/Forward()/Traceback()
   void Init();
   Trellis();
   ~Trellis();
 
   Model *model() { return hmm_; }
-  Sequences seqs() { return seqs_; }
+  SequencesView &seqs() { return seqs_; }
+  uint64_t n_cells() { return n_cells_; }  // number of (position, state) pairs for which we calculated dp values (zero if we got everything from <cached_trellis_>)
   double ending_viterbi_log_prob() { return ending_viterbi_log_prob_; }  // for full sequence length
   double ending_forward_log_prob() { return ending_forward_log_prob_; }  // for full sequence length
   // NOTE (and beware) this is confusing to subtract one from the length. BUT it is totally on purpose: I want the calling code to be able to just worry about how long its sequence is.
@@ -39,9 +40,7 @@ public:
   vector<double> *forward_log_probs_pointer() { return forward_log_probs_pointer_; }
   vector<int> *viterbi_indices_pointer() { return viterbi_indices_pointer_; }
 
-  void SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states);
-  void MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
-  void MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
+  void SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current);
   void CacheViterbiVals(size_t position, double dpval, size_t i_st_current);
   void CacheForwardVals(size_t position, double dpval, size_t i_st_current);
   void Viterbi();
@@ -53,14 +52,29 @@ public:
 
   void Dump();
 private:
+  // The dp kernels are templated on the algorithm and on the number of sequences (1, 2, or 0 for any number, or a profile), so the compiler can inline and
+  // specialize the emission calculation (see State::EmissionLogprob<N_SEQS>()) for the single-sequence case, which is most of what we run.
+  template <bool VITERBI> void FillTable();  // call the FillTable() instantiation for <seqs_>
+  template <bool VITERBI, int N_SEQS> void FillTable();
+  template <bool VITERBI, int N_SEQS> void MiddleVals(vector<double> *scoring_previous, vector<double> *scoring_current, size_t position);
+  inline void AddNextStates(State *state) {  // add <state>'s to-states to the states we need to check at the next position
+    vector<size_t> &to_indices(*state->to_state_indices());
+    if(to_indices.size() == 0)
+      return;
+    for(auto &ist : to_indices)
+      next_states_[ist] = 1;
+    next_begin_ = min(next_begin_, to_indices.front());  // NOTE to_indices are sorted
+    next_end_ = max(next_end_, to_indices.back() + 1);
+  }
+
   Model *hmm_;
-  Sequences seqs_;
+  SequencesView seqs_;
   int_2D *traceback_table_pointer_;  // if we have a cached trellis, this points to the cached trellis's table
   int_2D traceback_table_;  // if we have a cached trellis, this isn't initialized
 
   Trellis *cached_trellis_;  // pointer to another trellis that already has its dp table(s) filled in, the idea being this trellis only needs a subset of that table, so we don't need to calculate anything new for this one
 
-  int16_t ending_viterbi_pointer_;
+  TracebackIndex ending_viterbi_pointer_;
   double  ending_viterbi_log_prob_;
   double  ending_forward_log_prob_;
 
@@ -72,8 +86,13 @@ private:
   vector<double> forward_log_probs_;  // total log prob of all paths up to and including each position NOTE includes log prob of transition to end
   vector<int> viterbi_indices_;  // pointer to the state at which the best log prob occurred
 
+  uint64_t n_cells_;
   vector<double> *swap_ptr_;
   vector<double> scoring_current_, scoring_previous_;
+  // states that we need to check at the current and next positions. These are sized to the model (they used to be bitsets of compile-time length STATE_MAX), and we
+  // also keep track of the range of indices [begin, end) in which any are set, so we only loop over (and clear) the part of the model that's active at each position.
+  vector<uint8_t> current_states_, next_states_;
+  size_t current_begin_, current_end_, next_begin_, next_end_;
 };
 
 }
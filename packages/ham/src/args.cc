@@ -1,22 +1,33 @@
 #include "args.h"
+#include "queryfile.h"
 
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Args::Args(int argc, const char * argv[]):
+Args::Args(int argc, const char * argv[], bool exit_on_parse_error):
   algo_strings_ {"viterbi", "forward"},
   debug_ints_ {0, 1, 2},
+  output_format_strings_ {"csv", "binary"},
+  schedule_strings_ {"input-order", "largest-first"},
   algo_vals_(algo_strings_),
   debug_vals_(debug_ints_),
+  output_format_vals_(output_format_strings_),
+  schedule_vals_(schedule_strings_),
   hmmdir_arg_("", "hmmdir", "directory in which to look for hmm model files", true, "", "string"),
+  hmm_bundle_arg_("", "hmm-bundle", "if set, load hmms from this precompiled bundle file (made with hamutil --action compile-hmms) instead of parsing yamls from --hmmdir (genes that aren't in the bundle are still read from --hmmdir)", false, "", "string"),
   datadir_arg_("", "datadir", "directory in which to look for non-sample-specific data (eg human germline seqs)", true, "", "string"),
-  infile_arg_("", "infile", "input (whitespace-separated) file", true, "", "string"),
-  outfile_arg_("", "outfile", "output csv file", true, "", "string"),
+  infile_arg_("", "infile", "input file: either whitespace-separated text, or binary (see queryfile.h, and hamutil --action convert-input)", false, "", "string"),
+  outfile_arg_("", "outfile", "output csv file", false, "", "string"),
   annotationfile_arg_("", "annotationfile", "if specified, write annotations for each cluster to here", false, "", "string"),
-  input_cachefname_arg_("", "input-cachefname", "input cached log prob/naive seq csv file", false, "", "string"),
+  input_cachefname_arg_("", "input-cachefname", "input cached log prob/naive seq file (csv or binary)", false, "", "string"),
   output_cachefname_arg_("", "output-cachefname", "output cached log prob/naive seq csv file", false, "", "string"),
+  cache_journal_arg_("", "cache-journal", "append newly-calculated log probs/naive seqs (and naive hfracs, with --cache-naive-hfracs) to this csv file every time we write the progress file. If it already exists, we first read in everything in it, so a killed run can be resumed by rerunning with the same journal. Merge several journals into one cache file with hamutil --action compact-cache.", false, "", "string"),
+  timing_report_arg_("", "timing-report", "if set, time each phase and count trellises (by gene, region, and whether they were calculated from scratch, chunk cached, or cached), dp cells, and allocations, and write it all to this json file at exit (see profiler.cc for the format). In server mode, this covers all requests.", false, "", "string"),
+  metrics_file_arg_("", "metrics-file", "when partitioning, append a line of json to this file every --status-interval seconds (and once at the end) with the number of clusters, merges and dp cells per second, cache sizes, and rss (see Glomerator::WriteMetrics()). Several processes can append to the same file.", false, "", "string"),
   locus_arg_("", "locus", "ig{h,k,l} or tr{a,b,g,d}", true, "", "string"),
-  algorithm_arg_("", "algorithm", "algorithm to run", true, "", &algo_vals_),
+  algorithm_arg_("", "algorithm", "algorithm to run", false, "", &algo_vals_),
+  output_format_arg_("", "output-format", "format for --outfile when annotating (i.e. not partitioning): csv, or binary records with the same content (see outputwriter.h, and hamutil --action annotations-to-csv)", false, "csv", &output_format_vals_),
+  schedule_arg_("", "schedule", "order in which to run queries when annotating: input-order, or largest-first by estimated cost (see QueryRecord::EstimatedCost(), and hamutil --action estimate-costs), which keeps expensive queries from being left until the end with --n-threads. Output is in input order either way, which means largest-first has to hold finished annotations in memory until every earlier query is done, i.e. in the worst case the whole output file's worth. With binary input, it also has to read every query into memory first. So for very large inputs you may want to stick with input-order (or split the input).", false, "input-order", &schedule_vals_),
   ambig_base_arg_("", "ambig-base", "ambiguous base", false, "", "string"),
   seed_unique_id_arg_("", "seed-unique-id", "seed unique id", false, "", "string"),
   hamming_fraction_bound_lo_arg_("", "hamming-fraction-bound-lo", "if hamming fraction for a pair is smaller than this, merge them without calculating lratio", false, 0.0, "float"),
@@ -28,16 +39,27 @@ Args::Args(int argc, const char * argv[]):
   biggest_naive_seq_cluster_to_calculate_arg_("", "biggest-naive-seq-cluster-to-calculate", "", false, 99999, "int"),
   biggest_logprob_cluster_to_calculate_arg_("", "biggest-logprob-cluster-to-calculate", "", false, 99999, "int"),
   n_partitions_to_write_arg_("", "n-partitions-to-write", "how many partitions, before the best one, should we write to the output file", false, 99999, "int"),
+  profile_min_cluster_size_arg_("", "profile-min-cluster-size", "when partitioning, calculate emissions for clusters with at least this many sequences from per-position symbol counts (which we get for merged clusters by adding the parents' counts), rather than looping over sequences. This makes the dp cost independent of cluster size, but changes results in the last few decimal places. Zero means never.", false, 0, "int"),
   n_final_clusters_arg_("", "n-final-clusters", "instead of stopping at the most likely partition, stop when you have this many clusters", false, 0, "unsigned"),
   min_largest_cluster_size_arg_("", "min-largest-cluster-size", "instead of stopping at the most likely partition, stop when your largest cluster is this big", false, 0, "unsigned"),
   max_cluster_size_arg_("", "max-cluster-size", "if any cluster gets bigger than this, stop clustering", false, 0, "unsigned"),
   random_seed_arg_("", "random-seed", "", false, time(NULL), "unsigned"),
+  rss_budget_mb_arg_("", "rss-budget-mb", "if our resident memory goes over this many MB after a merge, clear the naive hfrac and lratio caches (they get recalculated as needed, but cleared naive hfracs won't be written to the output cache file with --cache-naive-hfracs). Zero means no budget.", false, 0, "unsigned"),
+  status_interval_arg_("", "status-interval", "when partitioning, write the .progress file (and --metrics-file, and flush --cache-journal) at most this often (in seconds)", false, 30, "unsigned"),
+  n_threads_arg_("", "n-threads", "number of threads to use when annotating (i.e. not partitioning). Queries are handed out one at a time to whichever thread is free, and output is written in input order. Zero means one per core. Each thread reads its own copy of each hmm (since hmms get rescaled for each query's mutation frequency), so with many threads you probably want --hmm-bundle, which is much faster to load than the yamls.", false, 1, "unsigned"),
+  n_hmm_threads_arg_("", "n-hmm-threads", "if set, start this many background threads that read the hmms for all the input's only_genes while we're setting up and running the first queries (rather than reading each one the first time a query needs it). Zero means don't prefetch.", false, 0, "unsigned"),
+  profile_cache_mb_arg_("", "profile-cache-mb", "if the cached cluster profiles (see --profile-min-cluster-size) take up more than this many MB, evict the oldest ones. Zero means no limit.", false, 0, "unsigned"),
   no_chunk_cache_arg_("", "no-chunk-cache", "don't perform chunk caching?", false),
+  naive_seq_index_arg_("", "naive-seq-index", "when looking for merges, use a banded naive sequence index to find the pairs of clusters that might be within --hamming-fraction-bound-hi, rather than looping over all pairs. NOTE since we then don't calculate naive hfracs for pairs that are obviously too far apart, --cache-naive-hfracs writes fewer of them to the output cache file", false),
+  evict_dead_clusters_arg_("", "evict-dead-clusters", "after each merge, remove naive hfracs and lratios involving the clusters that were merged out of existence (note that they then won't be written to the output cache file with --cache-naive-hfracs)", false),
+  pack_sequences_arg_("", "pack-sequences", "when partitioning, store each input sequence as two bits per base (plus a bitmap of ambiguous bases) rather than as a string and a byte per base. Uses about a fifth the memory for the sequences (since we free the input's unpacked copies once the glomerator has its own), but costs a little time each time a cluster's sequences are unpacked to run the dp.", false),
   partition_arg_("", "partition", "", false),
+  server_arg_("", "server", "instead of running once, load the hmms and germlines and then read requests from stdin, one per line, each of which is a list of bcrham arguments (with the same --hmmdir, --hmm-bundle, --datadir, --locus, and --ambig-base as the server). After each request we print a line starting with 'bcrham-server:' to stdout. Partition requests share a cache of log probs and naive seqs.", false),
   dont_rescale_emissions_arg_("", "dont-rescale-emissions", "", false),
   cache_naive_seqs_arg_("", "cache-naive-seqs", "cache all naive sequences", false),
   cache_naive_hfracs_arg_("", "cache-naive-hfracs", "cache naive hamming fraction between sequence sets (in addition to log probs and naive seqs)", false),
   only_cache_new_vals_arg_("", "only-cache-new-vals", "only write sequence sets with newly-calculated values to cache file", false),
+  binary_cache_arg_("", "binary-cache", "write the output cache file in the binary format (see cachefile.h) rather than csv. Input cache files in either format are detected automatically.", false),
   write_logprob_for_each_partition_arg_("", "write-logprob-for-each-partition", "By default, we don't know the total logprob of each partition (since many merges are by naive hfrac). This argument tells us that this is the last time through (with one process) and we want to know the total probability of each partition.", false),
   str_headers_ {},
   int_headers_ {"k_v_min", "k_v_max", "k_d_min", "k_d_max", "cdr3_length"},
@@ -48,19 +70,26 @@ Args::Args(int argc, const char * argv[]):
 {
   try {
     CmdLine cmd("bcrham -- the fantabulous HMM compiler goes to B-Cellville", ' ', "");
+    cmd.setExceptionHandling(exit_on_parse_error);
     cmd.add(hmmdir_arg_);
+    cmd.add(hmm_bundle_arg_);
     cmd.add(datadir_arg_);
     cmd.add(infile_arg_);
     cmd.add(outfile_arg_);
     cmd.add(annotationfile_arg_);
     cmd.add(input_cachefname_arg_);
     cmd.add(output_cachefname_arg_);
+    cmd.add(cache_journal_arg_);
+    cmd.add(timing_report_arg_);
+    cmd.add(metrics_file_arg_);
     cmd.add(locus_arg_);
     cmd.add(hamming_fraction_bound_lo_arg_);
     cmd.add(hamming_fraction_bound_hi_arg_);
     cmd.add(logprob_ratio_threshold_arg_);
     cmd.add(max_logprob_drop_arg_);
     cmd.add(algorithm_arg_);
+    cmd.add(output_format_arg_);
+    cmd.add(schedule_arg_);
     cmd.add(ambig_base_arg_);
     cmd.add(seed_unique_id_arg_);
     cmd.add(debug_arg_);
@@ -68,16 +97,27 @@ Args::Args(int argc, const char * argv[]):
     cmd.add(biggest_naive_seq_cluster_to_calculate_arg_);
     cmd.add(biggest_logprob_cluster_to_calculate_arg_);
     cmd.add(n_partitions_to_write_arg_);
+    cmd.add(profile_min_cluster_size_arg_);
     cmd.add(n_final_clusters_arg_);
     cmd.add(min_largest_cluster_size_arg_);
     cmd.add(max_cluster_size_arg_);
     cmd.add(random_seed_arg_);
+    cmd.add(rss_budget_mb_arg_);
+    cmd.add(status_interval_arg_);
+    cmd.add(n_threads_arg_);
+    cmd.add(n_hmm_threads_arg_);
+    cmd.add(profile_cache_mb_arg_);
     cmd.add(no_chunk_cache_arg_);
+    cmd.add(naive_seq_index_arg_);
+    cmd.add(evict_dead_clusters_arg_);
+    cmd.add(pack_sequences_arg_);
     cmd.add(cache_naive_seqs_arg_);
     cmd.add(cache_naive_hfracs_arg_);
     cmd.add(only_cache_new_vals_arg_);
+    cmd.add(binary_cache_arg_);
     cmd.add(write_logprob_for_each_partition_arg_);
     cmd.add(partition_arg_);
+    cmd.add(server_arg_);
     cmd.add(dont_rescale_emissions_arg_);
 
     cmd.parse(argc, argv);
@@ -98,6 +138,16 @@ Args::Args(int argc, const char * argv[]):
   if(find(loci.begin(), loci.end(), locus()) == loci.end())
     throw runtime_error("--locus argument '" + locus() + "' not among ig{h,k,l} or tr{a,b,g,d}");
 
+  binary_infile_ = false;
+  if(server())  // requests each have their own Args
+    return;
+  if(infile() == "" || outfile() == "" || algorithm() == "")
+    throw runtime_error("--infile, --outfile, and --algorithm are required (unless running with --server)");
+
+  binary_infile_ = IsBinaryQueryFile(infile());
+  if(binary_infile_)
+    return;
+
   ifstream ifs(infile());
   if(!ifs.is_open())
     throw runtime_error("args.cc: bcrham input file '" + infile() + "' d.n.e.\n");
@@ -8,12 +8,19 @@
 #include <ctime>
 #include <fstream>
 #include <cfenv>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <new>
 
 #include "dphandler.h"
 #include "bcrutils.h"
 #include "text.h"
 #include "args.h"
 #include "glomerator.h"
+#include "queryfile.h"
+#include "outputwriter.h"
 #include "tclap/CmdLine.h"
 
 using namespace TCLAP;
@@ -22,97 +29,359 @@ using namespace std;
 
 // ----------------------------------------------------------------------------------------
 vector<vector<Sequence> > GetSeqs(Args &args, Track *trk);
-void run_algorithm(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args &args);
+vector<vector<Sequence> > GetSeqsFromBinary(Args &args, Track *trk);
+void run_algorithm(HMMHolder &hmms, GermLines &gl, Args &args, Track *trk);
+AnnotationRecord run_query(DPHandler &dph, Args &args, vector<Sequence> &qry_seqs, KBounds kbounds, vector<string> &only_genes, double mut_freq);
+void run_server(HMMHolder &hmms, GermLines &gl, Args &server_args, Track *trk);
+void run_request(HMMHolder &hmms, GermLines &gl, Args &args, Track *trk, map<string, CacheEntry> *warm_cache=nullptr, map<string, string> *warm_seqs=nullptr);
+vector<string> input_genes(Args &args, Track *trk);
+void check_warm_cache_seqs(vector<vector<Sequence> > &qry_seq_list, map<string, string> &warm_seqs, map<string, CacheEntry> &warm_cache);
+
+// ----------------------------------------------------------------------------------------
+// Replace the global allocation functions so --timing-report can count allocations. These are just malloc() and free() plus two relaxed atomic
+// increments (and only when the profiler is enabled), which is about what the default ones cost anyway. NOTE they're here rather than in profiler.cc so
+// they only affect bcrham, and not every program that links libham.
+void *operator new(size_t size) {
+  if(Profiler::counting_allocations_) {
+    Profiler::n_allocations_.fetch_add(1, memory_order_relaxed);
+    Profiler::n_allocated_bytes_.fetch_add(size, memory_order_relaxed);
+  }
+  void *ptr(malloc(size == 0 ? 1 : size));
+  if(ptr == nullptr)
+    throw bad_alloc();
+  return ptr;
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {  // NOTE if this gets inlined, gcc sees free() on a pointer from operator new and warns (-Wmismatched-new-delete)
+  free(ptr);
+}
 
 // ----------------------------------------------------------------------------------------
 int main(int argc, const char * argv[]) {
   clock_t run_start(clock());
   Args args(argc, argv);
   srand(args.random_seed());
+  if(args.timing_report() != "")
+    Profiler::Enable();
 
   // init some infrastructure
-  vector<string> characters {"A", "C", "G", "T"};
-  Track track("NUKES", characters, args.ambig_base());
+  Track track(NucleotideTrack(args.ambig_base()));
+  PhaseTimer gl_timer("read-germlines");
   GermLines gl(args.datadir(), args.locus());
-  HMMHolder hmms(args.hmmdir(), gl, &track);
-  vector<vector<Sequence> > qry_seq_list(GetSeqs(args, &track));
-
-  if(args.cache_naive_seqs()) {
-    Glomerator glom(hmms, gl, qry_seq_list, &args, &track);
-    glom.CacheNaiveSeqs();
-  } else if(args.partition()) {  // NOTE this is kind of hackey -- there's some code duplication between Glomerator and the loop below... but only a little, and they're doing fairly different things, so screw it for the time being
-    Glomerator glom(hmms, gl, qry_seq_list, &args, &track);
-    glom.Cluster();
-  } else {
-    run_algorithm(hmms, gl, qry_seq_list, args);
-  }
+  gl_timer.Stop();
+  HMMHolder hmms(args.hmmdir(), gl, &track, args.hmm_bundle());
 
+  if(args.server())
+    run_server(hmms, gl, args, &track);
+  else
+    run_request(hmms, gl, args, &track);
+
+  if(Profiler *prof = Profiler::Get())
+    prof->WriteReport(args.timing_report());
   printf("        time: bcrham %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
   return 0;
 }
 
+// ----------------------------------------------------------------------------------------
+// do whatever <args> asks for (i.e. everything after the infrastructure's set up). The warm cache stuff is only for the server (see run_server())
+void run_request(HMMHolder &hmms, GermLines &gl, Args &args, Track *trk, map<string, CacheEntry> *warm_cache, map<string, string> *warm_seqs) {
+  if(args.n_hmm_threads() > 0 && (args.n_threads() == 1 || args.cache_naive_seqs() || args.partition()))  // with several annotation threads, each thread has its own HMMHolder, so there's no point prefetching into this one
+    hmms.Prefetch(input_genes(args, trk), args.n_hmm_threads());
+  if(args.cache_naive_seqs() || args.partition()) {  // NOTE this is kind of hackey -- there's some code duplication between Glomerator and the loop below... but only a little, and they're doing fairly different things, so screw it for the time being
+    PhaseTimer input_timer("read-input");
+    vector<vector<Sequence> > qry_seq_list(GetSeqs(args, trk));
+    input_timer.Stop();
+    if(warm_cache != nullptr)
+      check_warm_cache_seqs(qry_seq_list, *warm_seqs, *warm_cache);
+    PhaseTimer timer(args.cache_naive_seqs() ? "cache-naive-seqs" : "partition");  // includes reading and writing cache files
+    Glomerator glom(hmms, gl, qry_seq_list, &args, trk, warm_cache);
+    vector<vector<Sequence> >().swap(qry_seq_list);  // glomerator has its own copy of each sequence (packed, with --pack-sequences), so free the input's copies rather than keeping them around for the whole run
+    vector<vector<string> >().swap(args.str_lists_["seqs"]);
+    if(args.cache_naive_seqs())
+      glom.CacheNaiveSeqs();
+    else
+      glom.Cluster();
+  } else {
+    PhaseTimer timer("annotate");
+    run_algorithm(hmms, gl, args, trk);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// Keep the hmms and germlines (and the log probs and naive seqs from partition requests) around between requests, which we read from stdin, one per line, as bcrham
+// command lines (without the program name). After each request we print either "bcrham-server: ok <seconds>" or "bcrham-server: error <message>" to stdout, and
+// we exit on "quit" or end of input. Everything else that we print (i.e. the usual bcrham output) comes before the status line.
+void run_server(HMMHolder &hmms, GermLines &gl, Args &server_args, Track *trk) {
+  map<string, CacheEntry> warm_cache;  // log probs and naive seqs from previous requests
+  map<string, string> warm_seqs;  // sequence for each uid in <warm_cache>, so we notice if a request reuses a uid for a different sequence
+  cout << "bcrham-server: ready" << endl;
+  string line;
+  while(getline(cin, line)) {
+    vector<string> words(PythonSplit(line));
+    if(words.size() == 0)
+      continue;
+    if(words.size() == 1 && words[0] == "quit")
+      break;
+
+    clock_t request_start(clock());
+    try {
+      words.insert(words.begin(), "bcrham");
+      vector<const char*> argv;
+      for(auto &word : words)
+	argv.push_back(word.c_str());
+      Args args(argv.size(), argv.data(), false);
+      if(args.server())
+	throw runtime_error("can't nest --server requests");
+      if(args.hmmdir() != server_args.hmmdir() || args.hmm_bundle() != server_args.hmm_bundle() || args.datadir() != server_args.datadir() || args.locus() != server_args.locus() || args.ambig_base() != server_args.ambig_base())
+	throw runtime_error("--hmmdir, --hmm-bundle, --datadir, --locus, and --ambig-base have to be the same as the server's");
+      srand(args.random_seed());
+      run_request(hmms, gl, args, trk, &warm_cache, &warm_seqs);
+      printf("bcrham-server: ok %.1f\n", ((clock() - request_start) / (double)CLOCKS_PER_SEC));
+    } catch(ArgException &e) {
+      printf("bcrham-server: error %s (%s)\n", e.error().c_str(), e.argId().c_str());
+    } catch(exception &e) {
+      string msg(e.what());
+      replace(msg.begin(), msg.end(), '\n', ' ');  // status has to be one line
+      printf("bcrham-server: error %s\n", msg.c_str());
+    }
+    fflush(stdout);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// every gene in any of the input's only_genes, in order of first appearance (for HMMHolder::Prefetch())
+vector<string> input_genes(Args &args, Track *trk) {
+  if(args.binary_infile()) {
+    QueryFileReader reader(args.infile(), trk);  // only reads the header
+    return reader.gene_names();
+  }
+  vector<string> genes;
+  set<string> already_added;
+  for(auto &only_genes : args.str_lists_["only_genes"]) {
+    for(auto &gene : only_genes) {
+      if(already_added.count(gene))
+	continue;
+      genes.push_back(gene);
+      already_added.insert(gene);
+    }
+  }
+  return genes;
+}
+
+// ----------------------------------------------------------------------------------------
+// the cache is indexed by uid, so if a request has a uid we've seen before but with a different sequence, we have to throw out everything we've got
+void check_warm_cache_seqs(vector<vector<Sequence> > &qry_seq_list, map<string, string> &warm_seqs, map<string, CacheEntry> &warm_cache) {
+  bool consistent(true);
+  for(auto &seqs : qry_seq_list) {
+    for(auto &seq : seqs) {
+      if(warm_seqs.count(seq.name()) && warm_seqs[seq.name()] != seq.undigitized()) {
+	consistent = false;
+	break;
+      }
+    }
+  }
+  if(!consistent) {
+    cout << "  note: uid with different sequence than in a previous request, so clearing " << warm_cache.size() << " warm cache entries" << endl;
+    warm_cache.clear();
+    warm_seqs.clear();
+  }
+  for(auto &seqs : qry_seq_list)
+    for(auto &seq : seqs)
+      warm_seqs[seq.name()] = seq.undigitized();
+}
+
 // ----------------------------------------------------------------------------------------
 // read input sequences from file and return as vector of sequences
 vector<vector<Sequence> > GetSeqs(Args &args, Track *trk) {
+  if(args.binary_infile())
+    return GetSeqsFromBinary(args, trk);
   vector<vector<Sequence> > all_seqs;
   assert(args.str_lists_["names"].size() == args.str_lists_["seqs"].size());
+  QueryRecord qry;
   for(size_t iqry = 0; iqry < args.str_lists_["names"].size(); ++iqry) { // loop over queries, where each query can be composed of one, two, or k sequences
-    vector<Sequence> seqs;
-    assert(args.str_lists_["names"][iqry].size() == args.str_lists_["seqs"][iqry].size());
-    for(size_t iseq = 0; iseq < args.str_lists_["names"][iqry].size(); ++iseq) { // loop over each sequence in that query
-      Sequence sq(trk, args.str_lists_["names"][iqry][iseq], args.str_lists_["seqs"][iqry][iseq]);
-      seqs.push_back(sq);
-    }
-    all_seqs.push_back(seqs);
+    ReadTextQuery(args, iqry, trk, qry);
+    all_seqs.push_back(qry.seqs_);
   }
-  assert(all_seqs.size() == args.str_lists_["names"].size());
   return all_seqs;
 }
 
 // ----------------------------------------------------------------------------------------
-void run_algorithm(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args &args) {
+// the glomerator needs everything at once, and expects the per-query info in <args>, so we put it there (but the sequences, at least, are already digitized)
+vector<vector<Sequence> > GetSeqsFromBinary(Args &args, Track *trk) {
+  vector<vector<Sequence> > all_seqs;
+  QueryFileReader reader(args.infile(), trk);
+  QueryRecord qry;
+  while(reader.Next(qry)) {
+    all_seqs.push_back(qry.seqs_);
+    args.integers_["k_v_min"].push_back(qry.k_v_min_);
+    args.integers_["k_v_max"].push_back(qry.k_v_max_);
+    args.integers_["k_d_min"].push_back(qry.k_d_min_);
+    args.integers_["k_d_max"].push_back(qry.k_d_max_);
+    args.integers_["cdr3_length"].push_back(qry.cdr3_length_);
+    args.floats_["mut_freq"].push_back(qry.mut_freq_);
+    args.str_lists_["only_genes"].push_back(qry.only_genes_);
+  }
+  return all_seqs;
+}
 
-  // write csv output headers
-  ofstream ofs;
-  ofs.open(args.outfile());
-  if(!ofs.is_open())
-    throw runtime_error("ERROR --outfile (" + args.outfile() + ") d.n.e.\n");
-  StreamHeader(ofs, args.algorithm());
+// ----------------------------------------------------------------------------------------
+// hands out queries, one at a time, to however many threads are asking for them (reading them from the binary input file as we go, if that's what we've got, unless
+// we need to sort them by cost)
+class QueryQueue {
+public:
+  QueryQueue(Args &args, Track *trk);
+  ~QueryQueue() { delete reader_; }
+  bool Next(QueryRecord &qry, size_t &index);  // fill <qry> and set <index> to its position in the input file, or return false if there aren't any more
+  size_t n_handed_out() { return n_handed_out_; }
 
-  int n_vtb_calculated(0), n_fwd_calculated(0);
+private:
+  void GetRecord(size_t iqry, QueryRecord &qry);  // <iqry>th query in the input file (unless we're streaming)
+  size_t n_queries() { return args_.binary_infile() ? records_.size() : args_.str_lists_["names"].size(); }  // (unless we're streaming)
 
-  for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
-    if(args.debug() > 1) cout << "  ---------" << endl;
-    KSet kmin(args.integers_["k_v_min"][iqry], args.integers_["k_d_min"][iqry]);
-    KSet kmax(args.integers_["k_v_max"][iqry], args.integers_["k_d_max"][iqry]);
-    KBounds kbounds(kmin, kmax);
-    vector<Sequence> qry_seqs(qry_seq_list[iqry]);
+  Args &args_;
+  Track *trk_;
+  QueryFileReader *reader_;  // only set if we're streaming
+  vector<QueryRecord> records_;  // binary input that we had to read all at once
+  vector<size_t> order_;  // order in which to hand out queries (empty if in input order)
+  mutex mutex_;
+  size_t n_handed_out_;
+};
 
-    DPHandler dph(args.algorithm(), &args, gl, hmms);
-    Result result = dph.Run(qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
-    // if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
-    //   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
+// ----------------------------------------------------------------------------------------
+QueryQueue::QueryQueue(Args &args, Track *trk) : args_(args), trk_(trk), reader_(nullptr), n_handed_out_(0) {
+  bool largest_first(args_.schedule() == "largest-first");
+  if(args_.binary_infile()) {
+    reader_ = new QueryFileReader(args_.infile(), trk);
+    if(!largest_first)
+      return;
+    QueryRecord qry;
+    while(reader_->Next(qry))
+      records_.push_back(qry);
+    delete reader_;
+    reader_ = nullptr;
+  }
 
-    if(args.debug() > 1) cout << "       ----" << endl;
+  if(largest_first) {
+    vector<double> costs(n_queries());
+    QueryRecord qry;
+    for(size_t iqry=0; iqry<n_queries(); ++iqry) {
+      GetRecord(iqry, qry);
+      costs[iqry] = qry.EstimatedCost();
+      order_.push_back(iqry);
+    }
+    stable_sort(order_.begin(), order_.end(), [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+  }
+}
 
-    if(result.no_path_)
-      StreamErrorput(ofs, args.algorithm(), qry_seqs, "no_path");
-    else if(args.algorithm() == "viterbi")
-      StreamViterbiOutput(ofs, result.best_event(), qry_seqs, "");
-    else if(args.algorithm() == "forward")
-      StreamForwardOutput(ofs, qry_seqs, result.total_score(), "");
-    else
-      assert(0);
+// ----------------------------------------------------------------------------------------
+void QueryQueue::GetRecord(size_t iqry, QueryRecord &qry) {
+  if(args_.binary_infile()) {
+    qry = records_[iqry];
+    return;
+  }
+  ReadTextQuery(args_, iqry, trk_, qry);
+}
 
-    if(args.algorithm() == "viterbi")
-      ++n_vtb_calculated;
-    else if(args.algorithm() == "forward")
-      ++n_fwd_calculated;
+// ----------------------------------------------------------------------------------------
+bool QueryQueue::Next(QueryRecord &qry, size_t &index) {
+  lock_guard<mutex> lock(mutex_);
+  if(reader_ != nullptr) {
+    if(!reader_->Next(qry))
+      return false;
+    index = n_handed_out_++;
+    return true;
+  }
+
+  if(n_handed_out_ >= n_queries())
+    return false;
+  index = order_.size() > 0 ? order_[n_handed_out_] : n_handed_out_;
+  GetRecord(index, qry);
+  ++n_handed_out_;
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+void run_algorithm(HMMHolder &hmms, GermLines &gl, Args &args, Track *trk) {
+  AnnotationWriter writer(args.outfile(), args.algorithm(), args.output_format());  // writes the header, and then writes in a separate thread
+  QueryQueue queue(args, trk);
+  size_t n_threads(args.n_threads() == 0 ? max(1u, thread::hardware_concurrency()) : args.n_threads());
+  OrderedAnnotationWriter ordered_writer(writer);  // queries can finish out of order with several threads, or with --schedule largest-first
+
+  if(n_threads == 1) {
+    DPHandler dph(args.algorithm(), &args, gl, hmms);  // NOTE Run() clears the dphandler's cache, so we can reuse it for every query
+    QueryRecord qry;
+    size_t index;
+    while(queue.Next(qry, index)) {
+      AnnotationRecord record(run_query(dph, args, qry.seqs_, qry.kbounds(), qry.only_genes_, qry.mut_freq_));
+      ordered_writer.Write(index, record);
+    }
+  } else {
+    // DPHandler rescales the hmms' emissions for each query's mutation frequency (and lazily reads hmms, and indexes GermLines's maps with operator[]), so each
+    // thread gets its own GermLines, HMMHolder, and DPHandler. This means each thread reads its own copy of each hmm, which is cheap with --hmm-bundle, but not with yamls.
+    atomic<bool> failed(false);
+    exception_ptr first_exception(nullptr);
+    mutex exception_mutex;
+    vector<thread> threads;
+    for(size_t ithread=0; ithread<n_threads; ++ithread) {
+      threads.push_back(thread([&]() {
+	try {
+	  GermLines thread_gl(gl);
+	  HMMHolder thread_hmms(args.hmmdir(), thread_gl, trk, args.hmm_bundle());
+	  DPHandler dph(args.algorithm(), &args, thread_gl, thread_hmms);
+	  QueryRecord qry;
+	  size_t index;
+	  while(!failed && queue.Next(qry, index)) {
+	    AnnotationRecord record(run_query(dph, args, qry.seqs_, qry.kbounds(), qry.only_genes_, qry.mut_freq_));
+	    ordered_writer.Write(index, record);
+	  }
+	} catch(...) {
+	  lock_guard<mutex> lock(exception_mutex);
+	  if(!failed)
+	    first_exception = current_exception();
+	  failed = true;
+	}
+      }));
+    }
+    for(auto &thr : threads)
+      thr.join();
+    if(first_exception != nullptr)
+      rethrow_exception(first_exception);
+  }
+  assert(ordered_writer.n_pending() == 0);
+
+  int n_calculated(queue.n_handed_out());
+  int n_vtb_calculated(args.algorithm() == "viterbi" ? n_calculated : 0), n_fwd_calculated(args.algorithm() == "forward" ? n_calculated : 0);
+  {
+    PhaseTimer timer("finish-output");  // most of the writing happens in the writer's thread while we're running queries, so this is just the tail end
+    writer.Close();
+  }
+  if(Profiler *prof = Profiler::Get()) {
+    prof->AddCounter("vtb_calculated", n_vtb_calculated);
+    prof->AddCounter("fwd_calculated", n_fwd_calculated);
   }
   printf("        calcd:   vtb %-4d  fwd %-4d\n", n_vtb_calculated, n_fwd_calculated);
-  ofs.close();
 }
 
+// ----------------------------------------------------------------------------------------
+AnnotationRecord run_query(DPHandler &dph, Args &args, vector<Sequence> &qry_seqs, KBounds kbounds, vector<string> &only_genes, double mut_freq) {
+  if(args.debug() > 1) cout << "  ---------" << endl;
+
+  Result result = dph.Run(qry_seqs, kbounds, only_genes, mut_freq);
+  // if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
+  //   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, only_genes, mut_freq);
+
+  if(args.debug() > 1) cout << "       ----" << endl;
+
+  if(result.no_path_)
+    return AnnotationRecord(qry_seqs, "no_path");
+  else if(args.algorithm() == "viterbi")
+    return AnnotationRecord(result.best_event(), qry_seqs, "");
+  else if(args.algorithm() == "forward")
+    return AnnotationRecord(qry_seqs, result.total_score(), "");
+  else
+    throw runtime_error("unhandled algorithm " + args.algorithm());
+}
 
 // Glomerator *stupid_global_glom;  // I *(#*$$!*ING HATE GLOBALS
 
@@ -302,28 +302,127 @@ void Result::check_boundaries(KSet best, KBounds kbounds) {
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::CacheAll() {
+HMMHolder::HMMHolder(string hmm_dir, GermLines &gl, Track *track, string bundle_fname) :
+  hmm_dir_(hmm_dir),
+  gl_(gl),
+  bundle_(nullptr),
+  track_(track),
+  stop_prefetching_(false)
+{
+  if(bundle_fname != "")
+    bundle_ = new HMMBundle(bundle_fname);
+}
+
+// ----------------------------------------------------------------------------------------
+void HMMHolder::CacheAll(size_t n_threads) {
+  vector<string> genes;
   for(auto & region : gl_.regions_) {
     for(auto & gene : gl_.names_[region]) {
       string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
-      if(ifstream(infname)) {
-        cout << "    read " << infname << endl;
-        hmms_[gene] = new Model;
-        hmms_[gene]->Parse(infname);
-      }
+      if((bundle_ != nullptr && bundle_->Find(gl_.SanitizeName(gene)) >= 0) || ifstream(infname))
+	genes.push_back(gene);
     }
   }
+  Prefetch(genes, n_threads);
+  for(auto &gene : genes)  // wait for them all
+    Get(gene);
+  cout << "    read " << genes.size() << " hmms" << endl;
 }
 
 // ----------------------------------------------------------------------------------------
 Model *HMMHolder::Get(string gene) {
-  if(hmms_.find(gene) == hmms_.end()) {   // if we don't already have it, read it from disk
-    hmms_[gene] = new Model;
+  unique_lock<mutex> lock(mutex_);
+  loaded_cv_.wait(lock, [&]() { return loading_.count(gene) == 0; });  // if a prefetch thread is reading it, wait for it to finish
+  if(hmms_.find(gene) == hmms_.end()) {   // if we don't already have it, read it from disk (the prefetch threads will skip it if it's still in their queue)
+    loading_.insert(gene);
+    lock.unlock();
+    Model *model(nullptr);
+    try {
+      model = Read(gene);
+    } catch(...) {
+      lock.lock();
+      loading_.erase(gene);
+      loaded_cv_.notify_all();
+      throw;
+    }
+    lock.lock();
+    hmms_[gene] = model;
+    loading_.erase(gene);
+    loaded_cv_.notify_all();
+  }
+  return hmms_[gene];
+}
+
+// ----------------------------------------------------------------------------------------
+void HMMHolder::Prefetch(vector<string> genes, size_t n_threads) {
+  lock_guard<mutex> lock(mutex_);
+  for(auto &gene : genes) {
+    if(hmms_.count(gene) == 0 && loading_.count(gene) == 0)
+      prefetch_queue_.push_back(gene);
+  }
+  while(prefetch_threads_.size() < n_threads)
+    prefetch_threads_.push_back(thread(&HMMHolder::PrefetchLoop, this));
+  prefetch_cv_.notify_all();
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE threads wait for more genes when the queue's empty (rather than exiting), so a later Prefetch() call (e.g. the next server request) can reuse them
+void HMMHolder::PrefetchLoop() {
+  while(true) {
+    string gene;
+    {
+      unique_lock<mutex> lock(mutex_);
+      prefetch_cv_.wait(lock, [&]() { return stop_prefetching_ || prefetch_queue_.size() > 0; });
+      while(prefetch_queue_.size() > 0 && (hmms_.count(prefetch_queue_.front()) || loading_.count(prefetch_queue_.front())))  // skip ones that Get() already read (or is reading)
+	prefetch_queue_.pop_front();
+      if(stop_prefetching_)
+	return;
+      if(prefetch_queue_.size() == 0)
+	continue;
+      gene = prefetch_queue_.front();
+      prefetch_queue_.pop_front();
+      loading_.insert(gene);
+    }
+
+    Model *model(nullptr);
+    try {
+      model = Read(gene);
+    } catch(...) {  // leave it for Get() to read, so any exception gets thrown in the caller's thread
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    if(model != nullptr)
+      hmms_[gene] = model;
+    loading_.erase(gene);
+    loaded_cv_.notify_all();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void HMMHolder::StopPrefetching() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_prefetching_ = true;
+  }
+  prefetch_cv_.notify_all();
+  for(auto &thr : prefetch_threads_)
+    thr.join();
+  prefetch_threads_.clear();
+}
+
+// ----------------------------------------------------------------------------------------
+Model *HMMHolder::Read(string gene) {
+  PhaseTimer timer("read-hmms");
+  Model *model(new Model);
+  int imodel(bundle_ == nullptr ? -1 : bundle_->Find(gl_.SanitizeName(gene)));
+  if(imodel >= 0) {
+    model->Load(*bundle_, imodel);
+  } else {  // NOTE if we have a bundle but it doesn't have this gene, we fall back to the yaml
     string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
     // if (true) cout << "    read " << infname << endl;
-    hmms_[gene]->Parse(infname);
+    model->Parse(infname);
   }
-  return hmms_[gene];
+  return model;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -350,13 +449,16 @@ void HMMHolder::UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes)
 
 // ----------------------------------------------------------------------------------------
 HMMHolder::~HMMHolder() {
+  StopPrefetching();
   for(auto & entry : hmms_)
     delete entry.second;
+  delete bundle_;
 }
 
 // ----------------------------------------------------------------------------------------
 string HMMHolder::NameString(map<string, set<string> > *only_genes, int max_to_print) {
   // NOTE this doesn't check that we actually have xeverybody in <only_genes>
+  lock_guard<mutex> lock(mutex_);
   TermColors tc;
   map<string, string> region_strs;
   map<string, int> n_genes;
@@ -392,116 +494,16 @@ string HMMHolder::NameString(map<string, set<string> > *only_genes, int max_to_p
 }
 
 // ----------------------------------------------------------------------------------------
-void StreamHeader(ofstream &ofs, string algorithm) {
-  // NOTE make sure to change this in StreamErrorput() and StreamViterbiOutput() (or StreamForwardOutput()) below!
+string CsvHeader(string algorithm) {
+  // NOTE make sure to change this in AnnotationWriter::AppendCsv() (which writes all of bcrham's annotation and forward csv output)!
   if(algorithm == "viterbi")
-    ofs << "unique_ids,v_gene,d_gene,j_gene,fv_insertion,vd_insertion,dj_insertion,jf_insertion,v_5p_del,v_3p_del,d_5p_del,d_3p_del,j_5p_del,j_3p_del,logprob,seqs,v_per_gene_support,d_per_gene_support,j_per_gene_support,errors" << endl;
+    return "unique_ids,v_gene,d_gene,j_gene,fv_insertion,vd_insertion,dj_insertion,jf_insertion,v_5p_del,v_3p_del,d_5p_del,d_3p_del,j_5p_del,j_3p_del,logprob,seqs,v_per_gene_support,d_per_gene_support,j_per_gene_support,errors";
   else if(algorithm == "forward")
-    ofs << "unique_ids,logprob,errors" << endl;
+    return "unique_ids,logprob,errors";
   else
     throw runtime_error("bad algorithm " + algorithm);
 }
 
-// ----------------------------------------------------------------------------------------
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence*> &pseqs, string errors) {
-  vector<Sequence> seqs(GetSeqVector(pseqs));
-  StreamErrorput(ofs, algorithm, seqs, errors);
-}
-
-// ----------------------------------------------------------------------------------------
-void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence> &seqs, string errors) {
-  if(algorithm == "viterbi") {
-    ofs  // be very, very careful to change this *and* the csv header above at the same time
-      << SeqNameStr(seqs, ":")
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << ","
-      << "," << SeqStr(seqs, ":")
-      << ","
-      << ","
-      << ","
-      << "," << errors
-      << endl;
-  } else {
-    ofs
-      << SeqNameStr(seqs, ":")
-      << ","
-      << "," << errors
-      << endl;
-  }
-
-}
-
-// ----------------------------------------------------------------------------------------
-string PerGeneSupportString(vector<SupportPair> &support) {
-  string return_str;
-  for(size_t is=0; is<support.size(); ++is) {
-    if(is > 0)
-      return_str += ";";
-    return_str += support[is].gene() + ":" + to_string(support[is].logprob());
-  }
-  return return_str;
-}
-
-// ----------------------------------------------------------------------------------------
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence*> &pseqs, string errors) {
-  vector<Sequence> seqs(GetSeqVector(pseqs));
-  StreamViterbiOutput(ofs, event, seqs, errors);
-}
-
-// ----------------------------------------------------------------------------------------
-void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence> &seqs, string errors) {
-  string second_seq_name, second_seq;
-  ofs  // be very, very careful to change this *and* the csv header above at the same time
-    << SeqNameStr(seqs, ":")
-    << "," << event.genes_["v"]
-    << "," << event.genes_["d"]
-    << "," << event.genes_["j"]
-    << "," << event.insertions_["fv"]
-    << "," << event.insertions_["vd"]
-    << "," << event.insertions_["dj"]
-    << "," << event.insertions_["jf"]
-    << "," << event.deletions_["v_5p"]
-    << "," << event.deletions_["v_3p"]
-    << "," << event.deletions_["d_5p"]
-    << "," << event.deletions_["d_3p"]
-    << "," << event.deletions_["j_5p"]
-    << "," << event.deletions_["j_3p"]
-    << "," << event.score_
-    << "," << SeqStr(seqs, ":")
-    << "," << PerGeneSupportString(event.per_gene_support_["v"])
-    << "," << PerGeneSupportString(event.per_gene_support_["d"])
-    << "," << PerGeneSupportString(event.per_gene_support_["j"])
-    << "," << errors
-    << endl;
-}
-
-// ----------------------------------------------------------------------------------------
-void StreamForwardOutput(ofstream &ofs, vector<Sequence*> &pseqs, double total_score, string errors) {
-  vector<Sequence> seqs(GetSeqVector(pseqs));
-  StreamForwardOutput(ofs, seqs, total_score, errors);
-}
-
-// ----------------------------------------------------------------------------------------
-void StreamForwardOutput(ofstream &ofs, vector<Sequence> &seqs, double total_score, string errors) {
-  ofs  // be very, very careful to change this *and* the csv header above at the same time
-    << SeqNameStr(seqs, ":")
-    << "," << total_score
-    << "," << errors
-    << endl;
-}
-
 // ----------------------------------------------------------------------------------------
 string SeqStr(vector<Sequence*> &pseqs, string delimiter) {
   vector<Sequence> seqs(GetSeqVector(pseqs));
@@ -0,0 +1,393 @@
+#include "cachefile.h"
+#include "mathutils.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+void CacheEntry::Update(CacheEntry &other) {
+  if(other.has_logprob_) {
+    logprob_ = other.logprob_;
+    has_logprob_ = true;
+  }
+  if(other.has_naive_hfrac_) {
+    naive_hfrac_ = other.naive_hfrac_;
+    has_naive_hfrac_ = true;
+  }
+  if(other.naive_seq_ != "")
+    naive_seq_ = other.naive_seq_;
+  if(other.errors_ != "")
+    errors_ = other.errors_;
+}
+
+// ----------------------------------------------------------------------------------------
+bool IsBinaryCacheFile(string fname) {
+  ifstream ifs(fname, ios::binary);
+  if(!ifs.is_open())
+    return false;
+  char magic[8];
+  if(!ifs.read(magic, 8))
+    return false;
+  return strncmp(magic, BINARY_CACHE_MAGIC, 8) == 0;
+}
+
+// ----------------------------------------------------------------------------------------
+BinaryCacheReader::BinaryCacheReader(string fname) :
+  fname_(fname),
+  fd_(-1),
+  map_size_(0),
+  data_(nullptr)
+{
+  fd_ = open(fname_.c_str(), O_RDONLY);
+  if(fd_ < 0)
+    throw runtime_error("couldn't open binary cache file " + fname_);
+  struct stat st;
+  if(fstat(fd_, &st) != 0 || size_t(st.st_size) < sizeof(BinaryCacheHeader)) {
+    close(fd_);
+    throw runtime_error("binary cache file " + fname_ + " is too short to have a header");
+  }
+  map_size_ = st.st_size;
+  void *addr = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if(addr == MAP_FAILED) {
+    close(fd_);
+    throw runtime_error("couldn't mmap binary cache file " + fname_);
+  }
+  data_ = (const char*)addr;
+
+  header_ = (const BinaryCacheHeader*)data_;
+  try {  // NOTE the destructor doesn't get called if we throw from here, so we have to clean up ourselves
+    CheckHeader();
+  } catch(...) {
+    munmap((void*)data_, map_size_);
+    close(fd_);
+    throw;
+  }
+
+  records_ = (const BinaryCacheRecord*)(data_ + header_->records_offset);
+  hash_slots_ = (const uint64_t*)(data_ + header_->hash_offset);
+  strings_ = data_ + header_->strings_offset;
+  seqs_ = data_ + header_->seqs_offset;
+}
+
+// ----------------------------------------------------------------------------------------
+// make sure the header is ours, and that each section is inside the file (so a corrupt file throws rather than reading off the end of the mapping)
+void BinaryCacheReader::CheckHeader() {
+  if(strncmp(header_->magic, BINARY_CACHE_MAGIC, 8) != 0)
+    throw runtime_error("bad magic string in binary cache file " + fname_);
+  if(header_->version != BINARY_CACHE_VERSION)
+    throw runtime_error("binary cache file " + fname_ + " has version " + to_string(header_->version) + ", but we only know how to read version " + to_string(BINARY_CACHE_VERSION));
+  if(header_->byte_order != BINARY_CACHE_BYTE_ORDER)
+    throw runtime_error("binary cache file " + fname_ + " was written on a machine with different byte order");
+  if(header_->file_size != map_size_)
+    throw runtime_error("binary cache file " + fname_ + " has size " + to_string(map_size_) + " but header says " + to_string(header_->file_size) + " (truncated?)");
+  if(header_->records_offset % sizeof(uint64_t) != 0 || header_->hash_offset % sizeof(uint64_t) != 0)
+    throw runtime_error("misaligned records or hash table in binary cache file " + fname_);
+  if(header_->n_records > map_size_ / sizeof(BinaryCacheRecord) || !InBounds(header_->records_offset, header_->n_records * sizeof(BinaryCacheRecord), map_size_))
+    throw runtime_error("records extend past the end of binary cache file " + fname_);
+  if(header_->n_hash_slots > map_size_ / sizeof(uint64_t) || !InBounds(header_->hash_offset, header_->n_hash_slots * sizeof(uint64_t), map_size_))
+    throw runtime_error("hash table extends past the end of binary cache file " + fname_);
+  if(header_->strings_offset > header_->seqs_offset || header_->seqs_offset > map_size_)
+    throw runtime_error("bad string or naive seq table offsets in binary cache file " + fname_);
+}
+
+// ----------------------------------------------------------------------------------------
+// make sure everything <record> points to is inside its table
+void BinaryCacheReader::CheckRecord(const BinaryCacheRecord &record) {
+  uint64_t strings_size(header_->seqs_offset - header_->strings_offset), seqs_size(map_size_ - header_->seqs_offset);
+  if(!InBounds(record.key_offset, record.key_length, strings_size) || !InBounds(record.errors_offset, record.errors_length, strings_size))
+    throw runtime_error("key or errors string out of range in binary cache file " + fname_);
+  if((record.flags & HAS_NAIVE_SEQ) && !InBounds(record.naive_seq_offset, sizeof(uint32_t), seqs_size))
+    throw runtime_error("naive seq out of range in binary cache file " + fname_);
+}
+
+// ----------------------------------------------------------------------------------------
+BinaryCacheReader::~BinaryCacheReader() {
+  munmap((void*)data_, map_size_);
+  close(fd_);
+}
+
+// ----------------------------------------------------------------------------------------
+bool BinaryCacheReader::Find(const string &key, CacheEntry &entry) {
+  if(header_->n_hash_slots == 0)
+    return false;
+  uint64_t hash = StableHash(key);
+  uint64_t n_probed(0);
+  for(uint64_t islot = hash % header_->n_hash_slots; hash_slots_[islot] != 0 && n_probed < header_->n_hash_slots; islot = (islot + 1) % header_->n_hash_slots, ++n_probed) {
+    if(hash_slots_[islot] > header_->n_records)
+      throw runtime_error("hash table entry out of range in binary cache file " + fname_);
+    const BinaryCacheRecord &record(records_[hash_slots_[islot] - 1]);
+    CheckRecord(record);
+    if(record.key_hash != hash || record.key_length != key.size() || key.compare(0, string::npos, strings_ + record.key_offset, record.key_length) != 0)
+      continue;
+    Get(hash_slots_[islot] - 1, entry);
+    return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------------------
+void BinaryCacheReader::Get(size_t irecord, CacheEntry &entry) {
+  if(irecord >= header_->n_records)
+    throw runtime_error("record index " + to_string(irecord) + " out of range in " + fname_);
+  const BinaryCacheRecord &record(records_[irecord]);
+  CheckRecord(record);
+  entry = CacheEntry(String(record.key_offset, record.key_length));
+  entry.has_logprob_ = record.flags & HAS_LOGPROB;
+  if(entry.has_logprob_)
+    entry.logprob_ = record.logprob;
+  entry.has_naive_hfrac_ = record.flags & HAS_NAIVE_HFRAC;
+  if(entry.has_naive_hfrac_)
+    entry.naive_hfrac_ = record.naive_hfrac;
+  if(record.flags & HAS_NAIVE_SEQ)
+    entry.naive_seq_ = NaiveSeq(record);
+  entry.errors_ = String(record.errors_offset, record.errors_length);
+}
+
+// ----------------------------------------------------------------------------------------
+set<string> BinaryCacheReader::FailedKeys() {
+  set<string> failed_keys;
+  for(size_t ir=0; ir<header_->n_records; ++ir) {
+    const BinaryCacheRecord &record(records_[ir]);
+    CheckRecord(record);
+    if(record.errors_length > 0 && String(record.errors_offset, record.errors_length).find("no_path") != string::npos)
+      failed_keys.insert(String(record.key_offset, record.key_length));
+  }
+  return failed_keys;
+}
+
+// ----------------------------------------------------------------------------------------
+string BinaryCacheReader::NaiveSeq(const BinaryCacheRecord &record) {
+  static const char bases[] = "ACGT";
+  const char *ptr = seqs_ + record.naive_seq_offset;
+  uint32_t n_runs;
+  memcpy(&n_runs, ptr, sizeof(uint32_t));  // NOTE the seq table isn't aligned, so we have to memcpy rather than cast (CheckRecord() made sure these four bytes are in range)
+  uint64_t seqs_size(map_size_ - header_->seqs_offset);
+  if(!InBounds(record.naive_seq_offset + sizeof(uint32_t), 3 * sizeof(uint32_t) * uint64_t(n_runs) + (record.naive_seq_length + 3) / 4, seqs_size))
+    throw runtime_error("naive seq out of range in binary cache file " + fname_);
+  const char *runs = ptr + sizeof(uint32_t);
+  const unsigned char *packed = (const unsigned char*)(runs + 3 * sizeof(uint32_t) * n_runs);
+
+  string naive_seq(record.naive_seq_length, ' ');
+  for(size_t ip=0; ip<naive_seq.size(); ++ip)
+    naive_seq[ip] = bases[(packed[ip / 4] >> (2 * (ip % 4))) & 3];
+  for(size_t ir=0; ir<n_runs; ++ir) {
+    uint32_t run[3];  // start, length, character
+    memcpy(run, runs + 3 * sizeof(uint32_t) * ir, sizeof(run));
+    if(!InBounds(run[0], run[1], naive_seq.size()))
+      throw runtime_error("naive seq run out of range in binary cache file " + fname_);
+    for(size_t ip=run[0]; ip<run[0] + run[1]; ++ip)
+      naive_seq[ip] = char(run[2]);
+  }
+  return naive_seq;
+}
+
+// ----------------------------------------------------------------------------------------
+// append the run list and 2-bit packed version of <naive_seq> to <seq_table>
+void PackNaiveSeq(string &naive_seq, string &seq_table) {
+  vector<uint32_t> runs;
+  string packed((naive_seq.size() + 3) / 4, '\0');
+  for(size_t ip=0; ip<naive_seq.size(); ++ip) {
+    size_t ibase(0);
+    switch(naive_seq[ip]) {
+    case 'A': ibase = 0; break;
+    case 'C': ibase = 1; break;
+    case 'G': ibase = 2; break;
+    case 'T': ibase = 3; break;
+    default:
+      if(runs.size() > 0 && runs[runs.size() - 3] + runs[runs.size() - 2] == ip && runs.back() == uint32_t((unsigned char)naive_seq[ip])) {  // extend the previous run
+	++runs[runs.size() - 2];
+      } else {
+	runs.push_back(ip);
+	runs.push_back(1);
+	runs.push_back((unsigned char)naive_seq[ip]);
+      }
+      continue;
+    }
+    packed[ip / 4] |= char(ibase << (2 * (ip % 4)));
+  }
+  uint32_t n_runs(runs.size() / 3);
+  seq_table.append((const char*)&n_runs, sizeof(uint32_t));
+  if(runs.size() > 0)
+    seq_table.append((const char*)runs.data(), sizeof(uint32_t) * runs.size());
+  seq_table.append(packed);
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE we write to a temporary file and then rename it, since <fname> may well be the file that a BinaryCacheReader (maybe even ours) has mmap'd
+void WriteBinaryCacheFile(string fname, vector<CacheEntry> &entries) {
+  BinaryCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BINARY_CACHE_MAGIC, 8);
+  header.version = BINARY_CACHE_VERSION;
+  header.byte_order = BINARY_CACHE_BYTE_ORDER;
+  header.n_records = entries.size();
+  header.n_hash_slots = 1;
+  while(header.n_hash_slots < 2 * entries.size())  // keep the load factor at or below one half, so probe sequences stay short
+    header.n_hash_slots *= 2;
+
+  vector<BinaryCacheRecord> records(entries.size());
+  vector<uint64_t> hash_slots(header.n_hash_slots, 0);
+  string string_table, seq_table;
+  for(size_t ie=0; ie<entries.size(); ++ie) {
+    CacheEntry &entry(entries[ie]);
+    BinaryCacheRecord &record(records[ie]);
+    memset(&record, 0, sizeof(record));
+    record.key_hash = StableHash(entry.key_);
+    record.key_offset = string_table.size();
+    record.key_length = entry.key_.size();
+    string_table += entry.key_;
+    record.errors_offset = string_table.size();
+    record.errors_length = entry.errors_.size();
+    string_table += entry.errors_;
+    if(entry.has_logprob_) {
+      record.flags |= HAS_LOGPROB;
+      record.logprob = entry.logprob_;
+    }
+    if(entry.has_naive_hfrac_) {
+      record.flags |= HAS_NAIVE_HFRAC;
+      record.naive_hfrac = entry.naive_hfrac_;
+    }
+    if(entry.naive_seq_ != "") {
+      record.flags |= HAS_NAIVE_SEQ;
+      record.naive_seq_offset = seq_table.size();
+      record.naive_seq_length = entry.naive_seq_.size();
+      PackNaiveSeq(entry.naive_seq_, seq_table);
+    }
+    if(!entry.failed()) {  // same thing that gets counted when we read a csv file
+      if(entry.has_logprob_)
+	++header.n_logprobs;
+      if(entry.naive_seq_ != "")
+	++header.n_naive_seqs;
+    }
+
+    uint64_t islot(record.key_hash % header.n_hash_slots);
+    while(hash_slots[islot] != 0) {
+      if(entries[hash_slots[islot] - 1].key_ == entry.key_)
+	throw runtime_error("duplicate key " + entry.key_ + " when writing binary cache file " + fname);
+      islot = (islot + 1) % header.n_hash_slots;
+    }
+    hash_slots[islot] = ie + 1;
+  }
+
+  header.records_offset = sizeof(BinaryCacheHeader);
+  header.hash_offset = header.records_offset + sizeof(BinaryCacheRecord) * records.size();
+  header.strings_offset = header.hash_offset + sizeof(uint64_t) * hash_slots.size();
+  header.seqs_offset = header.strings_offset + string_table.size();
+  header.file_size = header.seqs_offset + seq_table.size();
+
+  string tmpfname(fname + ".tmp");
+  ofstream ofs(tmpfname, ios::binary);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open output cache file " + tmpfname);
+  ofs.write((const char*)&header, sizeof(header));
+  ofs.write((const char*)records.data(), sizeof(BinaryCacheRecord) * records.size());
+  ofs.write((const char*)hash_slots.data(), sizeof(uint64_t) * hash_slots.size());
+  ofs.write(string_table.data(), string_table.size());
+  ofs.write(seq_table.data(), seq_table.size());
+  ofs.close();
+  if(!ofs)
+    throw runtime_error("failed writing binary cache file " + tmpfname);
+  if(rename(tmpfname.c_str(), fname.c_str()) != 0)
+    throw runtime_error("couldn't move " + tmpfname + " to " + fname);
+}
+
+// ----------------------------------------------------------------------------------------
+void ReadCsvCacheFile(string fname, map<string, CacheEntry> &entries, bool skip_partial_last_line) {
+  ifstream ifs(fname);
+  if(!ifs.is_open())
+    throw runtime_error("input cache file " + fname + " dne\n");
+  string line;
+  if(!getline(ifs, line))  // zero length file
+    return;
+  line.erase(remove(line.begin(), line.end(), '\r'), line.end());
+  if(line.find("unique_ids,logprob,naive_seq,naive_hfrac,errors") != 0)
+    throw runtime_error("unexpected header in csv cache file " + fname + ": " + line);
+
+  while(getline(ifs, line)) {
+    if(skip_partial_last_line && ifs.eof()) {  // no newline at the end, so the writer didn't finish this line (and it may well have five columns, but with a truncated value)
+      cout << "    skipping partial last line in " << fname << endl;
+      break;
+    }
+    line.erase(remove(line.begin(), line.end(), '\r'), line.end());
+    vector<string> column_list = SplitString(line, ",");
+    if(column_list.size() != 5)
+      throw runtime_error("wrong number of columns in line '" + line + "' of " + fname);
+    CacheEntry entry(column_list[0]);
+    if(column_list[1].size() > 0) {
+      entry.logprob_ = stod(column_list[1]);
+      entry.has_logprob_ = true;
+    }
+    entry.naive_seq_ = column_list[2];
+    if(column_list[3].size() > 0) {
+      entry.naive_hfrac_ = stod(column_list[3]);
+      entry.has_naive_hfrac_ = true;
+    }
+    entry.errors_ = column_list[4];
+    if(entries.count(entry.key_))
+      entries[entry.key_].Update(entry);
+    else
+      entries[entry.key_] = entry;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+bool TrimPartialLastLine(string fname) {
+  ifstream ifs(fname, ios::binary | ios::ate);
+  if(!ifs.is_open())
+    return false;
+  streamoff size(ifs.tellg());
+  if(size == 0)
+    return false;
+  char ch;
+  ifs.seekg(size - 1);
+  if(!ifs.get(ch))
+    throw runtime_error("couldn't read last byte of " + fname);
+  if(ch == '\n')
+    return false;
+
+  // journals can be huge, so scan backwards from the end in chunks rather than reading the whole thing
+  off_t new_size(0);  // if there's no newline at all, the whole file is a partial line
+  const streamoff chunk_size(1 << 16);
+  string chunk;
+  for(streamoff end = size; end > 0 && new_size == 0; end -= chunk_size) {
+    streamoff begin(max(streamoff(0), end - chunk_size));
+    chunk.resize(end - begin);
+    ifs.seekg(begin);
+    if(!ifs.read(&chunk[0], chunk.size()))
+      throw runtime_error("couldn't read " + fname + " while looking for its last newline");
+    size_t inewline(chunk.rfind('\n'));
+    if(inewline != string::npos)
+      new_size = begin + inewline + 1;
+  }
+  ifs.close();
+  if(truncate(fname.c_str(), new_size) != 0)
+    throw runtime_error("couldn't truncate partial last line in " + fname);
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+void WriteCsvCacheHeader(ofstream &ofs) {
+  ofs << "unique_ids,logprob,naive_seq,naive_hfrac,errors" << endl;  // these have to match the line in ReadCsvCacheFile(), as well as partition_cachefile_headers in utils.py
+  ofs << setprecision(20);
+}
+
+// ----------------------------------------------------------------------------------------
+void WriteCsvCacheLine(ofstream &ofs, CacheEntry &entry) {
+  ofs << entry.key_ << ",";
+  if(entry.has_logprob_)
+    ofs << entry.logprob_;
+  ofs << "," << entry.naive_seq_ << ",";
+  if(entry.has_naive_hfrac_)
+    ofs << entry.naive_hfrac_;
+  ofs << "," << entry.errors_ << endl;
+}
+
+}
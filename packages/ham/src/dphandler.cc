@@ -5,7 +5,8 @@ DPHandler::DPHandler(string algorithm, Args *args, GermLines &gl, HMMHolder &hmm
   algorithm_(algorithm),
   args_(args),
   gl_(gl),
-  hmms_(hmms)
+  hmms_(hmms),
+  n_cells_(0)
 {
 }
 
@@ -23,23 +24,23 @@ void DPHandler::Clear() {
 }
 
 // ----------------------------------------------------------------------------------------
-Sequences DPHandler::GetSubSeqs(Sequences &seqs, KSet kset, string region) {
-  // get subsequences for one region
+SequencesView DPHandler::GetSubSeqs(Sequences &seqs, KSet kset, string region) {
+  // get subsequences for one region (these are views into <seqs>, so they don't copy anything)
   size_t k_v(kset.v), k_d(kset.d);
   if(region == "v")
-    return Sequences(seqs, 0, k_v);  // v region (plus vd insert) runs from zero up to k_v
+    return SequencesView(seqs, 0, k_v);  // v region (plus vd insert) runs from zero up to k_v
   else if(region == "d")
-    return Sequences(seqs, k_v, k_d);  // d region (plus dj insert) runs from k_v up to k_v + k_d
+    return SequencesView(seqs, k_v, k_d);  // d region (plus dj insert) runs from k_v up to k_v + k_d
   else if(region == "j")
-    return Sequences(seqs, k_v + k_d, seqs.GetSequenceLength() - k_v - k_d);  // j region runs from k_v + k_d to end
+    return SequencesView(seqs, k_v + k_d, seqs.GetSequenceLength() - k_v - k_d);  // j region runs from k_v + k_d to end
   else
     assert(0);
 }
 
 // ----------------------------------------------------------------------------------------
-map<string, Sequences> DPHandler::GetSubSeqs(Sequences &seqs, KSet kset) {
+map<string, SequencesView> DPHandler::GetSubSeqs(Sequences &seqs, KSet kset) {
   // get subsequences for all regions
-  map<string, Sequences> subseqs;
+  map<string, SequencesView> subseqs;
   for(auto & region : gl_.regions_)
     subseqs[region] = GetSubSeqs(seqs, kset, region);
   return subseqs;
@@ -60,11 +61,15 @@ Result DPHandler::Run(vector<Sequence*> pseqvector, KBounds kbounds, vector<stri
 
 // ----------------------------------------------------------------------------------------
 Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq, bool clear_cache) {
-  clock_t run_start(clock());
-
   Sequences seqs;
   for(auto &seq : seqvector)
     seqs.AddSeq(seq);
+  return Run(seqs, kbounds, only_gene_list, overall_mute_freq, clear_cache);
+}
+
+// ----------------------------------------------------------------------------------------
+Result DPHandler::Run(Sequences &seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq, bool clear_cache) {
+  clock_t run_start(clock());
 
   // convert <only_gene_list> to a set for each region
   map<string, set<string> > only_genes;
@@ -213,20 +218,21 @@ void DPHandler::PrintCachedTrellisSize() {
 }
 
 // ----------------------------------------------------------------------------------------
-void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin) {
+// NOTE the trellises in <scratch_cachefo_> keep a view of <query_seqs>, so they're only good until the end of Run() (which is fine, since we Clear() them at the start of each Run())
+uint64_t DPHandler::FillTrellis(KSet kset, SequencesView query_seqs, string gene, string &origin) {
 
   Trellis *cached_trellis(nullptr);
   if(!args_->no_chunk_cache()) {   // figure out if we've already got a trellis with a dp table which includes the one we're about to calculate (we should, unless this is the first kset)
     // NOTE we're no longer looking through previously chunk cached cachefo here. Which I think is ok, but possible only because we loop over ksets in decreasing order (?)
     for(auto &kv : scratch_cachefo_[gene]) {  // kv: (query string vector, trellis)
-      vector<string> cached_query_strs(kv.first);
-      if(cached_query_strs.size() != query_strs.size())  // have to have same number of sequences (it'd be much harder for this to happen now that I'm now reusing dphandlers)
+      const vector<string> &cached_query_strs(kv.first);
+      if(cached_query_strs.size() != query_seqs.n_seqs())  // have to have same number of sequences (it'd be much harder for this to happen now that I'm now reusing dphandlers)
 	continue;
 
       // loop over all the query strings for this trellis to see if they all match
       bool found_match(true);
-      for(size_t iseq = 0; iseq < cached_query_strs.size(); ++iseq) {  // NOTE this starts to seem like it might be bottlenecking me when I'm applying it for short d sequences
-        if(cached_query_strs[iseq].find(query_strs[iseq]) != 0) {  // if <query_strs[iseq]> (the current query) doesn't appear starting at position zero in <cached_query_strs[iseq]> (a previously cached query), we'll need to recalculate
+      for(size_t iseq = 0; iseq < cached_query_strs.size(); ++iseq) {
+        if(!query_seqs.IsPrefixOf(iseq, cached_query_strs[iseq])) {  // if the current query doesn't appear starting at position zero in <cached_query_strs[iseq]> (a previously cached query), we'll need to recalculate
           found_match = false;
           break;
         }
@@ -243,8 +249,12 @@ void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> quer
   Trellis tmptrell(hmms_.Get(gene), query_seqs, cached_trellis);  // NOTE chunk cached trellisi don't get kept around -- we should be able to always just go back to the original one
   Trellis *trell(&tmptrell);  // convenience pointer
   if(cached_trellis == nullptr) {   // if we didn't find a suitable chunk cached trellis
-    scratch_cachefo_[gene][query_strs] = Trellis(hmms_.Get(gene), query_seqs);
-    trell = &scratch_cachefo_[gene][query_strs];
+    vector<string> query_strs;  // this is the only place we need to copy the subsequences out as strings (to use as the cache key)
+    for(size_t iseq = 0; iseq < query_seqs.n_seqs(); ++iseq)
+      query_strs.push_back(query_seqs.undigitized(iseq));
+    Trellis &scratch_trellis(scratch_cachefo_[gene][query_strs]);
+    scratch_trellis = Trellis(hmms_.Get(gene), query_seqs);
+    trell = &scratch_trellis;
     origin = "scratch";
   } else {
     origin = "chunk";
@@ -268,6 +278,7 @@ void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> quer
   // correct the score for gene choice probs
   double gene_choice_score = log(hmms_.Get(gene)->overall_prob());
   scores_[gene][kset] = AddWithMinusInfinities(uncorrected_score, gene_choice_score);
+  return trell->n_cells();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -363,10 +374,10 @@ RecoEvent DPHandler::FillRecoEvent(Sequences &seqs, KSet kset, map<string, strin
 
 // ----------------------------------------------------------------------------------------
 vector<string> DPHandler::GetQueryStrs(Sequences &seqs, KSet kset, string region) {
-  Sequences query_seqs(GetSubSeqs(seqs, kset, region));
+  SequencesView query_seqs(GetSubSeqs(seqs, kset, region));
   vector<string> query_strs;
   for(size_t iseq = 0; iseq < seqs.n_seqs(); ++iseq)
-    query_strs.push_back(query_seqs[iseq].undigitized());
+    query_strs.push_back(query_seqs.undigitized(iseq));
   return query_strs;
 }
 
@@ -401,7 +412,7 @@ void DPHandler::InitCache(string gene) {
 
 // ----------------------------------------------------------------------------------------
 void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes) {
-  map<string, Sequences> subseqs(GetSubSeqs(seqs, kset));
+  map<string, SequencesView> subseqs(GetSubSeqs(seqs, kset));
   (*best_scores)[kset] = -INFINITY;
   (*total_scores)[kset] = -INFINITY;  // total log prob of this kset, i.e. log(P_v * P_d * P_j), where e.g. P_v = \sum_i P(v_i k_v)
   (*best_genes)[kset] = map<string, string>();
@@ -415,7 +426,9 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
     printf(" %s\n", "---------------");
   }
   for(auto & region : gl_.regions_) {
-    vector<string> query_strs(GetQueryStrs(seqs, kset, region));
+    vector<string> query_strs;  // only needed for debug printing (FillTrellis() works directly on <subseqs>)
+    if(args_->debug() == 2)
+      query_strs = GetQueryStrs(seqs, kset, region);
 
     TermColors tc;
     if(args_->debug() == 2) {
@@ -433,6 +446,11 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
     for(auto & gene : only_genes[region]) {
       InitCache(gene);
       string origin;
+      Profiler *prof(Profiler::Get());
+      chrono::steady_clock::time_point fill_start;
+      if(prof)
+	fill_start = chrono::steady_clock::now();
+      uint64_t n_cells(0);
       KSet partial_cache_match(FindPartialCacheMatch(region, gene, kset));  // "partial" in the sense that only this region's query sequence(s) need to be the same
       if(!partial_cache_match.isnull()) {  // first see if we have a match for these exact strings
 	paths_[gene][kset] = paths_[gene][partial_cache_match];
@@ -440,8 +458,11 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
 	// NOTE that we don't put anything about this gene/kset combo into the trellis caches. Which is fine now, since later we'll only need the path and score info
 	origin = "cached";
       } else {  // no exact cache match, so proceed to check for chunk caching (if that fails it'll actually calculate things)
-	FillTrellis(kset, subseqs[region], query_strs, gene, origin);
+	n_cells = FillTrellis(kset, subseqs[region], gene, origin);
       }
+      n_cells_ += n_cells;
+      if(prof)
+	prof->CountTrellis(region, gene, origin, n_cells, chrono::duration<double>(chrono::steady_clock::now() - fill_start).count());
 
       double gene_score(scores_[gene][kset]);  // convenience variable
       if(args_->debug() == 2 && algorithm_ == "viterbi")
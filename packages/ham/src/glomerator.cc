@@ -3,23 +3,54 @@
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track) :
+Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track, map<string, CacheEntry> *warm_cache) :
   track_(track),
   args_(args),
   gl_(gl),
   hmms_(hmms),
+  profile_bytes_(0),
+  naive_seq_index_(args_->hamming_fraction_bound_hi(), args_->ambig_base()),
+  use_naive_seq_index_(false),
+  input_cache_(nullptr),
+  warm_cache_(warm_cache),
   n_fwd_calculated_(0),
   n_vtb_calculated_(0),
   n_hfrac_calculated_(0),
   n_hfrac_merges_(0),
   n_lratio_merges_(0),
+  n_pairs_evicted_(0),
+  n_budget_clears_(0),
+  n_profiles_evicted_(0),
   asym_factor_(4.),
   force_merge_(false),
   current_partition_(nullptr),
-  progress_file_(fopen((args_->outfile() + ".progress").c_str(), "w"))
+  progress_file_(fopen((args_->outfile() + ".progress").c_str(), "w")),
+  n_dp_cells_(0),
+  metrics_file_(nullptr),
+  last_metrics_n_merges_(0),
+  last_metrics_n_dp_cells_(0)
 {
   time(&last_status_write_time_);
+  start_time_ = last_metrics_time_ = chrono::steady_clock::now();
+  if(args_->metrics_file() != "") {
+    metrics_file_ = fopen(args_->metrics_file().c_str(), "a");  // append, so several processes (or several server requests) can share a file
+    if(metrics_file_ == nullptr)
+      throw runtime_error("couldn't open metrics file " + args_->metrics_file());
+  }
   ReadCacheFile();
+  OpenCacheJournal();
+  if(warm_cache_ != nullptr) {  // like the binary input cache, the warm cache gets read lazily, except for failed queries
+    for(auto &kv : *warm_cache_) {
+      if(!kv.second.failed())
+	continue;
+      failed_queries_.insert(kv.first);
+      errors_[kv.first] = kv.second.errors_;
+    }
+  }
+
+  for(auto &seq_vec : qry_seq_list)
+    for(auto &seq : seq_vec)
+      single_seqs_[seq.name()] = seq;
 
   for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
     string key = SeqNameStr(qry_seq_list[iqry], ":");
@@ -28,10 +59,6 @@ Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> >
 
     initial_partition_.insert(key);
 
-    for(auto &seq_vec : qry_seq_list)
-      for(auto &seq : seq_vec)
-	single_seqs_[seq.name()] = seq;
-
     for(auto &uid : SplitString(key)) {
       single_seq_cachefo_[uid] = Query(uid,  // NOTE these are not necessarily the same as they would be (well, were) for the single seqs -- e.g. only_genes is now the OR for all the sequences
 				       GetSeqs(uid),
@@ -51,14 +78,33 @@ Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> >
 			  args_->integers_["cdr3_length"][iqry]);
   }
 
+  if(args_->pack_sequences()) {  // NOTE Query objects hold pointers into <single_seqs_>, so we have to pack in place
+    for(auto &kv : single_seqs_)
+      kv.second.Pack();
+  }
+
   current_partition_ = &initial_partition_;
 }
 
 // ----------------------------------------------------------------------------------------
 Glomerator::~Glomerator() {
   cout << FinalString(true) << endl;
+  if(Profiler *prof = Profiler::Get()) {
+    prof->AddCounter("vtb_calculated", n_vtb_calculated_);
+    prof->AddCounter("fwd_calculated", n_fwd_calculated_);
+    prof->AddCounter("hfrac_calculated", n_hfrac_calculated_);
+    prof->AddCounter("hfrac_merges", n_hfrac_merges_);
+    prof->AddCounter("lratio_merges", n_lratio_merges_);
+  }
+  FlushCacheJournal();
   WriteCacheFile();
+  UpdateWarmCache();
+  delete input_cache_;
   fclose(progress_file_);
+  if(metrics_file_ != nullptr) {
+    WriteMetrics(time(nullptr), true);
+    fclose(metrics_file_);
+  }
   remove((args_->outfile() + ".progress").c_str());
 
 // // ----------------------------------------------------------------------------------------
@@ -94,6 +140,9 @@ void Glomerator::Cluster() {
   if(args_->logprob_ratio_threshold() == -INFINITY)
     throw runtime_error("logprob ratio threshold not specified");
 
+  if(args_->naive_seq_index())
+    InitNaiveSeqIndex(initial_partition_);
+
   ClusterPath cp(initial_partition_);
   do {
     Merge(&cp);
@@ -117,73 +166,93 @@ void Glomerator::ReadCacheFile() {
     return;
   }
 
-  ifstream ifs(args_->input_cachefname());
-  if(!ifs.is_open())
-    throw runtime_error("input cache file " + args_->input_cachefname() + " dne\n");
-
-  string line;
-  // check the header is right (no cached info)
-  if(!getline(ifs, line)) {
-    cout << "        empty cachefile" << endl;
-    return;  // return for zero length file
-  }
-  line.erase(remove(line.begin(), line.end(), '\r'), line.end());
-  vector<string> headstrs(SplitString(line, ","));
-  assert(headstrs[0].find("unique_ids") == 0);  // these have to match the line in WriteCacheFile(), as well as partition_cachefile_headers in utils.py
-  assert(headstrs[1].find("logprob") == 0);
-  assert(headstrs[2].find("naive_seq") == 0);
-  assert(headstrs[3].find("naive_hfrac") == 0);
-  assert(headstrs[4].find("errors") == 0);
-
-  // NOTE there can be two lines with the same key (say if in one run we calculated the naive seq, and in a later run calculated the log prob)
-  while(getline(ifs, line)) {
-    line.erase(remove(line.begin(), line.end(), '\r'), line.end());
-    vector<string> column_list = SplitString(line, ",");
-    assert(column_list.size() == 5);
-    string query(column_list[0]);
-    string errors(column_list[4]);
-    if(errors.find("no_path") != string::npos) {
+  if(IsBinaryCacheFile(args_->input_cachefname())) {  // binary files get mmap'd and read lazily in LoadFromInputCache(), except that we need to know about failed queries up front
+    input_cache_ = new BinaryCacheReader(args_->input_cachefname());
+    for(auto &query : input_cache_->FailedKeys())
       failed_queries_.insert(query);
-      continue;
-    }
+    cout << "        read-cache:  logprobs " << input_cache_->n_logprobs() << "   naive-seqs " << input_cache_->n_naive_seqs() << endl;
+    return;
+  }
 
-    string logprob_str(column_list[1]);
-    if(logprob_str.size() > 0) {  // NOTE <query> might already be in <log_probs_> (see above), but this won't replace it unless it's actually set in the file (we could also check that they're similar, but since we don't expect them to always be identical, that would be complicated)
-      log_probs_[query] = stof(logprob_str);
-      initial_log_probs_.insert(query);
-    }
+  map<string, CacheEntry> entries;
+  ReadCsvCacheFile(args_->input_cachefname(), entries);  // NOTE there can be two lines with the same key (say if in one run we calculated the naive seq, and in a later run calculated the log prob), which this combines
+  for(auto &kv : entries) {
+    if(kv.second.failed())
+      failed_queries_.insert(kv.first);
+    else
+      LoadCacheEntry(kv.second, true);
+  }
+  cout << "        read-cache:  logprobs " << log_probs_.size() << "   naive-seqs " << naive_seqs_.size() << endl;
+}
 
-    string naive_seq(column_list[2]);
+// ----------------------------------------------------------------------------------------
+// NOTE this never replaces anything we already have, since we may have calculated (or evicted and recalculated) it since starting
+void Glomerator::LoadFromInputCache(string key) {
+  CacheEntry entry;
+  if(input_cache_ != nullptr && input_cache_->Find(key, entry) && !entry.failed())  // failed ones are already in <failed_queries_>
+    LoadCacheEntry(entry, true);
+  if(warm_cache_ != nullptr && warm_cache_->count(key) && !warm_cache_->at(key).failed())  // NOTE not initial, since they weren't in this run's input cache file
+    LoadCacheEntry(warm_cache_->at(key), false);
+}
 
-    string naive_hfrac_str(column_list[3]);
-    if(naive_hfrac_str.size() > 0) {
-      naive_hfracs_[query] = stof(naive_hfrac_str);
-      initial_naive_hfracs_.insert(query);
-    }
+// ----------------------------------------------------------------------------------------
+// copy anything in <entry> that we don't already have into our maps (and if <initial>, mark it as having come from the input cache file)
+void Glomerator::LoadCacheEntry(CacheEntry &entry, bool initial) {
+  string &key(entry.key_);
+  if(entry.has_logprob_ && log_probs_.count(key) == 0) {
+    log_probs_[key] = entry.logprob_;
+    if(initial)
+      initial_log_probs_.insert(key);
+  }
+  if(entry.has_naive_hfrac_ && naive_hfracs_.count(key) == 0) {
+    naive_hfracs_[key] = entry.naive_hfrac_;
+    if(initial)
+      initial_naive_hfracs_.insert(key);
+  }
+  if(entry.naive_seq_ != "" && naive_seqs_.count(key) == 0) {
+    naive_seqs_[key] = entry.naive_seq_;
+    if(initial)
+      initial_naive_seqs_.insert(key);
+  }
+}
 
-    if(naive_seq.size() > 0) {
-      naive_seqs_[query] = naive_seq;
-      initial_naive_seqs_.insert(query);
-    }
+// ----------------------------------------------------------------------------------------
+// add our log probs and naive seqs (and failures) to the caller's warm cache, so later runs in the same process don't have to recalculate them.
+// NOTE we don't pass on naive hfracs, since they're cheap and there's a ton of them
+void Glomerator::UpdateWarmCache() {
+  if(warm_cache_ == nullptr)
+    return;
+  set<string> keys(failed_queries_);
+  for(auto &kv : log_probs_)
+    keys.insert(kv.first);
+  for(auto &kv : naive_seqs_)
+    keys.insert(kv.first);
+  for(auto &key : keys) {
+    CacheEntry entry(GetCacheEntry(key));
+    entry.has_naive_hfrac_ = false;
+    if(warm_cache_->count(key))
+      warm_cache_->at(key).Update(entry);
+    else
+      (*warm_cache_)[key] = entry;
   }
-  cout << "        read-cache:  logprobs " << log_probs_.size() << "   naive-seqs " << naive_seqs_.size() << endl;
 }
 
 // ----------------------------------------------------------------------------------------
-void Glomerator::WriteCacheLine(ofstream &ofs, string query) {
-  ofs << query << ",";
-  if(log_probs_.count(query))
-    ofs << log_probs_[query];
-  ofs << ",";
+CacheEntry Glomerator::GetCacheEntry(string query) {
+  CacheEntry entry(query);
+  if(log_probs_.count(query)) {
+    entry.logprob_ = log_probs_[query];
+    entry.has_logprob_ = true;
+  }
   if(naive_seqs_.count(query))
-    ofs << naive_seqs_[query];
-  ofs << ",";
-  if(args_->cache_naive_hfracs() && naive_hfracs_.count(query))
-    ofs << naive_hfracs_[query];
-  ofs << ",";
+    entry.naive_seq_ = naive_seqs_[query];
+  if(args_->cache_naive_hfracs() && naive_hfracs_.count(query)) {
+    entry.naive_hfrac_ = naive_hfracs_[query];
+    entry.has_naive_hfrac_ = true;
+  }
   if(errors_.count(query))
-    ofs << errors_[query];
-  ofs << endl;
+    entry.errors_ = errors_[query];
+  return entry;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -191,13 +260,6 @@ void Glomerator::WriteCacheFile() {
   if(args_->output_cachefname() == "")
     return;
 
-  ofstream log_prob_ofs(args_->output_cachefname());
-  if(!log_prob_ofs.is_open())
-    throw runtime_error("couldn't open output cache file " + args_->output_cachefname() + "\n");
-
-  log_prob_ofs << "unique_ids,logprob,naive_seq,naive_hfrac,errors" << endl;  // these have to match the line in ReadCacheFile(), as well as partition_cachefile_headers in utils.py
-  log_prob_ofs << setprecision(20);
-
   set<string> keys_to_cache;
   for(auto &kv : log_probs_) {
     if(args_->only_cache_new_vals() && initial_log_probs_.count(kv.first))  // don't cache it if we had it in the initial cache file (this is just an optimization)
@@ -217,12 +279,103 @@ void Glomerator::WriteCacheFile() {
     }
   }
 
-  for(auto &key : keys_to_cache)
-    WriteCacheLine(log_prob_ofs, key);
+  // NOTE we need to get everything out of <input_cache_> before opening the output file, since they're often the same file
+  map<string, CacheEntry> entries;
+  if(input_cache_ != nullptr && !args_->only_cache_new_vals()) {  // with a csv input cache, everything in it is already in our maps, but with a binary one we've only loaded what we've looked at
+    for(size_t ir=0; ir<input_cache_->size(); ++ir) {
+      CacheEntry entry;
+      input_cache_->Get(ir, entry);
+      if(!args_->cache_naive_hfracs())
+	entry.has_naive_hfrac_ = false;
+      if(entry.empty())
+	continue;
+      entries[entry.key_] = entry;
+    }
+  }
+  for(auto &key : keys_to_cache) {
+    CacheEntry entry(GetCacheEntry(key));
+    if(entries.count(key))
+      entries[key].Update(entry);
+    else
+      entries[key] = entry;
+  }
+
+  if(args_->binary_cache()) {
+    vector<CacheEntry> entry_list;
+    for(auto &kv : entries)
+      entry_list.push_back(kv.second);
+    WriteBinaryCacheFile(args_->output_cachefname(), entry_list);
+    return;
+  }
 
+  ofstream log_prob_ofs(args_->output_cachefname());
+  if(!log_prob_ofs.is_open())
+    throw runtime_error("couldn't open output cache file " + args_->output_cachefname() + "\n");
+  WriteCsvCacheHeader(log_prob_ofs);
+  for(auto &kv : entries)
+    WriteCsvCacheLine(log_prob_ofs, kv.second);
   log_prob_ofs.close();
 }
 
+// ----------------------------------------------------------------------------------------
+// read anything that a previous (presumably killed) run with the same journal file managed to write, then open it for appending
+void Glomerator::OpenCacheJournal() {
+  if(args_->cache_journal() == "")
+    return;
+
+  if(TrimPartialLastLine(args_->cache_journal()))
+    cout << "        removed partial last line from cache journal " << args_->cache_journal() << endl;
+  ifstream ifs(args_->cache_journal());
+  bool new_file(!ifs.is_open() || ifs.peek() == ifstream::traits_type::eof());
+  ifs.close();
+
+  if(!new_file) {
+    map<string, CacheEntry> entries;
+    ReadCsvCacheFile(args_->cache_journal(), entries);
+    for(auto &kv : entries) {  // NOTE these aren't added to the initial_* sets, since they're new with respect to the input cache file, so we want them in the output cache file
+      CacheEntry &entry(kv.second);
+      if(entry.errors_ != "")
+	errors_[entry.key_] = entry.errors_;
+      if(entry.failed()) {
+	failed_queries_.insert(entry.key_);
+	continue;
+      }
+      LoadCacheEntry(entry, false);
+    }
+    cout << "        read-journal:  " << entries.size() << " entries" << endl;
+  }
+
+  journal_ofs_.open(args_->cache_journal(), ios::app);
+  if(!journal_ofs_.is_open())
+    throw runtime_error("couldn't open cache journal " + args_->cache_journal());
+  if(new_file)
+    WriteCsvCacheHeader(journal_ofs_);
+  journal_ofs_ << setprecision(20);
+}
+
+// ----------------------------------------------------------------------------------------
+// mark <key> as having a newly-calculated value that needs to go in the journal
+void Glomerator::JournalKey(string key) {
+  if(!journal_ofs_.is_open())
+    return;
+  journal_pending_.insert(key);
+}
+
+// ----------------------------------------------------------------------------------------
+// append everything we've calculated since the last flush (a key can end up on several lines, e.g. if we calculate its naive seq in one flush period and log prob in a later one, but readers merge them)
+void Glomerator::FlushCacheJournal() {
+  if(!journal_ofs_.is_open() || journal_pending_.size() == 0)
+    return;
+  for(auto &key : journal_pending_) {
+    CacheEntry entry(GetCacheEntry(key));
+    if(entry.empty())  // e.g. hfracs that were evicted before we got to them
+      continue;
+    WriteCsvCacheLine(journal_ofs_, entry);
+  }
+  journal_ofs_.flush();
+  journal_pending_.clear();
+}
+
 // ----------------------------------------------------------------------------------------
 void Glomerator::WritePartitions(ClusterPath &cp) {
   clock_t run_start(clock());
@@ -256,9 +409,7 @@ void Glomerator::WriteAnnotations(ClusterPath &cp) {
   cout << "DEPRECATED" << endl;  // for somewhat technical reasons -- it still basically works (see notes in partitiondriver.py) UPDATE I can't find any notes about this in partitiondriver.py, but I think the basic deal is I'm running a whole separate bcrham process (after I'm done partitioning) to get the annotations. I think one (perhaps the main?) reason was that translation is really complicated, but for the final annotations we typically want the real full cluster calculation
   clock_t run_start(clock());
   cout << "      calculating and writing annotations" << endl;
-  ofstream annotation_ofs;
-  annotation_ofs.open(args_->annotationfile());
-  StreamHeader(annotation_ofs, "viterbi");
+  AnnotationWriter writer(args_->annotationfile(), "viterbi");
 
   // NOTE we're no longer calculating the logprob for *every* partition, but in Glomerator::WritePartitions() we *do* calculate them if we're told to (i.e. the last time through), and this can make it so the last partition isn't the most likely
   for(auto &cluster : cp.partitions()[cp.i_best()]) {
@@ -272,9 +423,11 @@ void Glomerator::WriteAnnotations(ClusterPath &cp) {
       cout << "WTF " << cluster << " x" << event.naive_seq_ << "x" << endl;
       assert(0);
     }
-    StreamViterbiOutput(annotation_ofs, event, cachefo(cluster).seqs_, "");
+    vector<Sequence> seqs(GetSeqVector(cachefo(cluster).seqs_));
+    AnnotationRecord record(event, seqs, "");
+    writer.Write(record);
   }
-  annotation_ofs.close();
+  writer.Close();
   printf("        annotation writing time (probably includes a bunch of new vtb calculations) %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
 }
 
@@ -326,6 +479,14 @@ string Glomerator::GetStatusStr(time_t current_time) {
   ss << "    " << setw(4) << current_partition_->size() << " clusters";
   ss << "    " << setw(9) << GetRss() << " / " << setw(1) << GetMemTot() << " kB = " << setw(6) << setprecision(3) << 100. * float(GetRss()) / GetMemTot() << " %";
   ss << "   " << FinalString(false);
+  if(args_->profile_min_cluster_size() > 0)
+    ss << "     profiles: " << profiles_.size() << " (" << setprecision(3) << profile_bytes_ / 1e6 << " MB, evicted " << n_profiles_evicted_ << ")";
+  if(args_->evict_dead_clusters() || args_->rss_budget_mb() > 0) {
+    ss << "     cache: hfracs " << naive_hfracs_.size() << " lratios " << lratios_.size() << " (evicted " << n_pairs_evicted_ << " pairs";
+    if(args_->rss_budget_mb() > 0)
+      ss << ", " << n_budget_clears_ << " clears for budget " << args_->rss_budget_mb() << " MB";
+    ss << ")";
+  }
   ss << "     " << ClusterSizeString(current_partition_).c_str();
   ss << endl;
   return ss.str();
@@ -337,15 +498,43 @@ void Glomerator::WriteStatus() {
   // cout << CacheSizeString() << endl;
   time_t current_time;
   time(&current_time);
-  if(difftime(current_time, last_status_write_time_) > 30) {  // write something every x seconds (if it crashes, partitiondriver prints the contents to stdout)
+  if(difftime(current_time, last_status_write_time_) > args_->status_interval()) {  // write something every x seconds (if it crashes, partitiondriver prints the contents to stdout)
     string status_str(GetStatusStr(current_time));
     // cout << status_str;
     fprintf(progress_file_, "%s", status_str.c_str());
     fflush(progress_file_);
+    FlushCacheJournal();
+    if(metrics_file_ != nullptr)
+      WriteMetrics(current_time);
     last_status_write_time_ = current_time;
   }
 }
 
+// ----------------------------------------------------------------------------------------
+// one line of json, e.g.
+//   {"outfile": "...", "pid": 123, "time": 1700000000, "elapsed_seconds": 60.012, "done": false, "clusters": 812, "merges": 188, "merges_per_second": 2.1,
+//    "vtb_calculated": 143, "fwd_calculated": 103, "hfrac_calculated": 4820, "dp_cells": 58121585, "dp_cells_per_second": 7.2e6,
+//    "cache": {"log_probs": 103, "naive_hfracs": 4820, "lratios": 98, "naive_seqs": 143, "errors": 0}, "rss_kb": 14696}
+// where rates are since the previous line (or the start), and are null if no time has passed. <outfile> and <pid> are there so whoever's reading can tell processes apart if they share a file.
+void Glomerator::WriteMetrics(time_t current_time, bool done) {
+  int n_merges(n_hfrac_merges_ + n_lratio_merges_);
+  chrono::steady_clock::time_point now(chrono::steady_clock::now());
+  double interval(chrono::duration<double>(now - last_metrics_time_).count());
+  char buffer[10000];  // NOTE has to be big enough for the outfile path
+  snprintf(buffer, sizeof(buffer), "{\"outfile\": %s, \"pid\": %d, \"time\": %ld, \"elapsed_seconds\": %.3f, \"done\": %s, \"clusters\": %zu, \"merges\": %d, \"merges_per_second\": %s, "
+	  "\"vtb_calculated\": %d, \"fwd_calculated\": %d, \"hfrac_calculated\": %d, \"dp_cells\": %llu, \"dp_cells_per_second\": %s, "
+	  "\"cache\": {\"log_probs\": %zu, \"naive_hfracs\": %zu, \"lratios\": %zu, \"naive_seqs\": %zu, \"errors\": %zu}, \"rss_kb\": %d}\n",
+	  JsonString(args_->outfile()).c_str(), int(getpid()), long(current_time), chrono::duration<double>(now - start_time_).count(), done ? "true" : "false",
+	  current_partition_ == nullptr ? size_t(0) : current_partition_->size(), n_merges, (interval > 0 ? JsonDouble((n_merges - last_metrics_n_merges_) / interval) : string("null")).c_str(),
+	  n_vtb_calculated_, n_fwd_calculated_, n_hfrac_calculated_, (unsigned long long)n_dp_cells_, (interval > 0 ? JsonDouble((n_dp_cells_ - last_metrics_n_dp_cells_) / interval) : string("null")).c_str(),
+	  log_probs_.size(), naive_hfracs_.size(), lratios_.size(), naive_seqs_.size(), errors_.size(), GetRss());
+  fputs(buffer, metrics_file_);  // NOTE one write per line (after the flush), so lines from different processes sharing the file don't get interleaved
+  fflush(metrics_file_);
+  last_metrics_time_ = now;
+  last_metrics_n_merges_ = n_merges;
+  last_metrics_n_dp_cells_ = n_dp_cells_;
+}
+
 // ----------------------------------------------------------------------------------------
 string Glomerator::ParentalString(pair<string, string> *parents) {
   if(CountMembers(parents->first) > 5 || CountMembers(parents->second) > 5) {
@@ -466,8 +655,12 @@ double Glomerator::CalculateHfrac(string &seq_a, string &seq_b) {
 // ----------------------------------------------------------------------------------------
 double Glomerator::NaiveHfrac(string key_a, string key_b) {
   string joint_key = JoinNames(key_a, key_b);  // NOTE since the cache is indexed by the joint key, this assumes we can arrive at this cluster via only one path. Which should be ok.
-  if(naive_hfracs_.count(joint_key))  // if we've already calculated this distance
+  if(naive_hfracs_.count(joint_key) == 0)
+    LoadFromInputCache(joint_key);
+  if(naive_hfracs_.count(joint_key)) {  // if we've already calculated this distance (or read it from the input cache)
+    AddPairCacheKey(key_a, key_b, joint_key);  // NOTE values from the input cache don't get added when we read them (we don't know which two clusters a joint key is made of), so we add them here the first time they're used
     return naive_hfracs_[joint_key];
+  }
 
   string &seq_a = GetNaiveSeq(key_a);
   string &seq_b = GetNaiveSeq(key_b);
@@ -475,10 +668,56 @@ double Glomerator::NaiveHfrac(string key_a, string key_b) {
   if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
     return hfrac;
   naive_hfracs_[joint_key] = CalculateHfrac(seq_a, seq_b);
+  AddPairCacheKey(key_a, key_b, joint_key);
+  if(args_->cache_naive_hfracs())
+    JournalKey(joint_key);
 
   return naive_hfracs_[joint_key];
 }
 
+// ----------------------------------------------------------------------------------------
+// remember that <joint_key> in <naive_hfracs_> and/or <lratios_> involves <key_a> and <key_b>, so we can evict it once either of them is merged out of existence
+void Glomerator::AddPairCacheKey(string key_a, string key_b, string joint_key) {
+  if(!args_->evict_dead_clusters())
+    return;
+  pair_cache_keys_[key_a][key_b] = joint_key;
+  pair_cache_keys_[key_b][key_a] = joint_key;
+}
+
+// ----------------------------------------------------------------------------------------
+// the parents of <qmerge> no longer exist, so we'll never again need the naive hfracs or lratios between them and anybody else
+void Glomerator::EvictDeadClusters(Query &qmerge) {
+  if(!args_->evict_dead_clusters())
+    return;
+  for(auto &dead_key : vector<string>{qmerge.parents_.first, qmerge.parents_.second}) {
+    if(pair_cache_keys_.count(dead_key) == 0)
+      continue;
+    for(auto &kv : pair_cache_keys_[dead_key]) {  // kv.first is the other cluster in the pair, kv.second is the joint key
+      naive_hfracs_.erase(kv.second);
+      lratios_.erase(kv.second);
+      if(pair_cache_keys_.count(kv.first))
+	pair_cache_keys_[kv.first].erase(dead_key);
+      ++n_pairs_evicted_;
+    }
+    pair_cache_keys_.erase(dead_key);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// if we're over the memory budget, clear the pairwise caches entirely (they're cheap to recalculate, since the naive seqs and log probs are still cached)
+void Glomerator::EnforceRssBudget() {
+  if(args_->rss_budget_mb() == 0)
+    return;
+  if(GetRss() < 1000 * int(args_->rss_budget_mb()))  // GetRss() is in kB
+    return;
+  if(args_->debug())
+    cout << "          over rss budget (" << GetRss() << " kB): clearing " << naive_hfracs_.size() << " naive hfracs and " << lratios_.size() << " lratios" << endl;
+  naive_hfracs_.clear();
+  lratios_.clear();
+  pair_cache_keys_.clear();
+  ++n_budget_clears_;
+}
+
 // ----------------------------------------------------------------------------------------
 string Glomerator::ChooseSubsetOfNames(string queries, int n_max) {
   if(name_subsets_.count(queries))
@@ -487,27 +726,25 @@ string Glomerator::ChooseSubsetOfNames(string queries, int n_max) {
   // assert(seq_info_.count(queries) || tmp_cachefo_.count(queries));
   vector<string> namevector(SplitString(queries, ":"));
 
-  srand(hash<string>{}(queries));  // make sure we get the same subset each time we pass in the same queries (well, if there's different thresholds for naive_seqs annd logprobs they'll each get their own [very correlated] subset)
-
-  // first decide which indices we'll choose
-  set<int> ichosen;
-  vector<int> ichosen_vec;  // don't really need both of these... but maybe it's faster
-  set<string> chosen_strs;  // make sure we don't choose seed unique id more than once
-  for(size_t iname=0; iname<unsigned(n_max); ++iname) {
-    int ich(-1);
-    int n_tries(0);
-    while(ich < 0 || ichosen.count(ich) || chosen_strs.count(namevector[ich])) {
-      ich = rand() % namevector.size();
-      ++n_tries;
-      if(n_tries > 1e6)
-	throw runtime_error("too many tries in Glomerator::ChooseSubsetOfNames() -- maybe too many copies of the seed unique id?");
-    }
-    ichosen.insert(ich);
-    chosen_strs.insert(namevector[ich]);
-    ichosen_vec.push_back(ich);
+  // rank each name by a hash salted with <queries>, and take the <n_max> smallest. This gives the same subset each time we pass in the same queries (well, if there's different thresholds for naive_seqs annd logprobs they'll each get their own [very correlated] subset),
+  // on any platform, without touching the global rng (so it's safe to call from several threads), and in linear time
+  uint64_t salt = StableHash(queries);
+  vector<pair<uint64_t, int> > ranked;  // (hash, index in <namevector>)
+  unordered_set<string> already_seen;  // make sure we don't choose seed unique id more than once
+  for(size_t iname=0; iname<namevector.size(); ++iname) {
+    if(already_seen.count(namevector[iname]))
+      continue;
+    already_seen.insert(namevector[iname]);
+    ranked.push_back(pair<uint64_t, int>(StableHash(namevector[iname], salt), int(iname)));
   }
-
-  // then sort 'em
+  if(ranked.size() < unsigned(n_max))
+    throw runtime_error("asked for " + to_string(n_max) + " names, but there's only " + to_string(ranked.size()) + " unique ones in Glomerator::ChooseSubsetOfNames() -- maybe too many copies of the seed unique id?");
+  nth_element(ranked.begin(), ranked.begin() + n_max, ranked.end());  // NOTE pairs with identical hashes get ordered by index, so the chosen set is the same for any stl implementation
+
+  // then sort 'em back into their original order
+  vector<int> ichosen_vec;
+  for(int ich=0; ich<n_max; ++ich)
+    ichosen_vec.push_back(ranked[ich].second);
   sort(ichosen_vec.begin(), ichosen_vec.end());
 
   Query &cacheref = cachefo(queries);
@@ -628,6 +865,8 @@ string Glomerator::FindNaiveSeqNameReplace(pair<string, string> *parents) {
 
 // ----------------------------------------------------------------------------------------
 string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
+  if(naive_seqs_.count(queries) == 0)
+    LoadFromInputCache(queries);
   if(naive_seqs_.count(queries))
     return naive_seqs_[queries];
 
@@ -636,6 +875,7 @@ string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
     string name_with_which_to_replace = FindNaiveSeqNameReplace(parents);
     if(name_with_which_to_replace != "") {
       naive_seqs_[queries] = GetNaiveSeq(name_with_which_to_replace);  // copy the whole sequence object  TODO this doesn't follow/do the turtle thing
+      JournalKey(queries);
       return naive_seqs_[queries];
     }
   }
@@ -644,14 +884,19 @@ string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
   string queries_to_calc = GetNaiveSeqNameToCalculate(queries);
 
   // actually calculate the viterbi path for whatever queries we've decided on
+  if(naive_seqs_.count(queries_to_calc) == 0)
+    LoadFromInputCache(queries_to_calc);
   if(naive_seqs_.count(queries_to_calc) == 0) {
     string tmp_nseq = CalculateNaiveSeq(queries_to_calc);  // some compilers add <queries_to_calc> to <naive_seqs_> *before* calling CalculateNaiveSeq(), which causes that function's check to fail
     naive_seqs_[queries_to_calc] = tmp_nseq;
+    JournalKey(queries_to_calc);
   }
 
   // if we did some translation, propagate the naive sequence back to the queries we were originally interested in
-  if(queries_to_calc != queries)
+  if(queries_to_calc != queries) {
     naive_seqs_[queries] = naive_seqs_[queries_to_calc];
+    JournalKey(queries);
+  }
 
   return naive_seqs_[queries];
 }
@@ -664,11 +909,14 @@ string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
 
 // ----------------------------------------------------------------------------------------
 double Glomerator::GetLogProb(string queries) {  // NOTE this does *no* translation, so you better have done that already before you call it if you want it done
+  if(log_probs_.count(queries) == 0)
+    LoadFromInputCache(queries);
   if(log_probs_.count(queries))  // already did it
     return log_probs_[queries];
 
   double tmplp = CalculateLogProb(queries);  // NOTE this should be the *only* place (besides cache reading) that log_probs_ gets modified
   log_probs_[queries] = tmplp;  // tmp variable is just so we can assert that queries isn't already in log_probs_
+  JournalKey(queries);
 
   return log_probs_[queries];
 }
@@ -704,8 +952,78 @@ double Glomerator::GetLogProbRatio(string key_a, string key_b) {
     printf("\n");
   }
 
+  AddPairCacheKey(key_a, key_b, joint_name);
   return lratios_[joint_name] = lratio;
-  return lratio;
+}
+
+// ----------------------------------------------------------------------------------------
+// If <queries> was formed by merging two clusters whose profiles we already have, its profile is just their sum (emissions are additive under the star tree), so we don't need to go back to the sequences.
+vector<uint32_t> &Glomerator::GetProfile(string queries) {
+  if(profiles_.count(queries)) {
+    if(profile_order_positions_.count(queries))  // move it to the back of the line for eviction
+      profile_order_.splice(profile_order_.end(), profile_order_, profile_order_positions_[queries]);
+    return profiles_[queries];
+  }
+
+  Query &cacheref = cachefo(queries);
+  string &p1(cacheref.parents_.first), &p2(cacheref.parents_.second);
+  if(p1 != "" && profiles_.count(p1) && profiles_.count(p2)) {
+    vector<uint32_t> &prof_a(profiles_[p1]), &prof_b(profiles_[p2]);
+    if(prof_a.size() != prof_b.size())
+      throw runtime_error("parent profiles different sizes for " + queries);
+    vector<uint32_t> profile(prof_a);
+    for(size_t ic=0; ic<profile.size(); ++ic)
+      profile[ic] += prof_b[ic];
+    CacheProfile(queries, profile);
+  } else {
+    Sequences seqs;
+    for(auto *pseq : cacheref.seqs_)
+      seqs.AddSeq(*pseq);
+    CacheProfile(queries, seqs.BuildProfile());
+  }
+
+  return profiles_[queries];
+}
+
+// ----------------------------------------------------------------------------------------
+// add <profile> to the cache, then evict the least recently used profiles (other than this one) until we're under --profile-cache-mb
+void Glomerator::CacheProfile(string queries, vector<uint32_t> profile) {
+  EraseProfile(queries);
+  profile_bytes_ += profile.size() * sizeof(uint32_t);
+  profiles_[queries] = profile;
+
+  if(args_->profile_cache_mb() == 0)
+    return;
+  profile_order_positions_[queries] = profile_order_.insert(profile_order_.end(), queries);
+  size_t max_bytes = size_t(args_->profile_cache_mb()) * 1000000;
+  while(profile_bytes_ > max_bytes && profile_order_.front() != queries) {  // NOTE evicting a profile just means we'll have to count it from the sequences next time
+    EraseProfile(profile_order_.front());  // NOTE also removes it from <profile_order_>
+    ++n_profiles_evicted_;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Glomerator::EraseProfile(string queries) {
+  if(profiles_.count(queries) == 0)
+    return;
+  profile_bytes_ -= profiles_[queries].size() * sizeof(uint32_t);
+  profiles_.erase(queries);
+  if(profile_order_positions_.count(queries)) {
+    profile_order_.erase(profile_order_positions_[queries]);
+    profile_order_positions_.erase(queries);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// sequences to pass to the dp handler for <queries>, with the profile set if the cluster's big enough
+Sequences Glomerator::GetDPSeqs(string queries) {
+  Query &cacheref = cachefo(queries);
+  Sequences seqs;
+  for(auto *pseq : cacheref.seqs_)
+    seqs.AddSeq(*pseq);
+  if(args_->profile_min_cluster_size() > 0 && int(cacheref.seqs_.size()) >= args_->profile_min_cluster_size())
+    seqs.SetProfile(GetProfile(queries));
+  return seqs;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -720,7 +1038,9 @@ string Glomerator::CalculateNaiveSeq(string queries, RecoEvent *event) {
 
   DPHandler dph("viterbi", args_, gl_, hmms_);
   Query &cacheref = cachefo(queries);
-  Result result = dph.Run(cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
+  Sequences seqs(GetDPSeqs(queries));
+  Result result = dph.Run(seqs, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
+  n_dp_cells_ += dph.n_cells();
   // if(FishyMultiSeqAnnotation(SplitString(queries).size(), result.best_event()))
   //   dph.HandleFishyAnnotations(result, cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
   if(result.no_path_) {
@@ -747,7 +1067,9 @@ double Glomerator::CalculateLogProb(string queries) {  // NOTE can modify kbinfo
 
   DPHandler dph("forward", args_, gl_, hmms_);
   Query &cacheref = cachefo(queries);
-  Result result = dph.Run(cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
+  Sequences seqs(GetDPSeqs(queries));  // if the cluster's big enough, and we already have its parents' profiles (e.g. when <queries> is the union in an lratio), this reuses them
+  Result result = dph.Run(seqs, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
+  n_dp_cells_ += dph.n_cells();
   if(result.no_path_) {
     AddFailedQuery(queries, "no_path");
     return -INFINITY;
@@ -761,6 +1083,7 @@ double Glomerator::CalculateLogProb(string queries) {  // NOTE can modify kbinfo
 void Glomerator::AddFailedQuery(string queries, string error_str) {
     errors_[queries] = errors_[queries] + ":" + error_str;
     failed_queries_.insert(queries);
+    JournalKey(queries);
 }
 
 // ----------------------------------------------------------------------------------------
@@ -981,6 +1304,61 @@ Partition Glomerator::GetSeededClusters(Partition &partition) {
   return clusters;
 }
 
+// ----------------------------------------------------------------------------------------
+void Glomerator::InitNaiveSeqIndex(Partition &partition) {
+  map<size_t, size_t> n_per_cdr3_length;  // clusters that are alone in their cdr3 class can never merge, so we don't need their naive seqs (and the full loop never calculates them)
+  for(auto &key : partition)
+    ++n_per_cdr3_length[cachefo(key).cdr3_length_];
+  for(auto &key : partition) {
+    if(n_per_cdr3_length[cachefo(key).cdr3_length_] < 2)
+      continue;
+    string &naive_seq = GetNaiveSeq(key);
+    if(failed_queries_.count(key))  // failed clusters never get merged, so they don't need to be in the index
+      continue;
+    naive_seq_index_.Add(key, naive_seq, cachefo(key).cdr3_length_);
+  }
+  use_naive_seq_index_ = true;
+  if(args_->debug())
+    cout << "        naive seq index: " << naive_seq_index_.size() << " clusters in " << naive_seq_index_.n_buckets() << " buckets" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// keep the index in sync with the current partition: the parents of <qmerge> are gone, and <qmerge> is new
+void Glomerator::UpdateNaiveSeqIndex(Query &qmerge) {
+  if(!use_naive_seq_index_)
+    return;
+  if(naive_seq_index_.Contains(qmerge.parents_.first))
+    naive_seq_index_.Remove(qmerge.parents_.first);
+  if(naive_seq_index_.Contains(qmerge.parents_.second))
+    naive_seq_index_.Remove(qmerge.parents_.second);
+  string &naive_seq = GetNaiveSeq(qmerge.name_);
+  if(!failed_queries_.count(qmerge.name_))
+    naive_seq_index_.Add(qmerge.name_, naive_seq, qmerge.cdr3_length_);
+}
+
+// ----------------------------------------------------------------------------------------
+// Set <it_b> and <it_end> to the range of clusters that the inner loop in FindHfracMerge() and FindLRatioMerge() needs to compare to *<it_a>.
+// For plain partitioning, this is everything after <it_a> in <outer_clusters>, whereas if the seed's set, it's the *entire* current partition (including the seeded clusters, so the loops also need to skip key_a == key_b).
+// If we've got the naive seq index, we instead only loop over the subset of those that the index says might be within hamming_fraction_bound_hi (which we put in <candidates>).
+// Since Partition is sorted, we visit these in the same order as the full loop, so we end up choosing the same merges.
+void Glomerator::GetInnerLoopRange(ClusterPath *path, Partition &outer_clusters, Partition::iterator it_a, Partition &candidates, Partition::iterator &it_b, Partition::iterator &it_end) {
+  if(use_naive_seq_index_) {
+    if(naive_seq_index_.Contains(*it_a))  // if it isn't in the index it either failed or is alone in its cdr3 class, so we leave <candidates> empty
+      candidates = naive_seq_index_.Candidates(*it_a);
+    if(args_->seed_unique_id() == "")
+      candidates.erase(candidates.begin(), candidates.upper_bound(*it_a));  // the ones before <it_a> were already compared when they were in the outer loop
+    it_b = candidates.begin();
+    it_end = candidates.end();
+  } else if(args_->seed_unique_id() == "") {
+    it_b = it_a;
+    ++it_b;
+    it_end = outer_clusters.end();  // NOTE you can't replace this with path->CurrentPartition().end() because in this case <it_b> is looping over the *copy* of path->CurrentPartition()
+  } else {
+    it_b = path->CurrentPartition().begin();
+    it_end = path->CurrentPartition().end();
+  }
+}
+
 // ----------------------------------------------------------------------------------------
 pair<double, Query> Glomerator::FindHfracMerge(ClusterPath *path) {
   double min_hamming_fraction(INFINITY);
@@ -990,20 +1368,10 @@ pair<double, Query> Glomerator::FindHfracMerge(ClusterPath *path) {
   if(args_->seed_unique_id() != "")  // whereas if seed unique id is set, outer loop is only over those clusters that contain the seed
     outer_clusters = GetSeededClusters(path->CurrentPartition());
   for(Partition::iterator it_a = outer_clusters.begin(); it_a != outer_clusters.end(); ++it_a) {
-    Partition::iterator it_b(it_a);  // for plain partitioning, inner loop starts at the position of the outer iterator + 1
-    ++it_b;
-    if(args_->seed_unique_id() != "")  // but if the seed's set, inner loop is over the *entire* current partition (including the seeded clusters). So we also need to skip key_a == key_b below.
-      it_b = path->CurrentPartition().begin();
-
-    for( ; true; ++it_b) {
-      if(args_->seed_unique_id() == "") {
-	if(it_b == outer_clusters.end())  // NOTE you can't replace this with path->CurrentPartition().end() because in this case <it_b> is looping over the *copy* of path->CurrentPartition()
-	  break;
-      } else {
-	if(it_b == path->CurrentPartition().end())
-	  break;
-      }
-
+    Partition candidates;  // only used if we've got the naive seq index
+    Partition::iterator it_b, it_end;
+    GetInnerLoopRange(path, outer_clusters, it_a, candidates, it_b, it_end);
+    for( ; it_b != it_end; ++it_b) {
       string key_a(*it_a), key_b(*it_b);
       if(key_a == key_b)  // otherwise we'd loop over the seeded ones twice
 	continue;
@@ -1045,20 +1413,10 @@ pair<double, Query> Glomerator::FindLRatioMerge(ClusterPath *path) {
   if(args_->seed_unique_id() != "")  // see comments in FindHfracMerge
     outer_clusters = GetSeededClusters(path->CurrentPartition());
   for(Partition::iterator it_a = outer_clusters.begin(); it_a != outer_clusters.end(); ++it_a) {
-    Partition::iterator it_b(it_a);
-    ++it_b;
-    if(args_->seed_unique_id() != "")
-      it_b = path->CurrentPartition().begin();
-
-    for( ; true; ++it_b) {
-      if(args_->seed_unique_id() == "") {
-	if(it_b == outer_clusters.end())  // NOTE you can't replace this with path->CurrentPartition().end() because in this case <it_b> is looping over the *copy* of path->CurrentPartition()
-	  break;
-      } else {
-	if(it_b == path->CurrentPartition().end())
-	  break;
-      }
-
+    Partition candidates;  // see comments in FindHfracMerge
+    Partition::iterator it_b, it_end;
+    GetInnerLoopRange(path, outer_clusters, it_a, candidates, it_b, it_end);
+    for( ; it_b != it_end; ++it_b) {
       string key_a(*it_a), key_b(*it_b);
       if(key_a == key_b)  // otherwise we'd loop over the seeded ones twice
 	continue;
@@ -1184,17 +1542,24 @@ void Glomerator::Merge(ClusterPath *path) {
   new_partition.insert(chosen_qmerge.name_);
   path->AddPartition(new_partition, -INFINITY, args_->n_partitions_to_write());
   current_partition_ = &path->CurrentPartition();
+  UpdateNaiveSeqIndex(chosen_qmerge);
 
   if(args_->debug()) {
     printf("       merged   %s  %s\n", chosen_qmerge.parents_.first.c_str(), chosen_qmerge.parents_.second.c_str());
     cout << "          removing " << tmp_cachefo_.size() << " entries from tmp cache" << endl;
   }
 
+  for(auto &kv : tmp_cachefo_) {  // profiles for clusters we considered merging, but didn't, aren't going to be any more use
+    if(cachefo_.count(kv.first) == 0)
+      EraseProfile(kv.first);
+  }
   tmp_cachefo_.clear();  // NOTE I could simplify some other things if I only cleared the stuff from <tmp_cachefo_> that I thought I wouldn't later need.
-  // naive_hfracs_.clear();  // so, this can reduce memory usage a *lot* for no cpu hit in (usually, I think) later steps, but in (usually, I think) earlier steps it can be prohibitively slower (I think, when early on you're doing a ton of hfrac merges)
-  //  - bottom line, I think I'll need to buckle down and measure memory usage, decide how much I'm allowed to use, and only clear the caches that I need to
-  //  - but also, it'd probably (maybe?) be ok to clear this cache after a logprob merge, since that would mean we're probably through with all the naive hfrac merges
-  //  - or at least remove info for clusters we've merged out of existence
+  // NOTE clearing naive_hfracs_ entirely can reduce memory usage a *lot* for no cpu hit in (usually, I think) later steps, but in (usually, I think) earlier steps it can be prohibitively slower (I think, when early on you're doing a ton of hfrac merges)
+  //  - so by default we keep everything, but with --evict-dead-clusters we remove info for clusters we've merged out of existence, and with --rss-budget-mb we clear everything if we go over the budget
+  EvictDeadClusters(chosen_qmerge);
+  EnforceRssBudget();
+  EraseProfile(chosen_qmerge.parents_.first);  // if we needed them, they've already been added into the merged cluster's profile
+  EraseProfile(chosen_qmerge.parents_.second);
 
   if((args_->n_final_clusters() > 0 && path->CurrentPartition().size() <= args_->n_final_clusters()) ||
      (args_->min_largest_cluster_size() > 0 && LargestClusterSize(path->CurrentPartition()) >= args_->min_largest_cluster_size())) {  // largest cluster is still too small
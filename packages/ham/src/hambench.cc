@@ -0,0 +1,235 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+
+#include "args.h"
+#include "dphandler.h"
+#include "glomerator.h"
+#include "queryfile.h"
+#include "simulator.h"
+#include "text.h"
+#include "tclap/CmdLine.h"
+
+using namespace ham;
+using namespace TCLAP;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// Microbenchmarks for the dp code, on synthetic sequences (see simulator.h) made from the germline set in --datadir and run on the real hmms in --hmmdir:
+//   trellis:     viterbi and forward throughput (dp cells per second) for a single sequence on each gene's hmm
+//   dphandler:   DPHandler::Run() latency (i.e. the whole k space, with all the chunk caching) for each combination of cluster size and k bounds half-width
+//   glomerator:  merges per second for an entire Glomerator::Cluster() run on --n-families synthetic families
+// Results go to --outfile as json. Everything's seeded from --seed, so runs with the same arguments are comparable across builds.
+// e.g.: ./hambench --hmmdir test/reference-results/test/parameters/data/hmm/hmms --datadir test/reference-results/test/parameters/data/hmm/germline-sets --locus igh --outfile bench.json
+
+double SecondsSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// ----------------------------------------------------------------------------------------
+// summary of the timings for one benchmark configuration
+class BenchTiming {
+public:
+  BenchTiming() : n_reps(0), total_seconds(0.), min_seconds(INFINITY), n_cells(0) {}
+  void Add(double seconds, uint64_t cells) { ++n_reps; total_seconds += seconds; min_seconds = min(min_seconds, seconds); n_cells = cells; }
+  string Json() {
+    double mean(n_reps > 0 ? total_seconds / n_reps : 0.);
+    return "{\"reps\": " + to_string(n_reps) + ", \"mean_seconds\": " + JsonDouble(mean) + ", \"min_seconds\": " + JsonDouble(n_reps > 0 ? min_seconds : 0.)
+      + ", \"cells\": " + to_string(n_cells) + ", \"cells_per_second\": " + JsonDouble(mean > 0. ? n_cells / mean : 0.) + "}";
+  }
+
+  size_t n_reps;
+  double total_seconds, min_seconds;
+  uint64_t n_cells;  // per rep (they're all the same)
+};
+
+// ----------------------------------------------------------------------------------------
+// viterbi and forward on each gene's hmm, for the part of a (mutated) simulated sequence that came from that gene
+string BenchTrellis(Simulator &sim, HMMHolder &hmms, GermLines &gl, Track *track, size_t n_reps, double mut_freq) {
+  string json("{");
+  size_t ientry(0);
+  for(auto &region : gl.regions_) {
+    for(auto &gene : sim.available_genes()[region]) {
+      SimulatedFamily family(sim.Rearrange(region == "v" ? gene : "", region == "d" ? gene : "", region == "j" ? gene : ""));
+      sim.AddStarTreeSeqs(family, 1, mut_freq);
+      Sequences seqs;
+      seqs.AddSeq(Sequence(track, family.names_[0], family.seqs_[0]));
+      size_t pos(region == "v" ? 0 : (region == "d" ? family.k_v_ : family.k_v_ + family.k_d_));
+      size_t len(region == "v" ? family.k_v_ : (region == "d" ? family.k_d_ : family.naive_seq_.size() - family.k_v_ - family.k_d_));
+      SequencesView view(seqs, pos, len);
+      Model *hmm(hmms.Get(gene));
+      BenchTiming vtb_timing, fwd_timing;
+      for(size_t irep=0; irep<n_reps; ++irep) {
+	auto start(chrono::steady_clock::now());
+	Trellis vtb_trellis(hmm, view);
+	vtb_trellis.Viterbi();
+	vtb_timing.Add(SecondsSince(start), vtb_trellis.n_cells());
+	start = chrono::steady_clock::now();
+	Trellis fwd_trellis(hmm, view);
+	fwd_trellis.Forward();
+	fwd_timing.Add(SecondsSince(start), fwd_trellis.n_cells());
+      }
+      json += (ientry++ > 0 ? ",\n   " : "\n   ") + JsonString(gene) + ": {\"region\": " + JsonString(region) + ", \"length\": " + to_string(len) + ", \"n_states\": " + to_string(hmm->n_states())
+	+ ", \"viterbi\": " + vtb_timing.Json() + ", \"forward\": " + fwd_timing.Json() + "}";
+    }
+  }
+  return json + "}";
+}
+
+// ----------------------------------------------------------------------------------------
+// DPHandler::Run() on one simulated family for each combination of cluster size and k bounds half-width
+string BenchDPHandler(Simulator &sim, HMMHolder &hmms, GermLines &gl, Args &args, Track *track, vector<int> cluster_sizes, vector<int> k_half_widths, size_t n_reps, double mut_freq, size_t n_extra_genes) {
+  string json("[");
+  size_t ientry(0);
+  for(auto &cluster_size : cluster_sizes) {
+    SimulatedFamily family(sim.Rearrange());
+    sim.AddStarTreeSeqs(family, cluster_size, mut_freq);
+    vector<Sequence> seqvector;
+    for(size_t is=0; is<family.n_seqs(); ++is)
+      seqvector.push_back(Sequence(track, family.names_[is], family.seqs_[is]));
+    vector<string> only_genes(sim.OnlyGenes(family, n_extra_genes));
+    for(auto &gene : only_genes)  // read the hmms before timing, so the first rep doesn't include the yaml parsing
+      hmms.Get(gene);
+    for(auto &half_width : k_half_widths) {
+      KBounds kbounds(sim.GetKBounds(family, half_width));
+      for(auto &algorithm : vector<string>{"viterbi", "forward"}) {
+	DPHandler dph(algorithm, &args, gl, hmms);
+	BenchTiming timing;
+	for(size_t irep=0; irep<n_reps; ++irep) {
+	  uint64_t cells_before(dph.n_cells());
+	  auto start(chrono::steady_clock::now());
+	  Result result(dph.Run(seqvector, kbounds, only_genes, family.mut_freq_));
+	  timing.Add(SecondsSince(start), dph.n_cells() - cells_before);
+	  if(result.no_path_)
+	    throw runtime_error("no valid path for simulated family " + family.name_);
+	}
+	json += (ientry++ > 0 ? ",\n   " : "\n   ") + string("{\"algorithm\": ") + JsonString(algorithm) + ", \"cluster_size\": " + to_string(cluster_size) + ", \"k_half_width\": " + to_string(half_width)
+	  + ", \"n_ksets\": " + to_string((kbounds.vmax - kbounds.vmin) * (kbounds.dmax - kbounds.dmin)) + ", \"length\": " + to_string(family.naive_seq_.size()) + ", \"timing\": " + timing.Json() + "}";
+      }
+    }
+  }
+  return json + "]";
+}
+
+// ----------------------------------------------------------------------------------------
+// partition <families> (which should already be in args.infile()) with a Glomerator
+string BenchGlomerator(HMMHolder &hmms, GermLines &gl, Args &args, Track *track, vector<SimulatedFamily> &families) {
+  vector<vector<Sequence> > qry_seq_list;
+  for(size_t iqry=0; iqry<args.str_lists_["names"].size(); ++iqry) {
+    QueryRecord qry;
+    ReadTextQuery(args, iqry, track, qry);
+    for(auto &gene : qry.only_genes_)  // same as for the dphandler: don't time the hmm reading
+      hmms.Get(gene);
+    qry_seq_list.push_back(qry.seqs_);
+  }
+
+  auto start(chrono::steady_clock::now());
+  Glomerator *glom(new Glomerator(hmms, gl, qry_seq_list, &args, track));
+  glom->Cluster();
+  double seconds(SecondsSince(start));
+  string json("{\"n_families\": " + to_string(families.size()) + ", \"n_seqs\": " + to_string(qry_seq_list.size()) + ", \"seconds\": " + JsonDouble(seconds)
+	      + ", \"merges\": " + to_string(glom->n_merges()) + ", \"merges_per_second\": " + JsonDouble(seconds > 0. ? glom->n_merges() / seconds : 0.)
+	      + ", \"fwd_calculated\": " + to_string(glom->n_fwd_calculated()) + ", \"vtb_calculated\": " + to_string(glom->n_vtb_calculated()) + ", \"hfrac_calculated\": " + to_string(glom->n_hfrac_calculated())
+	      + ", \"dp_cells\": " + to_string(glom->n_dp_cells()) + ", \"dp_cells_per_second\": " + JsonDouble(seconds > 0. ? glom->n_dp_cells() / seconds : 0.) + "}");
+  delete glom;  // writes the output files, so we don't time it
+  return json;
+}
+
+// ----------------------------------------------------------------------------------------
+vector<int> IntList(string str) {
+  vector<int> vals;
+  for(auto &val : SplitString(str, ":"))
+    vals.push_back(stoi(val));
+  return vals;
+}
+
+// ----------------------------------------------------------------------------------------
+int main(int argc, const char *argv[]) {
+  vector<string> benchmarks{"all", "trellis", "dphandler", "glomerator"};
+  ValuesConstraint<string> benchmarks_constraint(benchmarks);
+  ValueArg<string> hmmdir_arg("", "hmmdir", "directory with the hmm yamls", true, "", "string");
+  ValueArg<string> datadir_arg("", "datadir", "germline set directory (i.e. bcrham's --datadir)", true, "", "string");
+  ValueArg<string> locus_arg("", "locus", "locus", false, "igh", "string");
+  ValueArg<string> outfile_arg("", "outfile", "output json file", true, "", "string");
+  ValueArg<string> ambig_base_arg("", "ambig-base", "ambiguous base (same as for bcrham)", false, "N", "string");
+  ValueArg<string> workdir_arg("", "workdir", "directory for the glomerator benchmark's temporary input and output files", false, "/tmp", "string");
+  ValueArg<string> benchmark_arg("", "benchmark", "which benchmark to run", false, "all", &benchmarks_constraint);
+  ValueArg<string> cluster_sizes_arg("", "cluster-sizes", "colon-separated list of cluster sizes for the dphandler benchmark", false, "1:2:4:8", "string");
+  ValueArg<string> k_half_widths_arg("", "k-half-widths", "colon-separated list of k bounds half-widths (i.e. k_v and k_d are each in [true - w, true + w]) for the dphandler benchmark", false, "0:2:5", "string");
+  ValueArg<unsigned> seed_arg("", "seed", "random seed for the simulation", false, 1, "unsigned");
+  ValueArg<unsigned> n_reps_arg("", "n-reps", "number of times to repeat each trellis and dphandler timing", false, 3, "unsigned");
+  ValueArg<unsigned> n_families_arg("", "n-families", "number of families for the glomerator benchmark", false, 10, "unsigned");
+  ValueArg<unsigned> family_size_arg("", "family-size", "number of sequences in each family for the glomerator benchmark", false, 5, "unsigned");
+  ValueArg<unsigned> n_extra_genes_arg("", "n-extra-genes", "number of genes (in each region) besides the true one to pass to the dphandler in only_genes", false, 2, "unsigned");
+  ValueArg<unsigned> k_half_width_arg("", "k-half-width", "k bounds half-width for the glomerator benchmark", false, 2, "unsigned");
+  ValueArg<float> mut_freq_arg("", "mut-freq", "mutation frequency for simulated sequences", false, 0.05, "float");
+  try {
+    CmdLine cmd("hambench -- timing for trellis, dphandler, and glomerator on simulated sequences", ' ', "");
+    cmd.add(hmmdir_arg);
+    cmd.add(datadir_arg);
+    cmd.add(locus_arg);
+    cmd.add(outfile_arg);
+    cmd.add(ambig_base_arg);
+    cmd.add(workdir_arg);
+    cmd.add(benchmark_arg);
+    cmd.add(cluster_sizes_arg);
+    cmd.add(k_half_widths_arg);
+    cmd.add(seed_arg);
+    cmd.add(n_reps_arg);
+    cmd.add(n_families_arg);
+    cmd.add(family_size_arg);
+    cmd.add(n_extra_genes_arg);
+    cmd.add(k_half_width_arg);
+    cmd.add(mut_freq_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+  string benchmark(benchmark_arg.getValue());
+
+  Track track(NucleotideTrack(ambig_base_arg.getValue()));
+  GermLines gl(datadir_arg.getValue(), locus_arg.getValue());
+  HMMHolder hmms(hmmdir_arg.getValue(), gl, &track);
+  Simulator sim(gl, GenesWithHmms(gl, hmmdir_arg.getValue()), seed_arg.getValue());
+
+  // the dphandler and glomerator need an Args, and the glomerator gets its queries from the infile, so we write a simulated input file first
+  vector<SimulatedFamily> families;
+  for(size_t ifam=0; ifam<n_families_arg.getValue(); ++ifam) {
+    families.push_back(sim.Rearrange());
+    sim.AddStarTreeSeqs(families.back(), family_size_arg.getValue(), mut_freq_arg.getValue());
+  }
+  string prefix(workdir_arg.getValue() + "/hambench-" + to_string(getpid()));
+  sim.WriteInputFile(prefix + "-input.csv", families, k_half_width_arg.getValue(), n_extra_genes_arg.getValue(), ambig_base_arg.getValue());
+  vector<string> argstrs{"hambench", "--algorithm", "forward", "--partition", "--hmmdir", hmmdir_arg.getValue(), "--datadir", datadir_arg.getValue(), "--locus", locus_arg.getValue(), "--ambig-base", ambig_base_arg.getValue(),
+      "--infile", prefix + "-input.csv", "--outfile", prefix + "-partition.csv", "--random-seed", to_string(seed_arg.getValue()),
+      "--hamming-fraction-bound-lo", "0.015", "--hamming-fraction-bound-hi", "0.08", "--logprob-ratio-threshold", "18",  // values from a typical partis partition run
+      "--biggest-naive-seq-cluster-to-calculate", "15", "--biggest-logprob-cluster-to-calculate", "15"};
+  vector<const char*> bench_argv;
+  for(auto &str : argstrs)
+    bench_argv.push_back(str.c_str());
+  Args args(bench_argv.size(), bench_argv.data());
+
+  vector<pair<string, string> > results;  // (name, json)
+  if(benchmark == "all" || benchmark == "trellis")
+    results.push_back(pair<string, string>("trellis", BenchTrellis(sim, hmms, gl, &track, n_reps_arg.getValue(), mut_freq_arg.getValue())));
+  if(benchmark == "all" || benchmark == "dphandler")
+    results.push_back(pair<string, string>("dphandler", BenchDPHandler(sim, hmms, gl, args, &track, IntList(cluster_sizes_arg.getValue()), IntList(k_half_widths_arg.getValue()), n_reps_arg.getValue(), mut_freq_arg.getValue(), n_extra_genes_arg.getValue())));
+  if(benchmark == "all" || benchmark == "glomerator")
+    results.push_back(pair<string, string>("glomerator", BenchGlomerator(hmms, gl, args, &track, families)));
+  remove((prefix + "-input.csv").c_str());
+  remove((prefix + "-partition.csv").c_str());
+
+  ofstream ofs(outfile_arg.getValue());
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open output file " + outfile_arg.getValue());
+  ofs << "{\"seed\": " << seed_arg.getValue() << ", \"n_reps\": " << n_reps_arg.getValue() << ", \"mut_freq\": " << JsonDouble(mut_freq_arg.getValue()) << ",\n";
+  for(size_t ir=0; ir<results.size(); ++ir)
+    ofs << " " << JsonString(results[ir].first) << ": " << results[ir].second << (ir < results.size() - 1 ? ",\n" : "\n");
+  ofs << "}\n";
+  ofs.close();
+  cout << "    wrote " << results.size() << " benchmark" << (results.size() == 1 ? "" : "s") << " to " << outfile_arg.getValue() << endl;
+  return 0;
+}
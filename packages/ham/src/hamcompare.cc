@@ -0,0 +1,298 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+
+#include "args.h"
+#include "dphandler.h"
+#include "queryfile.h"
+#include "text.h"
+#include "tclap/CmdLine.h"
+
+using namespace ham;
+using namespace TCLAP;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// Run DPHandler on each query in a corpus (any bcrham input file) twice, once with the --baseline-args and once with the --candidate-args (extra bcrham
+// arguments, e.g. "--profile-min-cluster-size 1" or "--dont-rescale-emissions"), and report how much the candidate changes the results and how much faster it is:
+//   forward:  log prob deltas
+//   viterbi:  log prob deltas, and the number of queries whose path (i.e. genes, deletions, or insertions), gene calls, or naive sequence changed
+// So before turning on an approximate mode (i.e. anything that trades exactness for speed), run it on a representative corpus and see if the differences are acceptable.
+// Summary goes to --outfile as json, and, with --per-query-file, each query's deltas and timings go to a csv.
+// e.g.: ./hamcompare --hmmdir <parameter-dir>/hmms --datadir <parameter-dir>/germline-sets --locus igh --infile input.csv --candidate-args "--profile-min-cluster-size 1" --outfile compare.json
+
+// ----------------------------------------------------------------------------------------
+// one side of the comparison: its own Args (so it can have different options) and HMMHolder (so neither side can leave the other's hmms modified)
+class CompareMode {
+public:
+  CompareMode(string name, vector<string> argstrs, GermLines &gl, Track *track, string hmmdir);
+  ~CompareMode();
+  void Prepare(vector<string> algorithms, vector<string> genes, bool all_genes, GermLines &gl);
+  Result Run(string algorithm, QueryRecord &qry, double &seconds);
+
+  string name_;
+  string argstr_;  // just the extra args, for printing
+  Args *args_;
+  HMMHolder *hmms_;
+  map<string, DPHandler*> dphs_;  // one for each algorithm (Run() clears its caches for each query, so we can reuse them)
+};
+
+// ----------------------------------------------------------------------------------------
+CompareMode::CompareMode(string name, vector<string> argstrs, GermLines &gl, Track *track, string hmmdir) : name_(name) {
+  vector<const char*> argv;
+  for(auto &str : argstrs)
+    argv.push_back(str.c_str());
+  args_ = new Args(argv.size(), argv.data());
+  hmms_ = new HMMHolder(hmmdir, gl, track, args_->hmm_bundle());
+}
+
+// ----------------------------------------------------------------------------------------
+CompareMode::~CompareMode() {
+  for(auto &kv : dphs_)
+    delete kv.second;
+  delete hmms_;
+  delete args_;
+}
+
+// ----------------------------------------------------------------------------------------
+// read all the hmms that the corpus needs (or all of them, if any query has no only_genes), and make the dphandlers, so neither is included in the timing
+void CompareMode::Prepare(vector<string> algorithms, vector<string> genes, bool all_genes, GermLines &gl) {
+  size_t n_threads(max(1u, args_->n_hmm_threads()));
+  if(all_genes) {
+    hmms_->CacheAll(n_threads);
+  } else {
+    hmms_->Prefetch(genes, n_threads);
+    for(auto &gene : genes)  // wait for them all
+      hmms_->Get(gene);
+  }
+  for(auto &algorithm : algorithms)
+    dphs_[algorithm] = new DPHandler(algorithm, args_, gl, *hmms_);
+}
+
+// ----------------------------------------------------------------------------------------
+Result CompareMode::Run(string algorithm, QueryRecord &qry, double &seconds) {
+  DPHandler &dph(*dphs_.at(algorithm));
+  auto start(chrono::steady_clock::now());
+  Result result(qry.kbounds(), args_->locus());
+  if(args_->profile_min_cluster_size() > 0 && int(qry.seqs_.size()) >= args_->profile_min_cluster_size()) {  // same as what Glomerator does for big clusters
+    Sequences seqs;
+    for(auto &seq : qry.seqs_)
+      seqs.AddSeq(seq);
+    seqs.SetProfile(seqs.BuildProfile());
+    result = dph.Run(seqs, qry.kbounds(), qry.only_genes_, qry.mut_freq_);
+  } else {
+    result = dph.Run(qry.seqs_, qry.kbounds(), qry.only_genes_, qry.mut_freq_);
+  }
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+// ----------------------------------------------------------------------------------------
+// totals over all queries for one algorithm
+class CompareSummary {
+public:
+  CompareSummary() : n_queries(0), baseline_seconds(0.), candidate_seconds(0.), max_abs_delta(0.), total_abs_delta(0.), n_over_tolerance(0), n_no_path_changed(0), n_path_changed(0), n_naive_seq_changed(0) {}
+  string Json(string algorithm);
+
+  size_t n_queries;
+  double baseline_seconds, candidate_seconds;
+  double max_abs_delta, total_abs_delta;  // log prob deltas (for queries that have a path in both)
+  size_t n_over_tolerance, n_no_path_changed, n_path_changed, n_naive_seq_changed;
+  map<string, size_t> n_gene_changed;  // by region
+};
+
+// ----------------------------------------------------------------------------------------
+string CompareSummary::Json(string algorithm) {
+  string json("{\"queries\": " + to_string(n_queries) + ", \"baseline_seconds\": " + JsonDouble(baseline_seconds) + ", \"candidate_seconds\": " + JsonDouble(candidate_seconds)
+	      + ", \"speedup\": " + JsonDouble(candidate_seconds > 0. ? baseline_seconds / candidate_seconds : 0.)
+	      + ",\n   \"logprob_delta\": {\"max_abs\": " + JsonDouble(max_abs_delta) + ", \"mean_abs\": " + JsonDouble(n_queries > 0 ? total_abs_delta / n_queries : 0.) + ", \"n_over_tolerance\": " + to_string(n_over_tolerance) + "}"
+	      + ", \"no_path_changed\": " + to_string(n_no_path_changed));
+  if(algorithm == "viterbi") {
+    json += ",\n   \"path_changed\": " + to_string(n_path_changed) + ", \"naive_seq_changed\": " + to_string(n_naive_seq_changed) + ", \"gene_changed\": {";
+    size_t ientry(0);
+    for(auto &region : vector<string>{"v", "d", "j"})
+      json += (ientry++ > 0 ? ", " : "") + JsonString(region) + ": " + to_string(n_gene_changed[region]);
+    json += "}";
+  }
+  return json + "}";
+}
+
+// ----------------------------------------------------------------------------------------
+// everything in the input file (binary or text), in order
+vector<QueryRecord> ReadCorpus(Args &args, Track *track) {
+  vector<QueryRecord> corpus;
+  if(args.binary_infile()) {
+    QueryFileReader reader(args.infile(), track);
+    QueryRecord qry;
+    while(reader.Next(qry))
+      corpus.push_back(qry);
+    return corpus;
+  }
+  for(size_t iqry=0; iqry<args.str_lists_["names"].size(); ++iqry) {
+    QueryRecord qry;
+    ReadTextQuery(args, iqry, track, qry);
+    corpus.push_back(qry);
+  }
+  return corpus;
+}
+
+// ----------------------------------------------------------------------------------------
+int main(int argc, const char *argv[]) {
+  ValueArg<string> hmmdir_arg("", "hmmdir", "directory with the hmm yamls", true, "", "string");
+  ValueArg<string> datadir_arg("", "datadir", "germline set directory (i.e. bcrham's --datadir)", true, "", "string");
+  ValueArg<string> locus_arg("", "locus", "locus", false, "igh", "string");
+  ValueArg<string> ambig_base_arg("", "ambig-base", "ambiguous base (same as for bcrham)", false, "N", "string");
+  ValueArg<string> infile_arg("", "infile", "corpus of queries, i.e. a bcrham input file (text or binary)", true, "", "string");
+  ValueArg<string> outfile_arg("", "outfile", "output json summary", true, "", "string");
+  ValueArg<string> per_query_arg("", "per-query-file", "if set, write each query's log probs, timings, and what changed to this csv", false, "", "string");
+  ValueArg<string> baseline_args_arg("", "baseline-args", "extra (space-separated) bcrham arguments for the baseline", false, "", "string");
+  ValueArg<string> candidate_args_arg("", "candidate-args", "extra (space-separated) bcrham arguments for the candidate", true, "", "string");
+  ValueArg<string> algorithms_arg("", "algorithms", "colon-separated list of algorithms to compare", false, "viterbi:forward", "string");
+  ValueArg<float> tolerance_arg("", "logprob-tolerance", "count log prob deltas bigger than this", false, 1e-3, "float");
+  SwitchArg fail_arg("", "fail-on-difference", "exit with status 1 if any log prob delta is bigger than --logprob-tolerance, or if any path, gene call, or naive sequence changed", false);
+  try {
+    CmdLine cmd("hamcompare -- compare results and timing for two sets of dp options", ' ', "");
+    cmd.add(hmmdir_arg);
+    cmd.add(datadir_arg);
+    cmd.add(locus_arg);
+    cmd.add(ambig_base_arg);
+    cmd.add(infile_arg);
+    cmd.add(outfile_arg);
+    cmd.add(per_query_arg);
+    cmd.add(baseline_args_arg);
+    cmd.add(candidate_args_arg);
+    cmd.add(algorithms_arg);
+    cmd.add(tolerance_arg);
+    cmd.add(fail_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+
+  Track track(NucleotideTrack(ambig_base_arg.getValue()));
+  GermLines gl(datadir_arg.getValue(), locus_arg.getValue());
+  vector<string> common_args{"hamcompare", "--hmmdir", hmmdir_arg.getValue(), "--datadir", datadir_arg.getValue(), "--locus", locus_arg.getValue(), "--ambig-base", ambig_base_arg.getValue(),
+      "--infile", infile_arg.getValue(), "--outfile", "/dev/null", "--algorithm", "viterbi"};  // bcrham requires an --outfile and --algorithm, but we don't use them
+  vector<CompareMode*> modes;
+  for(auto &name : vector<string>{"baseline", "candidate"}) {
+    string extra_args(name == "baseline" ? baseline_args_arg.getValue() : candidate_args_arg.getValue());
+    vector<string> argstrs(common_args);
+    for(auto &str : PythonSplit(extra_args))
+      argstrs.push_back(str);
+    modes.push_back(new CompareMode(name, argstrs, gl, &track, hmmdir_arg.getValue()));
+    modes.back()->argstr_ = extra_args;
+  }
+  CompareMode &baseline(*modes[0]), &candidate(*modes[1]);
+
+  vector<string> algorithms(SplitString(algorithms_arg.getValue(), ":"));
+  for(auto &algorithm : algorithms)
+    if(algorithm != "viterbi" && algorithm != "forward")
+      throw runtime_error("unhandled algorithm " + algorithm);
+
+  vector<QueryRecord> corpus(ReadCorpus(*baseline.args_, &track));
+  vector<string> genes;  // every gene in any query's only_genes, in order of first appearance
+  set<string> genes_seen;
+  bool all_genes(false);  // a query with no only_genes uses all of them
+  for(auto &qry : corpus) {
+    if(qry.only_genes_.size() == 0)
+      all_genes = true;
+    for(auto &gene : qry.only_genes_)
+      if(genes_seen.insert(gene).second)
+	genes.push_back(gene);
+  }
+  for(auto *mode : modes)
+    mode->Prepare(algorithms, genes, all_genes, gl);
+
+  ofstream per_query_ofs;
+  if(per_query_arg.getValue() != "") {
+    per_query_ofs.open(per_query_arg.getValue());
+    if(!per_query_ofs.is_open())
+      throw runtime_error("couldn't open per-query file " + per_query_arg.getValue());
+    per_query_ofs << setprecision(12) << "unique_ids,algorithm,baseline_logprob,candidate_logprob,delta,baseline_seconds,candidate_seconds,changed" << endl;
+  }
+
+  double tolerance(tolerance_arg.getValue());
+  bool any_difference(false);
+  map<string, CompareSummary> summaries;
+  for(auto &algorithm : algorithms) {
+    CompareSummary &summary(summaries[algorithm]);
+    for(size_t iqry=0; iqry<corpus.size(); ++iqry) {
+      QueryRecord &qry(corpus[iqry]);
+      double baseline_seconds(0.), candidate_seconds(0.);
+      Result baseline_result(baseline.Run(algorithm, qry, baseline_seconds));
+      Result candidate_result(candidate.Run(algorithm, qry, candidate_seconds));
+      ++summary.n_queries;
+      summary.baseline_seconds += baseline_seconds;
+      summary.candidate_seconds += candidate_seconds;
+
+      vector<string> changes;
+      double baseline_logprob(-INFINITY), candidate_logprob(-INFINITY), delta(0.);
+      if(baseline_result.no_path_ != candidate_result.no_path_) {
+	++summary.n_no_path_changed;
+	changes.push_back("no_path");
+      }
+      if(!baseline_result.no_path_ && !candidate_result.no_path_) {
+	if(algorithm == "viterbi") {
+	  RecoEvent &bevent(baseline_result.best_event()), &cevent(candidate_result.best_event());
+	  baseline_logprob = bevent.score_;
+	  candidate_logprob = cevent.score_;
+	  bool path_changed(false);
+	  for(auto &region : gl.regions_) {
+	    if(bevent.genes_[region] != cevent.genes_[region]) {
+	      ++summary.n_gene_changed[region];
+	      changes.push_back(region + "_gene");
+	      path_changed = true;
+	    }
+	  }
+	  if(bevent.deletions_ != cevent.deletions_ || bevent.insertions_ != cevent.insertions_)
+	    path_changed = true;
+	  if(path_changed) {
+	    ++summary.n_path_changed;
+	    changes.push_back("path");
+	  }
+	  if(bevent.naive_seq_ != cevent.naive_seq_) {
+	    ++summary.n_naive_seq_changed;
+	    changes.push_back("naive_seq");
+	  }
+	} else {
+	  baseline_logprob = baseline_result.total_score();
+	  candidate_logprob = candidate_result.total_score();
+	}
+	delta = candidate_logprob - baseline_logprob;
+	if(baseline_logprob == candidate_logprob)  // in case they're both -inf
+	  delta = 0.;
+	summary.max_abs_delta = max(summary.max_abs_delta, fabs(delta));
+	summary.total_abs_delta += fabs(delta);
+	if(fabs(delta) > tolerance) {
+	  ++summary.n_over_tolerance;
+	  changes.push_back("logprob");
+	}
+      }
+      if(changes.size() > 0)
+	any_difference = true;
+      if(per_query_ofs.is_open())
+	per_query_ofs << SeqNameStr(qry.seqs_, ":") << "," << algorithm << "," << baseline_logprob << "," << candidate_logprob << "," << delta << "," << baseline_seconds << "," << candidate_seconds << "," << JoinStrings(changes, ":") << "\n";
+    }
+    printf("    %-8s  %zu queries  speedup %.2f  max |delta logprob| %.2e  (%zu over %.1e)", algorithm.c_str(), summary.n_queries, summary.candidate_seconds > 0. ? summary.baseline_seconds / summary.candidate_seconds : 0., summary.max_abs_delta, summary.n_over_tolerance, tolerance);
+    if(algorithm == "viterbi")
+      printf("  path changed %zu  naive seq changed %zu", summary.n_path_changed, summary.n_naive_seq_changed);
+    printf("\n");
+  }
+  if(per_query_ofs.is_open())
+    per_query_ofs.close();
+
+  ofstream ofs(outfile_arg.getValue());
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open output file " + outfile_arg.getValue());
+  ofs << "{\"baseline_args\": " << JsonString(baseline.argstr_) << ", \"candidate_args\": " << JsonString(candidate.argstr_) << ", \"logprob_tolerance\": " << JsonDouble(tolerance);
+  for(auto &algorithm : algorithms)
+    ofs << ",\n " << JsonString(algorithm) << ": " << summaries[algorithm].Json(algorithm);
+  ofs << "}\n";
+  ofs.close();
+
+  for(auto *mode : modes)
+    delete mode;
+  return (fail_arg.getValue() && any_difference) ? 1 : 0;
+}
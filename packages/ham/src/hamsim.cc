@@ -0,0 +1,164 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+
+#include "queryfile.h"
+#include "simulator.h"
+#include "text.h"
+#include "tclap/CmdLine.h"
+
+using namespace ham;
+using namespace TCLAP;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// Generate large synthetic bcrham partitioning inputs (e.g. to see how Glomerator scales to 10^5 or 10^6 sequences) from the germline set in --datadir and the hmms
+// in --hmmdir (we only use genes that have hmms, so you can run bcrham on the output with the same --hmmdir and --datadir). Each family is one rearrangement
+// (see Simulator::Rearrange()), with its sequences mutated along a random tree (see Simulator::AddTreeSeqs()), and family sizes drawn from --family-sizes.
+// Families are written as they're made, so memory doesn't depend on --n-seqs. Sequences are padded with --ambig-base so each cdr3 length class has
+// the same length (see Simulator::PadSeq()), but the true annotation file has the unpadded naive sequence and k values. This is much less realistic than partis's simulation, but also much faster.
+// e.g.: ./hamsim --hmmdir <parameter-dir>/hmms --datadir <parameter-dir>/germline-sets --locus igh --n-seqs 100000 --outfile input.csv --true-partition-file true.csv
+
+// ----------------------------------------------------------------------------------------
+// one line per family, with the true rearrangement info
+void WriteTrueAnnotationHeader(ofstream &ofs) {
+  ofs << "unique_ids,v_gene,d_gene,j_gene,v_3p_del,d_5p_del,d_3p_del,j_5p_del,vd_insertion,dj_insertion,naive_seq,k_v,k_d,cdr3_length,mut_freq" << endl;
+}
+void WriteTrueAnnotation(ofstream &ofs, SimulatedFamily &family) {
+  ofs << JoinStrings(family.names_, ":") << "," << family.genes_["v"] << "," << family.genes_["d"] << "," << family.genes_["j"]
+      << "," << family.deletions_["v_3p"] << "," << family.deletions_["d_5p"] << "," << family.deletions_["d_3p"] << "," << family.deletions_["j_5p"]
+      << "," << family.insertions_["vd"] << "," << family.insertions_["dj"] << "," << family.naive_seq_ << "," << family.k_v_ << "," << family.k_d_
+      << "," << family.cdr3_length_ << "," << family.mut_freq_ << "\n";
+}
+
+// ----------------------------------------------------------------------------------------
+int main(int argc, const char *argv[]) {
+  vector<string> distributions{"constant", "geometric", "power-law"};
+  ValuesConstraint<string> distributions_constraint(distributions);
+  vector<string> formats{"csv", "binary"};
+  ValuesConstraint<string> formats_constraint(formats);
+  ValueArg<string> hmmdir_arg("", "hmmdir", "directory with the hmm yamls (we only use genes that have one)", true, "", "string");
+  ValueArg<string> datadir_arg("", "datadir", "germline set directory (i.e. bcrham's --datadir)", true, "", "string");
+  ValueArg<string> locus_arg("", "locus", "locus", false, "igh", "string");
+  ValueArg<string> outfile_arg("", "outfile", "output bcrham input file, with one sequence per line (i.e. for bcrham --partition)", true, "", "string");
+  ValueArg<string> output_format_arg("", "output-format", "format for --outfile: csv (i.e. whitespace-separated text), or binary (see queryfile.h)", false, "csv", &formats_constraint);
+  ValueArg<string> true_partition_arg("", "true-partition-file", "if set, write the true partition here, in the same format as bcrham --partition's --outfile", false, "", "string");
+  ValueArg<string> true_annotation_arg("", "true-annotation-file", "if set, write each family's true genes, deletions, insertions, naive sequence, etc. to this csv", false, "", "string");
+  ValueArg<string> ambig_base_arg("", "ambig-base", "ambiguous base, which we pad the sequences with (should be the same as you'll pass to bcrham)", false, "N", "string");
+  ValueArg<string> family_sizes_arg("", "family-sizes", "family size distribution", false, "geometric", &distributions_constraint);
+  ValueArg<float> mean_family_size_arg("", "mean-family-size", "mean family size for --family-sizes constant or geometric", false, 5., "float");
+  ValueArg<float> power_law_exponent_arg("", "power-law-exponent", "exponent for --family-sizes power-law, i.e. P(n) is proportional to n^-exponent", false, 2., "float");
+  ValueArg<unsigned> max_family_size_arg("", "max-family-size", "largest family size", false, 10000, "unsigned");
+  ValueArg<unsigned> n_seqs_arg("", "n-seqs", "total number of sequences (the last family is truncated if need be)", false, 1000, "unsigned");
+  ValueArg<float> mut_freq_arg("", "mut-freq", "mean mutation frequency: each family's root-to-leaf mutation probability is uniform between 0.5 and 1.5 times this", false, 0.05, "float");
+  ValueArg<unsigned> k_half_width_arg("", "k-half-width", "k bounds half-width, i.e. k_v and k_d are each in [true - w, true + w]", false, 2, "unsigned");
+  ValueArg<unsigned> n_extra_genes_arg("", "n-extra-genes", "number of genes (in each region) besides the true one to put in only_genes", false, 2, "unsigned");
+  ValueArg<unsigned> seed_arg("", "seed", "random seed", false, 1, "unsigned");
+  try {
+    CmdLine cmd("hamsim -- fast synthetic clonal family inputs for bcrham", ' ', "");
+    cmd.add(hmmdir_arg);
+    cmd.add(datadir_arg);
+    cmd.add(locus_arg);
+    cmd.add(outfile_arg);
+    cmd.add(output_format_arg);
+    cmd.add(true_partition_arg);
+    cmd.add(true_annotation_arg);
+    cmd.add(ambig_base_arg);
+    cmd.add(family_sizes_arg);
+    cmd.add(mean_family_size_arg);
+    cmd.add(power_law_exponent_arg);
+    cmd.add(max_family_size_arg);
+    cmd.add(n_seqs_arg);
+    cmd.add(mut_freq_arg);
+    cmd.add(k_half_width_arg);
+    cmd.add(n_extra_genes_arg);
+    cmd.add(seed_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+  auto start(chrono::steady_clock::now());
+
+  GermLines gl(datadir_arg.getValue(), locus_arg.getValue());
+  map<string, vector<string> > available_genes(GenesWithHmms(gl, hmmdir_arg.getValue()));
+  Simulator sim(gl, available_genes, seed_arg.getValue());
+  FamilySizeDistribution family_sizes(family_sizes_arg.getValue(), mean_family_size_arg.getValue(), power_law_exponent_arg.getValue(), max_family_size_arg.getValue());
+  uniform_real_distribution<double> mut_freq_factor(0.5, 1.5);
+
+  Track track(NucleotideTrack(ambig_base_arg.getValue()));
+  bool binary(output_format_arg.getValue() == "binary");
+  ofstream ofs;
+  QueryFileWriter *writer(nullptr);
+  if(binary) {
+    vector<string> all_genes;
+    for(auto &region : gl.regions_)
+      all_genes.insert(all_genes.end(), available_genes[region].begin(), available_genes[region].end());
+    writer = new QueryFileWriter(outfile_arg.getValue(), &track, all_genes);
+  } else {
+    ofs.open(outfile_arg.getValue());
+    if(!ofs.is_open())
+      throw runtime_error("couldn't open output file " + outfile_arg.getValue());
+    sim.WriteInputHeader(ofs);
+  }
+  ofstream partition_ofs, annotation_ofs;
+  if(true_partition_arg.getValue() != "") {
+    partition_ofs.open(true_partition_arg.getValue());
+    if(!partition_ofs.is_open())
+      throw runtime_error("couldn't open true partition file " + true_partition_arg.getValue());
+    partition_ofs << "partition,logprob" << endl;
+  }
+  if(true_annotation_arg.getValue() != "") {
+    annotation_ofs.open(true_annotation_arg.getValue());
+    if(!annotation_ofs.is_open())
+      throw runtime_error("couldn't open true annotation file " + true_annotation_arg.getValue());
+    WriteTrueAnnotationHeader(annotation_ofs);
+  }
+
+  size_t n_seqs(0), n_families(0), biggest_family(0);
+  while(n_seqs < n_seqs_arg.getValue()) {
+    size_t family_size(min(family_sizes.Draw(sim.rng()), size_t(n_seqs_arg.getValue() - n_seqs)));
+    SimulatedFamily family(sim.Rearrange());
+    sim.AddTreeSeqs(family, family_size, mut_freq_arg.getValue() * mut_freq_factor(sim.rng()));
+    if(binary) {
+      KBounds kb(sim.GetKBounds(family, k_half_width_arg.getValue()));
+      QueryRecord record;
+      record.k_v_min_ = kb.vmin + sim.LeftPadding(family);
+      record.k_v_max_ = kb.vmax + sim.LeftPadding(family);
+      record.k_d_min_ = kb.dmin;
+      record.k_d_max_ = kb.dmax;
+      record.cdr3_length_ = family.cdr3_length_;
+      record.mut_freq_ = family.mut_freq_;
+      record.only_genes_ = sim.OnlyGenes(family, n_extra_genes_arg.getValue());
+      for(size_t is=0; is<family.n_seqs(); ++is) {
+	string padded_seq(sim.PadSeq(family, family.seqs_[is], ambig_base_arg.getValue()));
+	record.seqs_ = {Sequence(&track, family.names_[is], padded_seq)};
+	writer->Write(record);
+      }
+    } else {
+      sim.WriteInputLines(ofs, family, k_half_width_arg.getValue(), n_extra_genes_arg.getValue(), ambig_base_arg.getValue());
+    }
+    if(partition_ofs.is_open())
+      partition_ofs << (n_families > 0 ? ";" : "") << JoinStrings(family.names_, ":");
+    if(annotation_ofs.is_open())
+      WriteTrueAnnotation(annotation_ofs, family);
+    n_seqs += family.n_seqs();
+    ++n_families;
+    biggest_family = max(biggest_family, family.n_seqs());
+  }
+
+  if(writer != nullptr) {
+    writer->Close();
+    delete writer;
+  } else {
+    ofs.close();
+  }
+  if(partition_ofs.is_open()) {
+    partition_ofs << ",-inf" << endl;  // i.e. we don't know its log prob
+    partition_ofs.close();
+  }
+  if(annotation_ofs.is_open())
+    annotation_ofs.close();
+  printf("    wrote %zu sequences in %zu families (biggest %zu) to %s in %.1f seconds\n", n_seqs, n_families, biggest_family, outfile_arg.getValue().c_str(), chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  return 0;
+}
@@ -0,0 +1,265 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <dirent.h>
+
+#include "cachefile.h"
+#include "queryfile.h"
+#include "outputwriter.h"
+#include "hmmbundle.h"
+#include "text.h"
+#include "tclap/CmdLine.h"
+
+using namespace ham;
+using namespace TCLAP;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// read any number of cache files (csv or binary), merging them in order (so values in later files replace those in earlier ones), and write the result in either format.
+// With <journals> set (i.e. for compact-cache), the csv files are bcrham --cache-journal files, which may end with a partial line if bcrham was killed.
+void ConvertCache(vector<string> infnames, string outfname, string format, bool journals=false) {
+  map<string, CacheEntry> entries;
+  for(auto &fname : infnames) {
+    size_t n_before(entries.size());
+    if(IsBinaryCacheFile(fname)) {
+      BinaryCacheReader reader(fname);
+      for(size_t ir=0; ir<reader.size(); ++ir) {
+	CacheEntry entry;
+	reader.Get(ir, entry);
+	if(entries.count(entry.key_))
+	  entries[entry.key_].Update(entry);
+	else
+	  entries[entry.key_] = entry;
+      }
+    } else {
+      ReadCsvCacheFile(fname, entries, journals);
+    }
+    cout << "    read " << fname << " (" << entries.size() - n_before << " new keys)" << endl;
+  }
+
+  if(format == "binary") {
+    vector<CacheEntry> entry_list;
+    for(auto &kv : entries)
+      entry_list.push_back(kv.second);
+    WriteBinaryCacheFile(outfname, entry_list);
+  } else if(format == "csv") {
+    ofstream ofs(outfname);
+    if(!ofs.is_open())
+      throw runtime_error("couldn't open output cache file " + outfname);
+    WriteCsvCacheHeader(ofs);
+    for(auto &kv : entries)
+      WriteCsvCacheLine(ofs, kv.second);
+    ofs.close();
+  } else {
+    throw runtime_error("unhandled --format " + format);
+  }
+  cout << "    wrote " << entries.size() << " keys to " << outfname << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// Parse one line of a (whitespace-separated) bcrham input file, where <headers> is the file's column order.
+// NOTE Args reads the whole input file into memory, so the streaming conversions here can't use it (or ReadTextQuery(), which reads from Args). Keep the column
+// handling the same as theirs, though: unknown columns throw (as in Args), names and seqs are required, and anything else that's missing is left at QueryRecord's default (as in ReadTextQuery()).
+QueryRecord ParseQueryLine(string &line, vector<string> &headers, Track *track) {
+  if(find(headers.begin(), headers.end(), "names") == headers.end() || find(headers.begin(), headers.end(), "seqs") == headers.end())
+    throw runtime_error("bcrham input file needs both names and seqs columns");
+  QueryRecord record;
+  vector<string> names, seqs;
+  stringstream ss(line);
+  for(auto &head : headers) {
+    string val;
+    ss >> val;
+    if(head == "names")
+      names = SplitString(val, ":");
+    else if(head == "seqs")
+      seqs = SplitString(val, ":");
+    else if(head == "only_genes")
+      record.only_genes_ = SplitString(val, ":");
+    else if(head == "k_v_min")
+      record.k_v_min_ = stoi(val);
+    else if(head == "k_v_max")
+      record.k_v_max_ = stoi(val);
+    else if(head == "k_d_min")
+      record.k_d_min_ = stoi(val);
+    else if(head == "k_d_max")
+      record.k_d_max_ = stoi(val);
+    else if(head == "cdr3_length")
+      record.cdr3_length_ = stoi(val);
+    else if(head == "mut_freq")
+      record.mut_freq_ = stod(val);
+    else
+      throw runtime_error("unexpected header " + head + " in bcrham input file");
+  }
+  if(names.size() != seqs.size())
+    throw runtime_error("different number of names and seqs in line: " + line);
+  for(size_t is=0; is<names.size(); ++is)
+    record.seqs_.push_back(Sequence(track, names[is], seqs[is]));
+  return record;
+}
+
+// ----------------------------------------------------------------------------------------
+// convert a text bcrham input file to the binary format (see queryfile.h). We go through the file twice so the gene names can go in the header without holding every query in memory.
+void ConvertInput(string infname, string outfname, string ambig_base) {
+  Track track(NucleotideTrack(ambig_base));
+
+  vector<string> headers;
+  set<string> gene_set;
+  for(size_t ipass=0; ipass<2; ++ipass) {
+    ifstream ifs(infname);
+    if(!ifs.is_open())
+      throw runtime_error("bcrham input file " + infname + " d.n.e.");
+    string line;
+    getline(ifs, line);
+    headers = PythonSplit(line);
+    QueryFileWriter *writer(ipass == 0 ? nullptr : new QueryFileWriter(outfname, &track, vector<string>(gene_set.begin(), gene_set.end())));
+    size_t n_queries(0);
+    while(getline(ifs, line)) {
+      if(line.size() < 10)  // same as in args.cc: skip blank lines
+	continue;
+      QueryRecord record(ParseQueryLine(line, headers, &track));
+      if(ipass == 0)
+	gene_set.insert(record.only_genes_.begin(), record.only_genes_.end());
+      else
+	writer->Write(record);
+      ++n_queries;
+    }
+    if(writer != nullptr) {
+      writer->Close();
+      delete writer;
+      cout << "    wrote " << n_queries << " queries (" << gene_set.size() << " genes) to " << outfname << endl;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// write each query's estimated cost (see QueryRecord::EstimatedCost()) to a csv, in input order, so partitiondriver can split the input into chunks of equal total cost rather than of equal numbers of queries
+void EstimateCosts(string infname, string outfname, string ambig_base) {
+  Track track(NucleotideTrack(ambig_base));
+  ofstream ofs(outfname);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open output file " + outfname);
+  ofs << "unique_ids,cost" << endl;
+
+  size_t n_queries(0);
+  double total_cost(0.);
+  QueryRecord record;
+  auto write_cost = [&](QueryRecord &rec) {
+    double cost(rec.EstimatedCost());
+    ofs << SeqNameStr(rec.seqs_, ":") << "," << cost << "\n";
+    total_cost += cost;
+    ++n_queries;
+  };
+  if(IsBinaryQueryFile(infname)) {
+    QueryFileReader reader(infname, &track);
+    while(reader.Next(record))
+      write_cost(record);
+  } else {
+    ifstream ifs(infname);
+    if(!ifs.is_open())
+      throw runtime_error("bcrham input file " + infname + " d.n.e.");
+    string line;
+    getline(ifs, line);
+    vector<string> headers(PythonSplit(line));
+    while(getline(ifs, line)) {
+      if(line.size() < 10)  // same as in args.cc: skip blank lines
+	continue;
+      record = ParseQueryLine(line, headers, &track);
+      write_cost(record);
+    }
+  }
+  ofs.close();
+  cout << "    wrote costs for " << n_queries << " queries (total " << total_cost << ") to " << outfname << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// convert a binary bcrham annotation/log prob file (--output-format binary) to the csv that bcrham would have written
+void AnnotationsToCsv(string infname, string outfname) {
+  AnnotationReader reader(infname);
+  AnnotationWriter writer(outfname, reader.algorithm(), "csv");
+  AnnotationRecord record;
+  size_t n_records(0);
+  while(reader.Next(record)) {
+    writer.Write(record);
+    ++n_records;
+  }
+  writer.Close();
+  cout << "    wrote " << n_records << " " << reader.algorithm() << " records to " << outfname << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// parse every yaml in each of <hmmdirs> (i.e. what bcrham would otherwise do one gene at a time in every process) and write them all to one bundle file for bcrham --hmm-bundle
+void CompileHmms(vector<string> hmmdirs, string outfname) {
+  vector<Model*> models;
+  for(auto &hmmdir : hmmdirs) {
+    DIR *dir = opendir(hmmdir.c_str());
+    if(dir == nullptr)
+      throw runtime_error("couldn't open hmm dir " + hmmdir);
+    vector<string> fnames;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != nullptr) {
+      string fname(entry->d_name);
+      if(fname.size() > 5 && fname.substr(fname.size() - 5) == ".yaml")
+	fnames.push_back(fname);
+    }
+    closedir(dir);
+    sort(fnames.begin(), fnames.end());
+    for(auto &fname : fnames) {
+      Model *model(new Model);
+      model->Parse(hmmdir + "/" + fname);
+      if(model->name() + ".yaml" != fname)
+	throw runtime_error("model in " + hmmdir + "/" + fname + " is called " + model->name() + ", but bcrham looks for models by file name");
+      models.push_back(model);
+    }
+    cout << "    read " << fnames.size() << " hmms from " << hmmdir << endl;
+  }
+
+  WriteHMMBundle(outfname, models);
+  size_t n_states(0);
+  for(auto &model : models) {
+    n_states += model->n_states();
+    delete model;
+  }
+  cout << "    wrote " << models.size() << " hmms (" << n_states << " states) to " << outfname << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+int main(int argc, const char *argv[]) {
+  vector<string> actions{"convert-cache", "compact-cache", "convert-input", "annotations-to-csv", "compile-hmms", "estimate-costs"};
+  ValuesConstraint<string> actions_constraint(actions);
+  vector<string> formats{"binary", "csv"};
+  ValuesConstraint<string> formats_constraint(formats);
+  ValueArg<string> action_arg("", "action", "what to do", true, "", &actions_constraint);
+  ValueArg<string> infiles_arg("", "infiles", "colon-separated list of input files (or, for compile-hmms, hmm directories)", true, "", "string");
+  ValueArg<string> outfile_arg("", "outfile", "output file", true, "", "string");
+  ValueArg<string> format_arg("", "format", "output format (for cache files)", false, "binary", &formats_constraint);
+  ValueArg<string> ambig_base_arg("", "ambig-base", "ambiguous base (for convert-input and estimate-costs, should be the same as you'll pass to bcrham)", false, "", "string");
+  try {
+    CmdLine cmd("hamutil -- file conversion and maintenance for bcrham", ' ', "");
+    cmd.add(action_arg);
+    cmd.add(infiles_arg);
+    cmd.add(outfile_arg);
+    cmd.add(format_arg);
+    cmd.add(ambig_base_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+
+  if(action_arg.getValue() == "convert-cache")
+    ConvertCache(SplitString(infiles_arg.getValue(), ":"), outfile_arg.getValue(), format_arg.getValue());
+  else if(action_arg.getValue() == "compact-cache")
+    ConvertCache(SplitString(infiles_arg.getValue(), ":"), outfile_arg.getValue(), format_arg.getValue(), true);
+  else if(action_arg.getValue() == "convert-input")
+    ConvertInput(infiles_arg.getValue(), outfile_arg.getValue(), ambig_base_arg.getValue());
+  else if(action_arg.getValue() == "annotations-to-csv")
+    AnnotationsToCsv(infiles_arg.getValue(), outfile_arg.getValue());
+  else if(action_arg.getValue() == "estimate-costs")
+    EstimateCosts(infiles_arg.getValue(), outfile_arg.getValue(), ambig_base_arg.getValue());
+  else if(action_arg.getValue() == "compile-hmms")
+    CompileHmms(SplitString(infiles_arg.getValue(), ":"), outfile_arg.getValue());
+  else
+    throw runtime_error("unhandled --action " + action_arg.getValue());
+
+  return 0;
+}
@@ -0,0 +1,291 @@
+#include "hmmbundle.h"
+#include "mathutils.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+bool IsHMMBundleFile(string fname) {
+  ifstream ifs(fname, ios::binary);
+  if(!ifs.is_open())
+    return false;
+  char magic[8];
+  if(!ifs.read(magic, 8))
+    return false;
+  return strncmp(magic, HMM_BUNDLE_MAGIC, 8) == 0;
+}
+
+// ----------------------------------------------------------------------------------------
+HMMBundle::HMMBundle(string fname) :
+  fname_(fname),
+  fd_(-1),
+  map_size_(0),
+  data_(nullptr)
+{
+  fd_ = open(fname_.c_str(), O_RDONLY);
+  if(fd_ < 0)
+    throw runtime_error("couldn't open hmm bundle " + fname_);
+  struct stat st;
+  if(fstat(fd_, &st) != 0 || size_t(st.st_size) < sizeof(HMMBundleHeader)) {
+    close(fd_);
+    throw runtime_error("hmm bundle " + fname_ + " is too short to have a header");
+  }
+  map_size_ = st.st_size;
+  void *addr = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd_, 0);  // read-only and shared, so every process on the machine uses the same physical pages
+  if(addr == MAP_FAILED) {
+    close(fd_);
+    throw runtime_error("couldn't mmap hmm bundle " + fname_);
+  }
+  data_ = (const char*)addr;
+
+  header_ = (const HMMBundleHeader*)data_;
+  try {
+    CheckHeader();
+  } catch(...) {  // the destructor won't run if we throw from here, so we have to clean up ourselves
+    munmap((void*)data_, map_size_);
+    close(fd_);
+    throw;
+  }
+
+  models_ = (const HMMBundleModel*)(data_ + header_->models_offset);
+  states_ = (const HMMBundleState*)(data_ + header_->states_offset);
+  transitions_ = (const HMMBundleTransition*)(data_ + header_->transitions_offset);
+  emissions_ = (const double*)(data_ + header_->emissions_offset);
+  symbols_ = (const HMMBundleString*)(data_ + header_->symbols_offset);
+  strings_ = data_ + header_->strings_offset;
+}
+
+// ----------------------------------------------------------------------------------------
+// make sure each table is aligned and lies inside the file (the records in the tables get checked as they're read, in the accessors)
+void HMMBundle::CheckHeader() {
+  if(strncmp(header_->magic, HMM_BUNDLE_MAGIC, 8) != 0)
+    throw runtime_error("bad magic string in hmm bundle " + fname_);
+  if(header_->version != HMM_BUNDLE_VERSION)
+    throw runtime_error("hmm bundle " + fname_ + " has version " + to_string(header_->version) + ", but we only know how to read version " + to_string(HMM_BUNDLE_VERSION));
+  if(header_->byte_order != HMM_BUNDLE_BYTE_ORDER)
+    throw runtime_error("hmm bundle " + fname_ + " was written on a machine with different byte order");
+  if(header_->file_size != map_size_)
+    throw runtime_error("hmm bundle " + fname_ + " has size " + to_string(map_size_) + " but header says " + to_string(header_->file_size) + " (truncated?)");
+
+  CheckTable("model", header_->models_offset, header_->n_models, sizeof(HMMBundleModel));
+  CheckTable("state", header_->states_offset, header_->n_states, sizeof(HMMBundleState));
+  CheckTable("transition", header_->transitions_offset, header_->n_transitions, sizeof(HMMBundleTransition));
+  CheckTable("emission", header_->emissions_offset, header_->n_emissions, sizeof(double));
+  CheckTable("symbol", header_->symbols_offset, header_->n_symbols, sizeof(HMMBundleString));
+  if(header_->strings_offset > map_size_)
+    throw runtime_error("string table starts past the end of hmm bundle " + fname_);
+  if(header_->n_symbols > 0 && header_->n_emissions % header_->n_symbols != 0)
+    throw runtime_error("emission table size " + to_string(header_->n_emissions) + " isn't a multiple of the number of symbols " + to_string(header_->n_symbols) + " in hmm bundle " + fname_);
+}
+
+// ----------------------------------------------------------------------------------------
+HMMBundle::~HMMBundle() {
+  munmap((void*)data_, map_size_);
+  close(fd_);
+}
+
+// ----------------------------------------------------------------------------------------
+void HMMBundle::CheckTable(string name, uint64_t offset, uint64_t n_entries, size_t entry_size) {
+  if(offset % 8 != 0)
+    throw runtime_error(name + " table in hmm bundle " + fname_ + " isn't aligned");
+  if(n_entries > map_size_ / entry_size || !InBounds(offset, n_entries * entry_size, map_size_))  // first check is so the multiplication can't overflow
+    throw runtime_error(name + " table extends past the end of hmm bundle " + fname_);
+}
+
+// ----------------------------------------------------------------------------------------
+const HMMBundleModel &HMMBundle::model(size_t imodel) {
+  if(imodel >= header_->n_models)
+    throw runtime_error("model index " + to_string(imodel) + " out of range in hmm bundle " + fname_);
+  const HMMBundleModel &bmodel(models_[imodel]);
+  if(!InBounds(bmodel.first_state, bmodel.n_states + 1, header_->n_states))  // +1 for init
+    throw runtime_error("states out of range for model " + to_string(imodel) + " in hmm bundle " + fname_);
+  return bmodel;
+}
+
+// ----------------------------------------------------------------------------------------
+const HMMBundleState &HMMBundle::state(size_t istate) {
+  if(istate >= header_->n_states)
+    throw runtime_error("state index " + to_string(istate) + " out of range in hmm bundle " + fname_);
+  const HMMBundleState &bst(states_[istate]);
+  if(!InBounds(bst.first_transition, bst.n_transitions, header_->n_transitions))
+    throw runtime_error("transitions out of range for state " + to_string(istate) + " in hmm bundle " + fname_);
+  if((bst.flags & HAS_EMISSIONS) && !InBounds(bst.first_emission, header_->n_symbols, header_->n_emissions))
+    throw runtime_error("emissions out of range for state " + to_string(istate) + " in hmm bundle " + fname_);
+  return bst;
+}
+
+// ----------------------------------------------------------------------------------------
+const HMMBundleTransition &HMMBundle::transition(size_t itrans) {
+  if(itrans >= header_->n_transitions)
+    throw runtime_error("transition index " + to_string(itrans) + " out of range in hmm bundle " + fname_);
+  return transitions_[itrans];
+}
+
+// ----------------------------------------------------------------------------------------
+const double *HMMBundle::emissions(const HMMBundleState &st) {
+  if(!InBounds(st.first_emission, header_->n_symbols, header_->n_emissions))
+    throw runtime_error("emissions out of range in hmm bundle " + fname_);
+  return emissions_ + st.first_emission;
+}
+
+// ----------------------------------------------------------------------------------------
+string HMMBundle::String(const HMMBundleString &str) {
+  if(!InBounds(str.offset, str.length, map_size_ - header_->strings_offset))
+    throw runtime_error("string out of range in hmm bundle " + fname_);
+  return string(strings_ + str.offset, str.length);
+}
+
+// ----------------------------------------------------------------------------------------
+int HMMBundle::Find(const string &name) {
+  size_t lo(0), hi(header_->n_models);
+  while(lo < hi) {
+    size_t mid((lo + hi) / 2);
+    int cmp(name.compare(String(models_[mid].name)));
+    if(cmp == 0)
+      return int(mid);
+    if(cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return -1;
+}
+
+// ----------------------------------------------------------------------------------------
+Track *HMMBundle::NewTrack(string ambiguous_char) {
+  Track *track(new Track);
+  track->set_name(String(header_->track_name));
+  if(ambiguous_char != "")
+    track->SetAmbiguous(ambiguous_char);
+  for(size_t is=0; is<header_->n_symbols; ++is)
+    track->AddSymbol(String(symbols_[is]));
+  return track;
+}
+
+// ----------------------------------------------------------------------------------------
+HMMBundleString AddBundleString(string &string_table, const string &str) {
+  HMMBundleString bstr;
+  memset(&bstr, 0, sizeof(bstr));
+  bstr.offset = string_table.size();
+  bstr.length = str.size();
+  string_table += str;
+  return bstr;
+}
+
+// ----------------------------------------------------------------------------------------
+void AddBundleState(State *st, vector<HMMBundleState> &states, vector<HMMBundleTransition> &transitions, vector<double> &emissions, string &string_table) {
+  HMMBundleState bst;
+  memset(&bst, 0, sizeof(bst));
+  bst.name = AddBundleString(string_table, st->name());
+  bst.germline_nuc = AddBundleString(string_table, st->germline_nuc());
+  bst.ambiguous_char = AddBundleString(string_table, st->ambiguous_char());
+  bst.ambiguous_emission_logprob = st->ambiguous_emission_logprob();
+  bst.end_transition_logprob = st->end_transition_logprob();
+  if(st->trans_to_end() != nullptr)
+    bst.flags |= HAS_END_TRANSITION;
+
+  bst.first_transition = transitions.size();
+  for(size_t it=0; it<st->transitions()->size(); ++it) {  // after Model::Finalize(), these are sorted by to-state index
+    Transition *trans(st->transition(it));
+    HMMBundleTransition btrans;
+    memset(&btrans, 0, sizeof(btrans));
+    btrans.to_state = trans->to_state()->index();
+    btrans.log_prob = trans->log_prob();
+    transitions.push_back(btrans);
+  }
+  bst.n_transitions = transitions.size() - bst.first_transition;
+
+  if(st->name() != "init") {
+    bst.flags |= HAS_EMISSIONS;
+    bst.first_emission = emissions.size();
+    vector<double> log_probs(st->emission()->log_probs());
+    emissions.insert(emissions.end(), log_probs.begin(), log_probs.end());
+  }
+
+  states.push_back(bst);
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE like WriteBinaryCacheFile(), we write to a temporary file and then rename it, so running processes that have the old one mmap'd aren't affected
+void WriteHMMBundle(string fname, vector<Model*> &models) {
+  if(models.size() == 0)
+    throw runtime_error("no models to write to hmm bundle " + fname);
+  vector<Model*> sorted_models(models);
+  sort(sorted_models.begin(), sorted_models.end(), [](Model *a, Model *b) { return a->name() < b->name(); });
+
+  Track *track(sorted_models[0]->track());
+  vector<HMMBundleModel> bmodels;
+  vector<HMMBundleState> states;
+  vector<HMMBundleTransition> transitions;
+  vector<double> emissions;
+  string string_table;
+  for(auto &model : sorted_models) {
+    if(bmodels.size() > 0 && model->name() == sorted_models[bmodels.size() - 1]->name())
+      throw runtime_error("duplicate model " + model->name() + " when writing hmm bundle " + fname);
+    if(model->track()->name() != track->name() || model->track()->Stringify() != track->Stringify())
+      throw runtime_error("model " + model->name() + " has track " + model->track()->name() + ":" + model->track()->Stringify() + ", but hmm bundles can only have one track (" + track->name() + ":" + track->Stringify() + ")");
+
+    HMMBundleModel bmodel;
+    memset(&bmodel, 0, sizeof(bmodel));
+    bmodel.name = AddBundleString(string_table, model->name());
+    bmodel.ambiguous_char = AddBundleString(string_table, model->ambiguous_char());
+    bmodel.overall_prob = model->overall_prob();
+    bmodel.original_overall_mute_freq = model->original_overall_mute_freq();
+    bmodel.first_state = states.size();
+    bmodel.n_states = model->n_states();
+    for(size_t ist=0; ist<model->n_states(); ++ist)
+      AddBundleState(model->state(ist), states, transitions, emissions, string_table);
+    AddBundleState(model->init_state(), states, transitions, emissions, string_table);
+    bmodels.push_back(bmodel);
+  }
+
+  vector<HMMBundleString> symbols;
+  for(size_t is=0; is<track->alphabet_size(); ++is)
+    symbols.push_back(AddBundleString(string_table, track->symbol(is)));
+
+  HMMBundleHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HMM_BUNDLE_MAGIC, 8);
+  header.version = HMM_BUNDLE_VERSION;
+  header.byte_order = HMM_BUNDLE_BYTE_ORDER;
+  header.n_models = bmodels.size();
+  header.n_states = states.size();
+  header.n_transitions = transitions.size();
+  header.n_emissions = emissions.size();
+  header.n_symbols = symbols.size();
+  header.track_name = AddBundleString(string_table, track->name());
+  header.models_offset = sizeof(HMMBundleHeader);
+  header.states_offset = header.models_offset + sizeof(HMMBundleModel) * bmodels.size();
+  header.transitions_offset = header.states_offset + sizeof(HMMBundleState) * states.size();
+  header.emissions_offset = header.transitions_offset + sizeof(HMMBundleTransition) * transitions.size();
+  header.symbols_offset = header.emissions_offset + sizeof(double) * emissions.size();
+  header.strings_offset = header.symbols_offset + sizeof(HMMBundleString) * symbols.size();
+  header.file_size = header.strings_offset + string_table.size();
+
+  string tmpfname(fname + ".tmp");
+  ofstream ofs(tmpfname, ios::binary);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open output hmm bundle " + tmpfname);
+  ofs.write((const char*)&header, sizeof(header));
+  ofs.write((const char*)bmodels.data(), sizeof(HMMBundleModel) * bmodels.size());
+  ofs.write((const char*)states.data(), sizeof(HMMBundleState) * states.size());
+  ofs.write((const char*)transitions.data(), sizeof(HMMBundleTransition) * transitions.size());
+  ofs.write((const char*)emissions.data(), sizeof(double) * emissions.size());
+  ofs.write((const char*)symbols.data(), sizeof(HMMBundleString) * symbols.size());
+  ofs.write(string_table.data(), string_table.size());
+  ofs.close();
+  if(!ofs)
+    throw runtime_error("failed writing hmm bundle " + tmpfname);
+  if(rename(tmpfname.c_str(), fname.c_str()) != 0)
+    throw runtime_error("couldn't move " + tmpfname + " to " + fname);
+}
+
+}
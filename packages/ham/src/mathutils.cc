@@ -9,4 +9,10 @@ double AddWithMinusInfinities(double first, double second) {
     return first + second;
 }
 
+// ----------------------------------------------------------------------------------------
+// written so it can't overflow, since the arguments usually come straight out of a file we're mmap'ing
+bool InBounds(uint64_t offset, uint64_t length, uint64_t size) {
+  return offset <= size && length <= size - offset;
+}
+
 }
@@ -1,4 +1,5 @@
 #include "model.h"
+#include "hmmbundle.h"
 
 namespace ham {
 // ----------------------------------------------------------------------------------------
@@ -94,7 +95,6 @@ void Model::Parse(string infname) {
     if(state->name() == "init") {
       initial_ = state;
     } else {
-      assert(states_.size() < STATE_MAX);
       states_.push_back(state);
     }
     states_by_name_[state->name()] = state;
@@ -103,10 +103,36 @@ void Model::Parse(string infname) {
   Finalize(); // post process states and/to create an end state with only transitions-from
 }
 
+// ----------------------------------------------------------------------------------------
+void Model::Load(HMMBundle &bundle, size_t imodel) {
+  const HMMBundleModel &bmodel(bundle.model(imodel));
+  name_ = bundle.String(bmodel.name);
+  overall_prob_ = bmodel.overall_prob;
+  original_overall_mute_freq_ = bmodel.original_overall_mute_freq;
+  ambiguous_char_ = bundle.String(bmodel.ambiguous_char);
+  assert(track_ == nullptr);
+  track_ = bundle.NewTrack(ambiguous_char_);
+
+  vector<string> state_names;  // NOTE includes init at the end, but transitions never go to init, so it doesn't matter
+  for(size_t ist=bmodel.first_state; ist<=bmodel.first_state + bmodel.n_states; ++ist)
+    state_names.push_back(bundle.String(bundle.state(ist).name));
+
+  for(size_t ist=0; ist<state_names.size(); ++ist) {
+    State *state(new State);
+    state->Load(bundle, bmodel.first_state + ist, state_names, track_);
+    if(state->name() == "init")
+      initial_ = state;
+    else
+      states_.push_back(state);
+    states_by_name_[state->name()] = state;
+  }
+
+  Finalize();
+}
+
 // ----------------------------------------------------------------------------------------
 void Model::AddState(State* state) {
   throw runtime_error("do I ever get here?");
-  assert(states_.size() < STATE_MAX);
   states_.push_back(state);
   states_by_name_[state->name()] = state;
   return;
@@ -141,6 +167,10 @@ void Model::UnRescaleOverallMuteFreq() {
 void Model::Finalize() {
   assert(!finalized_);  // well it wouldn't *hurt* to call this twice, but you still *oughtn't* to
 
+  SortStates();
+  if(states_.size() > size_t(numeric_limits<TracebackIndex>::max()) + 1)  // i.e. the largest index has to fit
+    throw runtime_error("model " + name_ + " has " + to_string(states_.size()) + " states, but trellis traceback tables can only hold " + to_string(size_t(numeric_limits<TracebackIndex>::max()) + 1) + " (see TracebackIndex in model.h)");
+
   // set each state's index within this model
   for(size_t i = 0; i < states_.size(); ++i)
     states_[i]->SetIndex(i);
@@ -164,9 +194,62 @@ void Model::Finalize() {
 }
 
 
+// ----------------------------------------------------------------------------------------
+// Renumber <states_> in topological order, i.e. so each state comes after the states that can transition to it (ignoring init and self-transitions), breaking
+// ties (and cycles, e.g. among the insert states) by input order. The dp loops go through states in index order, looking up each state's from-states in the
+// previous column, so this keeps those lookups close together in memory. Models written by partis are already in this order, so for them nothing changes.
+// NOTE only the indices change, so anything that goes through State::name() (e.g. TracebackPath::name_vector()) is unaffected.
+void Model::SortStates() {
+  map<string, size_t> input_indices;
+  for(size_t ist = 0; ist < states_.size(); ++ist)
+    input_indices[states_[ist]->name()] = ist;
+
+  vector<vector<size_t> > to_indices(states_.size());
+  vector<size_t> n_from(states_.size(), 0);  // number of not-yet-placed states that can transition to each state
+  for(size_t ist = 0; ist < states_.size(); ++ist) {
+    for(auto *trans : *states_[ist]->transitions()) {
+      if(input_indices.count(trans->to_state_name()) == 0)
+	throw runtime_error("ERROR state '" + states_[ist]->name() + "' in '" + name_ + "' has a transition to nonexistent state '" + trans->to_state_name() + "'");
+      size_t ito(input_indices[trans->to_state_name()]);
+      if(ito == ist)
+	continue;
+      to_indices[ist].push_back(ito);
+      ++n_from[ito];
+    }
+  }
+
+  set<size_t> ready;  // unplaced states with no unplaced from-states
+  for(size_t ist = 0; ist < states_.size(); ++ist)
+    if(n_from[ist] == 0)
+      ready.insert(ist);
+  vector<bool> placed(states_.size(), false);
+  vector<State*> sorted_states;
+  size_t ifirst_unplaced(0);
+  while(sorted_states.size() < states_.size()) {
+    size_t inext;
+    if(ready.size() > 0) {
+      inext = *ready.begin();
+      ready.erase(ready.begin());
+    } else {  // everybody left is in (or after) a cycle, so take the first one in input order
+      while(placed[ifirst_unplaced])
+	++ifirst_unplaced;
+      inext = ifirst_unplaced;
+    }
+    placed[inext] = true;
+    sorted_states.push_back(states_[inext]);
+    for(auto &ito : to_indices[inext]) {
+      --n_from[ito];
+      if(n_from[ito] == 0 && !placed[ito])
+	ready.insert(ito);
+    }
+  }
+
+  states_ = sorted_states;
+}
+
 // ----------------------------------------------------------------------------------------
 void Model::FinalizeState(State *st) {
-  // Modiry to_state_ and from_state_ bitsets in <st> and its transition partners
+  // Modiry to_state_indices_ and from_state_indices_ in <st> and its transition partners
   vector<Transition*>* transitions(st->transitions());
   for(size_t it = 0; it < transitions->size(); ++it) { // loops over the transitions out of <st>
     string to_state_name(transitions->at(it)->to_state_name());
@@ -185,10 +268,12 @@ void Model::FinalizeState(State *st) {
 
 // ----------------------------------------------------------------------------------------
 void Model::AddMaybeFasterFromStateStuff() {
-  initial_->SetFromStateIndices();
+  initial_->SortStateIndices();
+  for(size_t i = 0; i < states_.size(); ++i)
+    states_[i]->SortStateIndices();
+  ending_->SortStateIndices();
   for(size_t i = 0; i < states_.size(); ++i)
-    states_[i]->SetFromStateIndices();
-  ending_->SetFromStateIndices();
+    states_[i]->SetFromStateLogprobs(states_);
 }
 
 // ----------------------------------------------------------------------------------------
@@ -200,7 +285,7 @@ void Model::CheckTopology() {
   // make sure there's an end state
   // make sure all states are reachable from init
 
-  vector<uint16_t> states_to_check;  // Dynamic vector of states to which we've managed to get (starting from init).
+  vector<size_t> states_to_check;  // Dynamic vector of states to which we've managed to get (starting from init).
   // i.e. we push onto <states_to_check> when we first encounter a state,
   // and pop that state back off when we've verified the state has a non-self transition
 
@@ -208,13 +293,13 @@ void Model::CheckTopology() {
 
   vector<bool> checked_states(states_.size(), false);  // states that 1) are reachable from init and 2) have a non-self transition
   while(states_to_check.size() > 0) {
-    uint16_t icheck(states_to_check.back());  // index of the state we're now checking
+    size_t icheck(states_to_check.back());  // index of the state we're now checking
     states_to_check.pop_back();  // we're checking it now, so it no longer needs to be in <states_to_check>. NOTE states can in general appear in <states_to_check> more than once
 
     if(checked_states[icheck])  // skip it if we're already sure this state is ok
       continue;
 
-    vector<uint16_t> tmp_visited;  // vector of the states to which we can transition from the <icheck>th state
+    vector<size_t> tmp_visited;  // vector of the states to which we can transition from the <icheck>th state
     AddToStateIndices(states_[icheck], tmp_visited);
     size_t num_visited(tmp_visited.size());  // number of states to which we can transition from <icheck>. NOTE recall that transitions are not included in the vector of transitions (I don't know if there's a real reason for this)
 
@@ -255,7 +340,7 @@ void Model::CheckTopology() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Model::AddToStateIndices(State *st, vector<uint16_t> &visited) {
+void Model::AddToStateIndices(State *st, vector<size_t> &visited) {
   // push onto <visited> the index of each state to which we can transition from <st>
   for(size_t i = 0; i < st->transitions()->size(); ++i) {
     if(st->transitions()->at(i))
@@ -0,0 +1,116 @@
+#include "naiveseqindex.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+NaiveSeqIndex::NaiveSeqIndex(double max_hfrac, string ambig_char, size_t min_band_length) :
+  max_hfrac_(max_hfrac),
+  ambig_char_(ambig_char),
+  min_band_length_(min_band_length)
+{
+}
+
+// ----------------------------------------------------------------------------------------
+size_t NaiveSeqIndex::BandLength(Bucket &bucket, size_t iband, size_t seq_length) {
+  if(iband == bucket.n_bands_ - 1)
+    return seq_length - BandStart(bucket, iband);
+  return bucket.band_length_;
+}
+
+// ----------------------------------------------------------------------------------------
+void NaiveSeqIndex::InitBucket(Bucket &bucket, size_t seq_length) {
+  // NOTE the hfrac denominator excludes ambiguous positions, so the number of mismatches within the bound is at most <max_hfrac_> times the full length (add one to be safe with rounding)
+  size_t max_mismatches = size_t(max_hfrac_ * seq_length) + 1;
+  size_t n_bands = seq_length / min_band_length_;
+  bucket.seq_length_ = seq_length;
+  if(n_bands < max_mismatches + 1)  // can't guarantee a matching band without making the bands so short that nearly everything would match, so don't bother
+    return;
+  bucket.n_bands_ = n_bands;
+  bucket.band_length_ = seq_length / n_bands;
+  bucket.max_mismatches_ = max_mismatches;
+  bucket.max_wild_bands_ = (n_bands - max_mismatches - 1) / 4;  // use a bit of the slack to allow for wild bands, and the rest for requiring more than one matching band
+  bucket.band_members_.resize(n_bands);
+}
+
+// ----------------------------------------------------------------------------------------
+void NaiveSeqIndex::Add(string key, string &naive_seq, size_t cdr3_length) {
+  if(bucket_keys_.count(key))
+    Remove(key);
+
+  BucketKey bkey(cdr3_length);
+  bool new_bucket(buckets_.count(bkey) == 0);
+  Bucket &bucket(buckets_[bkey]);
+  if(new_bucket)
+    InitBucket(bucket, naive_seq.size());
+  bucket_keys_[key] = bkey;
+  bucket.members_.insert(key);
+
+  map<size_t, size_t> &hashes(band_hashes_[key]);
+  if(naive_seq.size() != bucket.seq_length_) {  // shouldn't happen (see the note in the header)
+    bucket.overflow_.insert(key);
+    return;
+  }
+  for(size_t iband=0; iband<bucket.n_bands_; ++iband) {
+    string band(naive_seq.substr(BandStart(bucket, iband), BandLength(bucket, iband, naive_seq.size())));
+    if(ambig_char_ != "" && band.find(ambig_char_) != string::npos)
+      continue;
+    hashes[iband] = hash<string>{}(band);
+  }
+
+  if(bucket.n_bands_ - hashes.size() > bucket.max_wild_bands_) {  // too many ambiguous bands, so this one gets compared to everybody
+    hashes.clear();
+    bucket.overflow_.insert(key);
+    return;
+  }
+  for(auto &kv : hashes)
+    bucket.band_members_[kv.first][kv.second].insert(key);
+}
+
+// ----------------------------------------------------------------------------------------
+void NaiveSeqIndex::Remove(string key) {
+  if(bucket_keys_.count(key) == 0)
+    throw runtime_error("key " + key + " not in naive seq index");
+
+  Bucket &bucket(buckets_[bucket_keys_[key]]);
+  bucket.members_.erase(key);
+  bucket.overflow_.erase(key);
+  for(auto &kv : band_hashes_[key]) {
+    set<string> &members(bucket.band_members_[kv.first][kv.second]);
+    members.erase(key);
+    if(members.size() == 0)
+      bucket.band_members_[kv.first].erase(kv.second);
+  }
+
+  bucket_keys_.erase(key);
+  band_hashes_.erase(key);
+}
+
+// ----------------------------------------------------------------------------------------
+set<string> NaiveSeqIndex::Candidates(string key) {
+  if(bucket_keys_.count(key) == 0)
+    throw runtime_error("key " + key + " not in naive seq index");
+
+  Bucket &bucket(buckets_[bucket_keys_[key]]);
+  set<string> candidates;
+  size_t n_wild = bucket.n_bands_ - band_hashes_[key].size();
+  if(bucket.n_bands_ == 0 || bucket.overflow_.count(key) || bucket.n_bands_ <= bucket.max_mismatches_ + n_wild + bucket.max_wild_bands_) {
+    candidates = bucket.members_;
+  } else {
+    size_t min_matches = bucket.n_bands_ - bucket.max_mismatches_ - n_wild - bucket.max_wild_bands_;  // anybody within the bound (who isn't in <overflow_>) matches at least this many bands
+    map<string, size_t> n_matches;
+    for(auto &kv : band_hashes_[key]) {
+      for(auto &other : bucket.band_members_[kv.first][kv.second])  // NOTE hash collisions just give us extra candidates, which is fine
+	++n_matches[other];
+    }
+    candidates = bucket.overflow_;
+    for(auto &kv : n_matches) {
+      if(kv.second >= min_matches)
+	candidates.insert(kv.first);
+    }
+  }
+
+  candidates.erase(key);
+  return candidates;
+}
+
+}
@@ -0,0 +1,377 @@
+#include "outputwriter.h"
+
+#include <cstring>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+AnnotationRecord::AnnotationRecord(vector<Sequence> &seqs, string errors) :
+  unique_ids_(SeqNameStr(seqs, ":")),
+  errors_(errors),
+  has_event_(false),
+  logprob_(-INFINITY)
+{
+  for(auto &seq : seqs)
+    seqs_.push_back(seq.undigitized());
+}
+
+// ----------------------------------------------------------------------------------------
+AnnotationRecord::AnnotationRecord(vector<Sequence> &seqs, double total_score, string errors) :
+  unique_ids_(SeqNameStr(seqs, ":")),
+  errors_(errors),
+  has_event_(true),
+  logprob_(total_score)
+{
+}
+
+// ----------------------------------------------------------------------------------------
+AnnotationRecord::AnnotationRecord(RecoEvent &event, vector<Sequence> &seqs, string errors) :
+  unique_ids_(SeqNameStr(seqs, ":")),
+  errors_(errors),
+  has_event_(true),
+  logprob_(event.score_)
+{
+  for(auto &seq : seqs)
+    seqs_.push_back(seq.undigitized());
+  for(auto &region : vector<string>{"v", "d", "j"}) {
+    genes_.push_back(event.genes_[region]);
+    per_gene_support_.push_back(vector<pair<string, double> >());
+    for(auto &sp : event.per_gene_support_[region])
+      per_gene_support_.back().push_back(pair<string, double>(sp.gene(), sp.logprob()));
+  }
+  for(auto &bound : vector<string>{"fv", "vd", "dj", "jf"})
+    insertions_.push_back(event.insertions_[bound]);
+  for(auto &del : vector<string>{"v_5p", "v_3p", "d_5p", "d_3p", "j_5p", "j_3p"})
+    deletions_.push_back(event.deletions_[del]);
+}
+
+// ----------------------------------------------------------------------------------------
+bool IsBinaryAnnotationFile(string fname) {
+  ifstream ifs(fname, ios::binary);
+  if(!ifs.is_open())
+    return false;
+  char magic[8];
+  if(!ifs.read(magic, 8))
+    return false;
+  return strncmp(magic, BINARY_ANNOTATION_MAGIC, 8) == 0;
+}
+
+// ----------------------------------------------------------------------------------------
+AnnotationWriter::AnnotationWriter(string fname, string algorithm, string format, size_t buffer_bytes) :
+  fname_(fname),
+  algorithm_(algorithm),
+  format_(format),
+  buffer_bytes_(buffer_bytes),
+  max_pending_(2),
+  fp_(fopen(fname.c_str(), "w")),
+  done_(false),
+  closed_(false)
+{
+  if(fp_ == nullptr)
+    throw runtime_error("ERROR --outfile (" + fname_ + ") d.n.e.\n");
+  if(algorithm_ != "viterbi" && algorithm_ != "forward")
+    throw runtime_error("bad algorithm " + algorithm_);
+  buffer_.reserve(buffer_bytes_ + (1 << 16));
+
+  if(format_ == "csv") {
+    buffer_ += CsvHeader(algorithm_) + "\n";
+  } else if(format_ == "binary") {
+    buffer_.append(BINARY_ANNOTATION_MAGIC, 8);
+    Pack<uint32_t>(BINARY_ANNOTATION_VERSION);
+    Pack<uint32_t>(BINARY_ANNOTATION_BYTE_ORDER);
+    Pack<uint32_t>(algorithm_ == "viterbi" ? 0 : 1);
+  } else {
+    throw runtime_error("unhandled output format " + format_);
+  }
+
+  thread_ = thread(&AnnotationWriter::WriterLoop, this);
+}
+
+// ----------------------------------------------------------------------------------------
+AnnotationWriter::~AnnotationWriter() {
+  if(closed_)
+    return;
+  try {
+    Close();
+  } catch(exception &e) {
+    cerr << "ERROR " << e.what() << endl;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::Write(AnnotationRecord &record) {
+  if(closed_)
+    throw runtime_error("write to closed annotation writer for " + fname_);
+  if(format_ == "csv")
+    AppendCsv(record);
+  else
+    AppendBinary(record);
+  if(buffer_.size() >= buffer_bytes_)
+    HandOff();
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE printf's %g is what ofstream uses for doubles with the default precision (which is what the csv output has always used for log probs), and %f is what to_string() uses (ditto for per-gene support)
+void AnnotationWriter::AppendDouble(double val, const char *fmt) {
+  char tmp[64];
+  int n_chars = snprintf(tmp, sizeof(tmp), fmt, val);
+  buffer_.append(tmp, n_chars);
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::AppendCsv(AnnotationRecord &record) {  // has to match CsvHeader()
+  buffer_ += record.unique_ids_;
+  if(algorithm_ == "forward") {
+    buffer_ += ',';
+    if(record.has_event_)
+      AppendDouble(record.logprob_, "%g");
+    buffer_ += ',';
+    buffer_ += record.errors_;
+    buffer_ += '\n';
+    return;
+  }
+
+  if(record.has_event_) {
+    for(auto &gene : record.genes_) {
+      buffer_ += ',';
+      buffer_ += gene;
+    }
+    for(auto &insertion : record.insertions_) {
+      buffer_ += ',';
+      buffer_ += insertion;
+    }
+    for(auto &deletion : record.deletions_) {
+      buffer_ += ',';
+      buffer_ += to_string(deletion);
+    }
+    buffer_ += ',';
+    AppendDouble(record.logprob_, "%g");
+  } else {
+    buffer_.append(14, ',');
+  }
+  buffer_ += ',';
+  for(size_t is=0; is<record.seqs_.size(); ++is) {
+    if(is > 0)
+      buffer_ += ':';
+    buffer_ += record.seqs_[is];
+  }
+  if(record.has_event_) {
+    for(auto &support : record.per_gene_support_) {
+      buffer_ += ',';
+      for(size_t ig=0; ig<support.size(); ++ig) {
+	if(ig > 0)
+	  buffer_ += ';';
+	buffer_ += support[ig].first;
+	buffer_ += ':';
+	AppendDouble(support[ig].second, "%f");
+      }
+    }
+  } else {
+    buffer_.append(3, ',');
+  }
+  buffer_ += ',';
+  buffer_ += record.errors_;
+  buffer_ += '\n';
+}
+
+// ----------------------------------------------------------------------------------------
+template <typename T> void AnnotationWriter::Pack(T val) {
+  buffer_.append((const char*)&val, sizeof(T));
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::PackString(const string &str) {
+  Pack<uint32_t>(str.size());
+  buffer_.append(str);
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::AppendBinary(AnnotationRecord &record) {
+  size_t istart(buffer_.size());
+  Pack<uint32_t>(0);  // placeholder for the record length
+  PackString(record.unique_ids_);
+  PackString(record.errors_);
+  Pack<uint8_t>(record.has_event_);
+  Pack<double>(record.logprob_);
+  if(algorithm_ == "viterbi") {
+    Pack<uint32_t>(record.seqs_.size());
+    for(auto &seq : record.seqs_)
+      PackString(seq);
+    if(record.has_event_) {
+      for(auto &gene : record.genes_)
+	PackString(gene);
+      for(auto &insertion : record.insertions_)
+	PackString(insertion);
+      for(auto &deletion : record.deletions_)
+	Pack<uint32_t>(deletion);
+      for(auto &support : record.per_gene_support_) {
+	Pack<uint32_t>(support.size());
+	for(auto &gene_logprob : support) {
+	  PackString(gene_logprob.first);
+	  Pack<double>(gene_logprob.second);
+	}
+      }
+    }
+  }
+  uint32_t record_length(buffer_.size() - istart - sizeof(uint32_t));
+  memcpy(&buffer_[istart], &record_length, sizeof(uint32_t));
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::HandOff() {
+  if(buffer_.size() == 0)
+    return;
+  unique_lock<mutex> lock(mutex_);
+  space_cv_.wait(lock, [this] { return queue_.size() < max_pending_ || write_error_ != ""; });
+  if(write_error_ != "")
+    throw runtime_error(write_error_);
+  queue_.push_back(string());
+  queue_.back().swap(buffer_);
+  lock.unlock();
+  queue_cv_.notify_one();
+  buffer_.reserve(buffer_bytes_ + (1 << 16));
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::WriterLoop() {
+  while(true) {
+    string chunk;
+    {
+      unique_lock<mutex> lock(mutex_);
+      queue_cv_.wait(lock, [this] { return queue_.size() > 0 || done_; });
+      if(queue_.size() == 0)  // done, and nothing left to write
+	return;
+      chunk.swap(queue_.front());
+      queue_.pop_front();
+    }
+    space_cv_.notify_one();
+    if(fwrite(chunk.data(), 1, chunk.size(), fp_) != chunk.size()) {
+      lock_guard<mutex> lock(mutex_);
+      write_error_ = "failed writing to " + fname_;
+      space_cv_.notify_one();
+      return;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::Close() {
+  if(closed_)
+    return;
+  closed_ = true;
+  bool handed_off(false);
+  try {
+    HandOff();
+    handed_off = true;
+  } catch(...) {}
+  {
+    lock_guard<mutex> lock(mutex_);
+    done_ = true;
+  }
+  queue_cv_.notify_one();
+  thread_.join();
+  bool close_ok(fclose(fp_) == 0);
+  if(write_error_ != "")
+    throw runtime_error(write_error_);
+  if(!handed_off || !close_ok)
+    throw runtime_error("failed writing to " + fname_);
+}
+
+// ----------------------------------------------------------------------------------------
+void OrderedAnnotationWriter::Write(size_t index, AnnotationRecord &record) {
+  lock_guard<mutex> lock(mutex_);
+  if(index < next_index_ || pending_.count(index))
+    throw runtime_error("OrderedAnnotationWriter got index " + to_string(index) + " twice");
+  pending_[index] = record;
+  while(pending_.count(next_index_)) {
+    writer_.Write(pending_[next_index_]);
+    pending_.erase(next_index_);
+    ++next_index_;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+AnnotationReader::AnnotationReader(string fname) :
+  fname_(fname),
+  ifs_(fname, ios::binary),
+  ipos_(0)
+{
+  if(!ifs_.is_open())
+    throw runtime_error("couldn't open binary annotation file " + fname_);
+  buffer_.resize(8 + 3 * sizeof(uint32_t));
+  if(!ifs_.read(&buffer_[0], buffer_.size()) || buffer_.compare(0, 8, BINARY_ANNOTATION_MAGIC) != 0)
+    throw runtime_error("bad header in binary annotation file " + fname_);
+  ipos_ = 8;
+  uint32_t version(Unpack<uint32_t>()), byte_order(Unpack<uint32_t>()), ialgorithm(Unpack<uint32_t>());
+  if(version != BINARY_ANNOTATION_VERSION)
+    throw runtime_error("binary annotation file " + fname_ + " has version " + to_string(version) + ", but we only know how to read version " + to_string(BINARY_ANNOTATION_VERSION));
+  if(byte_order != BINARY_ANNOTATION_BYTE_ORDER)
+    throw runtime_error("binary annotation file " + fname_ + " was written on a machine with different byte order");
+  algorithm_ = ialgorithm == 0 ? "viterbi" : "forward";
+}
+
+// ----------------------------------------------------------------------------------------
+template <typename T> T AnnotationReader::Unpack() {
+  if(ipos_ + sizeof(T) > buffer_.size())
+    throw runtime_error("record in binary annotation file " + fname_ + " is shorter than its contents");
+  T val;
+  memcpy(&val, &buffer_[ipos_], sizeof(T));
+  ipos_ += sizeof(T);
+  return val;
+}
+
+// ----------------------------------------------------------------------------------------
+string AnnotationReader::UnpackString() {
+  uint32_t length(Unpack<uint32_t>());
+  if(ipos_ + length > buffer_.size())
+    throw runtime_error("record in binary annotation file " + fname_ + " is shorter than its contents");
+  string str(buffer_, ipos_, length);
+  ipos_ += length;
+  return str;
+}
+
+// ----------------------------------------------------------------------------------------
+bool AnnotationReader::Next(AnnotationRecord &record) {
+  uint32_t record_length;
+  if(!ifs_.read((char*)&record_length, sizeof(uint32_t))) {
+    if(ifs_.gcount() != 0)
+      throw runtime_error("partial record length at end of binary annotation file " + fname_);
+    return false;
+  }
+  buffer_.resize(record_length);
+  if(!ifs_.read(&buffer_[0], record_length))
+    throw runtime_error("truncated record in binary annotation file " + fname_);
+  ipos_ = 0;
+
+  record = AnnotationRecord();
+  record.unique_ids_ = UnpackString();
+  record.errors_ = UnpackString();
+  record.has_event_ = Unpack<uint8_t>();
+  record.logprob_ = Unpack<double>();
+  if(algorithm_ == "viterbi") {
+    uint32_t n_seqs(Unpack<uint32_t>());
+    for(size_t is=0; is<n_seqs; ++is)
+      record.seqs_.push_back(UnpackString());
+    if(record.has_event_) {
+      for(size_t ig=0; ig<3; ++ig)
+	record.genes_.push_back(UnpackString());
+      for(size_t ii=0; ii<4; ++ii)
+	record.insertions_.push_back(UnpackString());
+      for(size_t id=0; id<6; ++id)
+	record.deletions_.push_back(Unpack<uint32_t>());
+      for(size_t ir=0; ir<3; ++ir) {
+	record.per_gene_support_.push_back(vector<pair<string, double> >());
+	uint32_t n_genes(Unpack<uint32_t>());
+	for(size_t ig=0; ig<n_genes; ++ig) {
+	  string gene(UnpackString());
+	  record.per_gene_support_.back().push_back(pair<string, double>(gene, Unpack<double>()));
+	}
+      }
+    }
+  }
+  if(ipos_ != buffer_.size())
+    throw runtime_error("record in binary annotation file " + fname_ + " has extra bytes");
+  return true;
+}
+
+}
@@ -0,0 +1,162 @@
+#include "profiler.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+#include <sys/resource.h>
+
+namespace ham {
+
+Profiler *Profiler::instance_(nullptr);
+atomic<uint64_t> Profiler::n_allocations_(0);
+atomic<uint64_t> Profiler::n_allocated_bytes_(0);
+bool Profiler::counting_allocations_(false);
+
+// ----------------------------------------------------------------------------------------
+double CpuSeconds() {
+  struct timespec ts;
+  if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+    return clock() / (double)CLOCKS_PER_SEC;
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// ----------------------------------------------------------------------------------------
+Profiler::Profiler() :
+  start_time_(chrono::steady_clock::now()),
+  start_cpu_seconds_(CpuSeconds())
+{
+}
+
+// ----------------------------------------------------------------------------------------
+void Profiler::Enable() {
+  if(instance_ != nullptr)
+    return;
+  instance_ = new Profiler;  // NOTE never deleted, so it's still around for anybody who reports at exit
+  n_allocations_ = 0;
+  n_allocated_bytes_ = 0;
+  counting_allocations_ = true;
+}
+
+// ----------------------------------------------------------------------------------------
+void Profiler::AddPhase(string name, double wall_seconds, double cpu_seconds) {
+  lock_guard<mutex> lock(mutex_);
+  PhaseTimes &phase(phases_[name]);
+  ++phase.n_calls;
+  phase.wall_seconds += wall_seconds;
+  phase.cpu_seconds += cpu_seconds;
+}
+
+// ----------------------------------------------------------------------------------------
+void Profiler::TrellisCounts::Add(string origin, uint64_t cells, double secs) {
+  if(origin == "scratch")
+    ++n_scratch;
+  else if(origin == "chunk")
+    ++n_chunk;
+  else if(origin == "cached")
+    ++n_cached;
+  else
+    throw runtime_error("unhandled trellis origin " + origin);
+  n_cells += cells;
+  seconds += secs;
+}
+
+// ----------------------------------------------------------------------------------------
+string Profiler::TrellisCounts::Json() {
+  double n_total(n_scratch + n_chunk + n_cached);
+  char buffer[1000];
+  sprintf(buffer, "{\"scratch\": %llu, \"chunk\": %llu, \"cached\": %llu, \"chunk_hit_rate\": %s, \"cached_hit_rate\": %s, \"cells\": %llu, \"seconds\": %s, \"cells_per_second\": %s}",
+	  (unsigned long long)n_scratch, (unsigned long long)n_chunk, (unsigned long long)n_cached,
+	  JsonDouble(n_total > 0 ? n_chunk / n_total : 0.).c_str(), JsonDouble(n_total > 0 ? n_cached / n_total : 0.).c_str(),
+	  (unsigned long long)n_cells, JsonDouble(seconds).c_str(), JsonDouble(seconds > 0 ? n_cells / seconds : 0.).c_str());
+  return string(buffer);
+}
+
+// ----------------------------------------------------------------------------------------
+// <seconds> is the time for the whole trellis lookup/fill (so includes the chunk cache search), and <n_cells> is the number of (position, state) pairs for which we calculated dp values
+void Profiler::CountTrellis(string region, string gene, string origin, uint64_t n_cells, double seconds) {
+  lock_guard<mutex> lock(mutex_);
+  total_counts_.Add(origin, n_cells, seconds);
+  region_counts_[region].Add(origin, n_cells, seconds);
+  gene_counts_[gene].Add(origin, n_cells, seconds);
+}
+
+// ----------------------------------------------------------------------------------------
+void Profiler::AddCounter(string name, double val) {
+  lock_guard<mutex> lock(mutex_);
+  counters_[name] += val;
+}
+
+// ----------------------------------------------------------------------------------------
+// {"wall_seconds": ..., "cpu_seconds": ..., "max_rss_kb": ...,
+//  "phases": {<name>: {"calls": ..., "wall_seconds": ..., "cpu_seconds": ...}, ...},
+//  "trellis": <counts>, "regions": {"v": <counts>, ...}, "genes": {<gene>: <counts>, ...},
+//  "allocations": {"count": ..., "bytes": ...}, "counters": {<name>: ..., ...}}
+// where <counts> is {"scratch", "chunk", "cached", "chunk_hit_rate", "cached_hit_rate", "cells", "seconds", "cells_per_second"}
+void Profiler::WriteReport(string fname) {
+  lock_guard<mutex> lock(mutex_);
+  double wall_seconds(chrono::duration<double>(chrono::steady_clock::now() - start_time_).count());
+  struct rusage usage;
+  long max_rss_kb(getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : -1);  // kB on linux
+
+  string tmpfname(fname + ".tmp");
+  ofstream ofs(tmpfname);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open profile report " + tmpfname);
+  ofs << "{\"wall_seconds\": " << JsonDouble(wall_seconds) << ", \"cpu_seconds\": " << JsonDouble(CpuSeconds() - start_cpu_seconds_) << ", \"max_rss_kb\": " << max_rss_kb << ",\n";
+
+  ofs << " \"phases\": {";
+  size_t ientry(0);
+  for(auto &kv : phases_) {
+    ofs << (ientry++ > 0 ? ",\n   " : "\n   ") << JsonString(kv.first) << ": {\"calls\": " << kv.second.n_calls << ", \"wall_seconds\": " << JsonDouble(kv.second.wall_seconds) << ", \"cpu_seconds\": " << JsonDouble(kv.second.cpu_seconds) << "}";
+  }
+  ofs << "},\n";
+
+  ofs << " \"trellis\": " << total_counts_.Json() << ",\n";
+  ofs << " \"regions\": {";
+  ientry = 0;
+  for(auto &kv : region_counts_)
+    ofs << (ientry++ > 0 ? ",\n   " : "\n   ") << JsonString(kv.first) << ": " << kv.second.Json();
+  ofs << "},\n";
+  ofs << " \"genes\": {";
+  ientry = 0;
+  for(auto &kv : gene_counts_)
+    ofs << (ientry++ > 0 ? ",\n   " : "\n   ") << JsonString(kv.first) << ": " << kv.second.Json();
+  ofs << "},\n";
+
+  ofs << " \"allocations\": {\"count\": " << n_allocations_.load() << ", \"bytes\": " << n_allocated_bytes_.load() << "},\n";
+
+  ofs << " \"counters\": {";
+  ientry = 0;
+  for(auto &kv : counters_)
+    ofs << (ientry++ > 0 ? ", " : "") << JsonString(kv.first) << ": " << JsonDouble(kv.second);
+  ofs << "}}\n";
+  ofs.close();
+  if(!ofs)
+    throw runtime_error("failed writing profile report " + tmpfname);
+  if(rename(tmpfname.c_str(), fname.c_str()) != 0)
+    throw runtime_error("couldn't move " + tmpfname + " to " + fname);
+}
+
+// ----------------------------------------------------------------------------------------
+PhaseTimer::PhaseTimer(string name) :
+  name_(name),
+  enabled_(Profiler::Get() != nullptr),
+  start_cpu_seconds_(0.)
+{
+  if(enabled_) {
+    start_ = chrono::steady_clock::now();
+    start_cpu_seconds_ = CpuSeconds();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void PhaseTimer::Stop() {
+  if(!enabled_)
+    return;
+  Profiler::Get()->AddPhase(name_, chrono::duration<double>(chrono::steady_clock::now() - start_).count(), CpuSeconds() - start_cpu_seconds_);
+  enabled_ = false;
+}
+
+}
@@ -0,0 +1,239 @@
+#include "queryfile.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+bool IsBinaryQueryFile(string fname) {
+  ifstream ifs(fname, ios::binary);
+  if(!ifs.is_open())
+    return false;
+  char magic[8];
+  if(!ifs.read(magic, 8))
+    return false;
+  return strncmp(magic, BINARY_QUERY_MAGIC, 8) == 0;
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE only names and seqs have to be there (e.g. annotation input doesn't need cdr3_length), and anything that's missing is left at QueryRecord's default
+void ReadTextQuery(Args &args, size_t iqry, Track *track, QueryRecord &record) {
+  vector<string> &names(args.str_lists_["names"].at(iqry)), &seqs(args.str_lists_["seqs"].at(iqry));
+  if(names.size() != seqs.size())
+    throw runtime_error("different numbers of names (" + to_string(names.size()) + ") and seqs (" + to_string(seqs.size()) + ") for query " + to_string(iqry) + " in " + args.infile());
+  record = QueryRecord();
+  for(size_t iseq=0; iseq<names.size(); ++iseq)
+    record.seqs_.push_back(Sequence(track, names[iseq], seqs[iseq]));
+  if(iqry < args.integers_["k_v_min"].size()) {
+    record.k_v_min_ = args.integers_["k_v_min"][iqry];
+    record.k_v_max_ = args.integers_["k_v_max"].at(iqry);
+    record.k_d_min_ = args.integers_["k_d_min"].at(iqry);
+    record.k_d_max_ = args.integers_["k_d_max"].at(iqry);
+  }
+  if(iqry < args.integers_["cdr3_length"].size())
+    record.cdr3_length_ = args.integers_["cdr3_length"][iqry];
+  if(iqry < args.str_lists_["only_genes"].size())
+    record.only_genes_ = args.str_lists_["only_genes"][iqry];
+  if(iqry < args.floats_["mut_freq"].size())
+    record.mut_freq_ = args.floats_["mut_freq"][iqry];
+}
+
+// ----------------------------------------------------------------------------------------
+// The dp tables for each gene are (sequence length) x (n states), and we fill them for each kset, with each sequence's emissions summed at each position. The number
+// of states is proportional to gene length, which is roughly constant within a region, so we leave it out.
+// NOTE zero only_genes means all of them, but that doesn't happen in practice, so we don't bother looking up how many genes there are
+double QueryRecord::EstimatedCost() {
+  size_t max_length(0);
+  for(auto &seq : seqs_)
+    max_length = max(max_length, seq.size());
+  double n_ksets = max(1, k_v_max_ - k_v_min_) * max(1, k_d_max_ - k_d_min_);
+  return max(size_t(1), only_genes_.size()) * n_ksets * max_length * max(size_t(1), seqs_.size());
+}
+
+// ----------------------------------------------------------------------------------------
+QueryFileReader::QueryFileReader(string fname, Track *track) :
+  fname_(fname),
+  ifs_(fname, ios::binary),
+  track_(track),
+  ipos_(0),
+  n_read_(0)
+{
+  if(!ifs_.is_open())
+    throw runtime_error("couldn't open binary query file " + fname_);
+  char magic[8];
+  if(!ifs_.read(magic, 8) || strncmp(magic, BINARY_QUERY_MAGIC, 8) != 0)
+    throw runtime_error("bad magic string in binary query file " + fname_);
+  uint32_t version(ReadUint32());
+  if(version != BINARY_QUERY_VERSION)
+    throw runtime_error("binary query file " + fname_ + " has version " + to_string(version) + ", but we only know how to read version " + to_string(BINARY_QUERY_VERSION));
+  if(ReadUint32() != BINARY_QUERY_BYTE_ORDER)
+    throw runtime_error("binary query file " + fname_ + " was written on a machine with different byte order");
+
+  // the sequences are digitized, so the file's alphabet has to be the same as ours
+  uint32_t n_symbols(ReadUint32());
+  if(n_symbols != track_->alphabet_size())
+    throw runtime_error("binary query file " + fname_ + " has " + to_string(n_symbols) + " symbols, but track has" + track_->Stringify());
+  for(size_t is=0; is<n_symbols; ++is) {
+    string symbol(ReadString());
+    if(symbol != track_->symbol(is))
+      throw runtime_error("symbol " + to_string(is) + " in binary query file " + fname_ + " is " + symbol + ", but track has" + track_->Stringify());
+  }
+  string ambig_char(ReadString());
+  if(ambig_char != "" && ambig_char != track_->ambiguous_char())
+    throw runtime_error("binary query file " + fname_ + " was written with ambiguous char '" + ambig_char + "', but track has" + track_->Stringify());
+
+  uint32_t n_genes(ReadUint32());
+  for(size_t ig=0; ig<n_genes; ++ig)
+    gene_names_.push_back(ReadString());
+}
+
+// ----------------------------------------------------------------------------------------
+uint32_t QueryFileReader::ReadUint32() {
+  uint32_t val;
+  if(!ifs_.read((char*)&val, sizeof(uint32_t)))
+    throw runtime_error("unexpected end of file in header of binary query file " + fname_);
+  return val;
+}
+
+// ----------------------------------------------------------------------------------------
+string QueryFileReader::ReadString() {
+  string str(ReadUint32(), '\0');
+  if(str.size() > 0 && !ifs_.read(&str[0], str.size()))
+    throw runtime_error("unexpected end of file in header of binary query file " + fname_);
+  return str;
+}
+
+// ----------------------------------------------------------------------------------------
+void QueryFileReader::CheckRemaining(size_t n_bytes) {
+  if(ipos_ + n_bytes > buffer_.size())
+    throw runtime_error("record " + to_string(n_read_) + " in binary query file " + fname_ + " is shorter than its contents");
+}
+
+// ----------------------------------------------------------------------------------------
+template <typename T> T QueryFileReader::Unpack() {
+  CheckRemaining(sizeof(T));
+  T val;
+  memcpy(&val, &buffer_[ipos_], sizeof(T));
+  ipos_ += sizeof(T);
+  return val;
+}
+
+// ----------------------------------------------------------------------------------------
+string QueryFileReader::UnpackString() {
+  uint32_t length(Unpack<uint32_t>());
+  CheckRemaining(length);
+  string str(buffer_, ipos_, length);
+  ipos_ += length;
+  return str;
+}
+
+// ----------------------------------------------------------------------------------------
+bool QueryFileReader::Next(QueryRecord &record) {
+  uint32_t record_length;
+  if(!ifs_.read((char*)&record_length, sizeof(uint32_t))) {
+    if(ifs_.gcount() != 0)
+      throw runtime_error("partial record length at end of binary query file " + fname_);
+    return false;
+  }
+  buffer_.resize(record_length);
+  if(!ifs_.read(&buffer_[0], record_length))
+    throw runtime_error("record " + to_string(n_read_) + " truncated in binary query file " + fname_);
+  ipos_ = 0;
+
+  record.k_v_min_ = Unpack<int32_t>();
+  record.k_v_max_ = Unpack<int32_t>();
+  record.k_d_min_ = Unpack<int32_t>();
+  record.k_d_max_ = Unpack<int32_t>();
+  record.cdr3_length_ = Unpack<int32_t>();
+  record.mut_freq_ = Unpack<double>();
+
+  record.seqs_.clear();
+  uint32_t n_seqs(Unpack<uint32_t>());
+  for(size_t is=0; is<n_seqs; ++is) {
+    string name(UnpackString());
+    uint32_t length(Unpack<uint32_t>());
+    CheckRemaining(length);
+    vector<uint8_t> digitized(buffer_.begin() + ipos_, buffer_.begin() + ipos_ + length);
+    ipos_ += length;
+    record.seqs_.push_back(Sequence(track_, name, digitized));
+  }
+
+  record.only_genes_.clear();
+  uint32_t n_genes(Unpack<uint32_t>());
+  for(size_t ig=0; ig<n_genes; ++ig) {
+    uint32_t igene(Unpack<uint32_t>());
+    if(igene >= gene_names_.size())
+      throw runtime_error("gene index " + to_string(igene) + " out of range in record " + to_string(n_read_) + " of binary query file " + fname_);
+    record.only_genes_.push_back(gene_names_[igene]);
+  }
+
+  if(ipos_ != buffer_.size())
+    throw runtime_error("record " + to_string(n_read_) + " in binary query file " + fname_ + " has extra bytes");
+  ++n_read_;
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+QueryFileWriter::QueryFileWriter(string fname, Track *track, vector<string> gene_names) :
+  fname_(fname),
+  ofs_(fname, ios::binary)
+{
+  if(!ofs_.is_open())
+    throw runtime_error("couldn't open binary query file " + fname_ + " for writing");
+  buffer_.append(BINARY_QUERY_MAGIC, 8);
+  Pack<uint32_t>(BINARY_QUERY_VERSION);
+  Pack<uint32_t>(BINARY_QUERY_BYTE_ORDER);
+  Pack<uint32_t>(track->alphabet_size());
+  for(size_t is=0; is<track->alphabet_size(); ++is)
+    PackString(track->symbol(is));
+  PackString(track->ambiguous_char());
+  Pack<uint32_t>(gene_names.size());
+  for(size_t ig=0; ig<gene_names.size(); ++ig) {
+    PackString(gene_names[ig]);
+    gene_indices_[gene_names[ig]] = ig;
+  }
+  ofs_.write(buffer_.data(), buffer_.size());
+}
+
+// ----------------------------------------------------------------------------------------
+template <typename T> void QueryFileWriter::Pack(T val) {
+  buffer_.append((const char*)&val, sizeof(T));
+}
+
+// ----------------------------------------------------------------------------------------
+void QueryFileWriter::PackString(const string &str) {
+  Pack<uint32_t>(str.size());
+  buffer_.append(str);
+}
+
+// ----------------------------------------------------------------------------------------
+void QueryFileWriter::Write(QueryRecord &record) {
+  buffer_.clear();
+  Pack<int32_t>(record.k_v_min_);
+  Pack<int32_t>(record.k_v_max_);
+  Pack<int32_t>(record.k_d_min_);
+  Pack<int32_t>(record.k_d_max_);
+  Pack<int32_t>(record.cdr3_length_);
+  Pack<double>(record.mut_freq_);
+  Pack<uint32_t>(record.seqs_.size());
+  for(auto &seq : record.seqs_) {
+    PackString(seq.name());
+    Pack<uint32_t>(seq.size());
+    buffer_.append((const char*)seq.seqq()->data(), seq.size());
+  }
+  Pack<uint32_t>(record.only_genes_.size());
+  for(auto &gene : record.only_genes_) {
+    if(gene_indices_.count(gene) == 0)
+      throw runtime_error("gene " + gene + " not in gene list for binary query file " + fname_);
+    Pack<uint32_t>(gene_indices_[gene]);
+  }
+
+  uint32_t record_length(buffer_.size());
+  ofs_.write((const char*)&record_length, sizeof(uint32_t));
+  ofs_.write(buffer_.data(), buffer_.size());
+  if(!ofs_)
+    throw runtime_error("failed writing to binary query file " + fname_);
+}
+
+}
@@ -3,7 +3,7 @@
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Sequence::Sequence() : track_(nullptr)
+Sequence::Sequence() : track_(nullptr), packed_(false), packed_length_(0)
 {
 }
 
@@ -11,7 +11,8 @@ Sequence::Sequence() : track_(nullptr)
 Sequence::Sequence(Track* trk, string name, string &undigitized):
   name_(name),
   track_(trk),
-  seqq_(undigitized.size())
+  packed_(false),
+  packed_length_(0)
 {
   undigitized_ = string(undigitized);
   ClearWhitespace("\n", &undigitized_);
@@ -22,7 +23,8 @@ Sequence::Sequence(Track* trk, string name, string &undigitized):
 Sequence::Sequence(Track* trk, string name, string &undigitized, size_t pos, size_t len):
   name_(name),
   track_(trk),
-  seqq_(undigitized.size())
+  packed_(false),
+  packed_length_(0)
 {
   CheckPosLen(name, undigitized, pos, len);
   undigitized_ = undigitized.substr(pos, len);  // <len> better be greater than zero
@@ -31,13 +33,34 @@ Sequence::Sequence(Track* trk, string name, string &undigitized, size_t pos, siz
 }
 
 // ----------------------------------------------------------------------------------------
-Sequence::Sequence(Sequence &rhs, size_t pos, size_t len) {
+Sequence::Sequence(Track* trk, string name, vector<uint8_t> &digitized):
+  name_(name),
+  track_(trk),
+  seqq_(digitized),
+  packed_(false),
+  packed_length_(0)
+{
+  undigitized_.reserve(seqq_.size());
+  for(auto &ival : seqq_) {
+    if(ival == track_->ambiguous_index() && track_->ambiguous_char() != "")
+      undigitized_ += track_->ambiguous_char();
+    else if(ival < track_->alphabet_size())
+      undigitized_ += track_->symbol(ival);
+    else
+      throw runtime_error("digitized value " + to_string(ival) + " out of range for track" + track_->Stringify() + " in " + name_);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+Sequence::Sequence(Sequence &rhs, size_t pos, size_t len) : packed_(false), packed_length_(0) {
   name_ = rhs.name_;
-  CheckPosLen(name_, rhs.undigitized(), pos, len);
+  string rhs_undigitized(rhs.undigitized());
+  CheckPosLen(name_, rhs_undigitized, pos, len);
   header_  = rhs.header_;
   track_  = rhs.track_;
-  undigitized_ = rhs.undigitized().substr(pos, len);  // <len> better be greater than zero
-  seqq_ = vector<uint8_t>(rhs.seqq_.begin() + pos, rhs.seqq_.begin() + pos + len);
+  undigitized_ = rhs_undigitized.substr(pos, len);  // <len> better be greater than zero
+  for(size_t ipos=pos; ipos<pos + len; ++ipos)
+    seqq_.push_back(rhs.value(ipos));
 }
 
 // ----------------------------------------------------------------------------------------
@@ -47,6 +70,10 @@ Sequence::Sequence(const Sequence &rhs) {
   undigitized_ = rhs.undigitized_;
   track_  = rhs.track_;
   seqq_ = rhs.seqq_;
+  packed_ = rhs.packed_;
+  packed_length_ = rhs.packed_length_;
+  packed_seqq_ = rhs.packed_seqq_;
+  ambiguous_bits_ = rhs.ambiguous_bits_;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -59,11 +86,80 @@ void Sequence::CheckPosLen(string name, string undigitized, size_t pos, size_t l
 
 // ----------------------------------------------------------------------------------------
 void Sequence::Digitize() {
-  assert(seqq_.size() == undigitized_.size());
-  for(size_t i = 0; i < undigitized_.size(); ++i) {
-    string symbol = undigitized_.substr(i, 1);
-    seqq_[i] = track_->symbol_index(symbol);
+  seqq_.resize(undigitized_.size());
+  track_->Digitize(undigitized_, seqq_.data());
+}
+
+// ----------------------------------------------------------------------------------------
+vector<uint8_t> *Sequence::seqq() {
+  if(packed_)
+    throw runtime_error("can't get digitized vector for packed sequence " + name_ + " (Unpack() it first)");
+  return &seqq_;
+}
+
+// ----------------------------------------------------------------------------------------
+string Sequence::undigitized() const {
+  if(!packed_)
+    return undigitized_;
+  char chars[4] = {' ', ' ', ' ', ' '};  // Pack() makes sure all the symbols are one character
+  for(size_t is=0; is<track_->alphabet_size(); ++is)
+    chars[is] = track_->symbol(is)[0];
+  string undigitized(packed_length_, ' ');
+  for(size_t ipos=0; ipos<packed_length_; ++ipos)
+    undigitized[ipos] = chars[(packed_seqq_[ipos / 4] >> (2 * (ipos % 4))) & 3];
+  if(ambiguous_bits_.size() > 0) {
+    for(size_t ipos=0; ipos<packed_length_; ++ipos) {
+      if((ambiguous_bits_[ipos / 64] >> (ipos % 64)) & 1)
+	undigitized[ipos] = track_->ambiguous_char()[0];
+    }
   }
+  return undigitized;
+}
+
+// ----------------------------------------------------------------------------------------
+void Sequence::Pack() {
+  if(packed_)
+    return;
+  if(track_->alphabet_size() > 4)
+    throw runtime_error("can't pack sequence " + name_ + " with more than four symbols in its alphabet (" + track_->Stringify() + ")");
+  for(size_t is=0; is<track_->alphabet_size(); ++is) {
+    if(track_->symbol(is).size() != 1)
+      throw runtime_error("can't pack sequence " + name_ + " with multi-character symbol " + track_->symbol(is));
+  }
+  if(track_->ambiguous_char().size() > 1)
+    throw runtime_error("can't pack sequence " + name_ + " with multi-character ambiguous symbol " + track_->ambiguous_char());
+
+  packed_length_ = seqq_.size();
+  packed_seqq_.assign((packed_length_ + 3) / 4, 0);
+  ambiguous_bits_.clear();
+  for(size_t ipos=0; ipos<packed_length_; ++ipos) {
+    uint8_t ival(seqq_[ipos]);
+    if(ival == track_->ambiguous_index()) {
+      if(ambiguous_bits_.size() == 0)
+	ambiguous_bits_.assign((packed_length_ + 63) / 64, 0);
+      ambiguous_bits_[ipos / 64] |= uint64_t(1) << (ipos % 64);
+      continue;
+    }
+    assert(ival < 4);
+    packed_seqq_[ipos / 4] |= ival << (2 * (ipos % 4));
+  }
+  packed_ = true;
+  vector<uint8_t>().swap(seqq_);  // swap with empty ones (rather than clear()) so we actually give back the memory
+  string().swap(undigitized_);
+}
+
+// ----------------------------------------------------------------------------------------
+void Sequence::Unpack() {
+  if(!packed_)
+    return;
+  undigitized_ = undigitized();
+  seqq_.resize(packed_length_);
+  for(size_t ipos=0; ipos<packed_length_; ++ipos)
+    seqq_[ipos] = PackedValue(ipos);
+  packed_ = false;
+  packed_length_ = 0;
+  vector<uint8_t>().swap(packed_seqq_);
+  vector<uint64_t>().swap(ambiguous_bits_);
 }
 
 // ----------------------------------------------------------------------------------------
@@ -110,9 +206,50 @@ Sequences Sequences::Union(Sequences &otherseqs) {
   return union_seqs;
 }
 // ----------------------------------------------------------------------------------------
-Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) : sequence_length_(0) {
+Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) : sequence_length_(0), n_profile_symbols_(0) {
   for(auto & seq : seqs.seqs_)
     AddSeq(Sequence(seq, pos, len));
+  if(seqs.has_profile()) {
+    n_profile_symbols_ = seqs.n_profile_symbols_;
+    profile_ = vector<uint32_t>(seqs.profile_.begin() + pos * n_profile_symbols_, seqs.profile_.begin() + (pos + len) * n_profile_symbols_);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+SequencesView::SequencesView(Sequences &seqs, size_t pos, size_t len) :
+  seqs_(&seqs),
+  offset_(pos),
+  length_(len)
+{
+  if(pos >= seqs.GetSequenceLength() || pos + len > seqs.GetSequenceLength())  // same check as Sequence::CheckPosLen()
+    throw runtime_error("len " + to_string(len) + " too large for sequences of length " + to_string(seqs.GetSequenceLength()) + " (starting at " + to_string(pos) + ") in " + seqs.name_str());
+}
+
+// ----------------------------------------------------------------------------------------
+vector<uint32_t> Sequences::BuildProfile() {
+  if(n_seqs() == 0)
+    throw runtime_error("can't build profile with no sequences");
+  size_t n_symbols = seqs_[0].track()->alphabet_size() + 1;  // last one is for the ambiguous symbol
+  vector<uint32_t> profile(sequence_length_ * n_symbols, 0);
+  for(auto &seq : seqs_) {
+    for(size_t ipos=0; ipos<sequence_length_; ++ipos) {
+      size_t isym = seq.value(ipos);
+      if(isym >= n_symbols - 1)  // ambiguous index is 254, i.e. not contiguous with the rest of the alphabet
+	isym = n_symbols - 1;
+      ++profile[ipos * n_symbols + isym];
+    }
+  }
+  return profile;
+}
+
+// ----------------------------------------------------------------------------------------
+void Sequences::SetProfile(const vector<uint32_t> &profile) {
+  if(n_seqs() == 0)
+    throw runtime_error("can't set profile with no sequences");
+  n_profile_symbols_ = seqs_[0].track()->alphabet_size() + 1;
+  if(profile.size() != sequence_length_ * n_profile_symbols_)
+    throw runtime_error("profile of size " + to_string(profile.size()) + " doesn't match sequences of length " + to_string(sequence_length_) + " with " + to_string(n_profile_symbols_) + " symbols");
+  profile_ = profile;
 }
 
 // // ----------------------------------------------------------------------------------------
@@ -138,7 +275,9 @@ void Sequences::AddSeq(Sequence sq) {
     if(sq.size() != sequence_length_)  // all sequences must have the same length
       throw runtime_error("Sequences::AddSeq() sequences must all have the same length, but got " + to_string(sq.size()) + " and " + to_string(sequence_length_));
   }
+  sq.Unpack();  // the dp (e.g. SequencesView) reads <seqq_> directly
   seqs_.push_back(sq);  // NOTE we now own this sequence, i.e. we will delete it when we die
+  profile_.clear();  // no longer matches the sequences
 }
 
 }
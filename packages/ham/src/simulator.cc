@@ -0,0 +1,270 @@
+#include "simulator.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+FamilySizeDistribution::FamilySizeDistribution(string name, double mean, double exponent, size_t max_size) :
+  name_(name),
+  mean_(mean),
+  max_size_(max_size)
+{
+  if(max_size_ == 0)
+    throw runtime_error("max family size has to be positive");
+  if(name_ == "constant" || name_ == "geometric") {
+    if(mean_ < 1.)
+      throw runtime_error("mean family size has to be at least 1 (got " + to_string(mean_) + ")");
+    geometric_ = geometric_distribution<size_t>(1. / mean_);  // number of failures before the first success, so 1 + that has mean 1 / p
+  } else if(name_ == "power-law") {
+    vector<double> weights;
+    for(size_t size=1; size<=max_size_; ++size)
+      weights.push_back(pow(double(size), -exponent));
+    power_law_ = discrete_distribution<size_t>(weights.begin(), weights.end());
+  } else {
+    throw runtime_error("unhandled family size distribution " + name_);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+size_t FamilySizeDistribution::Draw(mt19937 &rng) {
+  size_t size(0);
+  if(name_ == "constant")
+    size = round(mean_);
+  else if(name_ == "geometric")
+    size = 1 + geometric_(rng);
+  else
+    size = 1 + power_law_(rng);
+  return min(size, max_size_);
+}
+
+// ----------------------------------------------------------------------------------------
+Simulator::Simulator(GermLines &gl, map<string, vector<string> > available_genes, unsigned seed) :
+  gl_(gl),
+  available_genes_(available_genes),
+  rng_(seed),
+  n_families_(0),
+  n_seqs_(0),
+  max_cyst_(0),
+  max_j_3p_(0)
+{
+  for(auto &region : gl_.regions_) {
+    if(available_genes_[region].size() == 0)
+      throw runtime_error("no available " + region + " genes for simulation");
+    for(auto &gene : available_genes_[region])
+      if(gl_.seqs_.count(gene) == 0)
+	throw runtime_error("available gene " + gene + " isn't in the germline set");
+  }
+  for(auto &gene : available_genes_["v"])
+    if(gl_.cyst_positions_.count(gene))
+      max_cyst_ = max(max_cyst_, size_t(gl_.cyst_positions_[gene]));
+  for(auto &gene : available_genes_["j"])
+    if(gl_.tryp_positions_.count(gene))
+      max_j_3p_ = max(max_j_3p_, gl_.seqs_[gene].size() - gl_.tryp_positions_[gene]);
+}
+
+// ----------------------------------------------------------------------------------------
+size_t Simulator::Uniform(size_t lo, size_t hi) {
+  uniform_int_distribution<size_t> dist(lo, hi);
+  return dist(rng_);
+}
+
+// ----------------------------------------------------------------------------------------
+string Simulator::RandomBases(size_t length) {
+  string bases("ACGT"), seq;
+  for(size_t ib=0; ib<length; ++ib)
+    seq += bases[Uniform(0, 3)];
+  return seq;
+}
+
+// ----------------------------------------------------------------------------------------
+string Simulator::ChooseGene(string region) {
+  vector<string> &genes(available_genes_[region]);
+  return genes[Uniform(0, genes.size() - 1)];
+}
+
+// ----------------------------------------------------------------------------------------
+SimulatedFamily Simulator::Rearrange(string vgene, string dgene, string jgene) {
+  SimulatedFamily family;
+  family.name_ = "f" + to_string(n_families_++);
+  family.genes_["v"] = vgene == "" ? ChooseGene("v") : vgene;
+  family.genes_["d"] = dgene == "" ? ChooseGene("d") : dgene;
+  family.genes_["j"] = jgene == "" ? ChooseGene("j") : jgene;
+  for(auto &kv : family.genes_)
+    if(gl_.seqs_.count(kv.second) == 0)
+      throw runtime_error("gene " + kv.second + " isn't in the germline set");
+  string &vseq(gl_.seqs_[family.genes_["v"]]), &dseq(gl_.seqs_[family.genes_["d"]]), &jseq(gl_.seqs_[family.genes_["j"]]);
+  if(gl_.cyst_positions_.count(family.genes_["v"]) == 0 || gl_.tryp_positions_.count(family.genes_["j"]) == 0)
+    throw runtime_error("missing conserved codon position for " + family.genes_["v"] + " or " + family.genes_["j"]);
+  size_t cyst(gl_.cyst_positions_[family.genes_["v"]]), tryp(gl_.tryp_positions_[family.genes_["j"]]);
+
+  // deletions of up to four bases, but leave the conserved codons and at least one base of d (so for light chain we always keep the dummy d's single base)
+  size_t max_v3p(vseq.size() > cyst + 3 ? vseq.size() - cyst - 3 : 0);
+  family.deletions_["v_3p"] = Uniform(0, min(size_t(4), max_v3p));
+  family.deletions_["d_5p"] = Uniform(0, min(size_t(4), dseq.size() - 1));
+  family.deletions_["d_3p"] = Uniform(0, min(size_t(4), dseq.size() - 1 - family.deletions_["d_5p"]));
+  family.deletions_["j_5p"] = Uniform(0, min(size_t(4), tryp));
+  family.insertions_["vd"] = RandomBases(Uniform(0, 6));
+  family.insertions_["dj"] = RandomBases(Uniform(0, 6));
+
+  string vpart(vseq.substr(0, vseq.size() - family.deletions_["v_3p"]));
+  string dpart(dseq.substr(family.deletions_["d_5p"], dseq.size() - family.deletions_["d_5p"] - family.deletions_["d_3p"]));
+  string jpart(jseq.substr(family.deletions_["j_5p"]));
+  family.naive_seq_ = vpart + family.insertions_["vd"] + dpart + family.insertions_["dj"] + jpart;
+  family.k_v_ = vpart.size() + family.insertions_["vd"].size();
+  family.k_d_ = dpart.size() + family.insertions_["dj"].size();
+  size_t tryp_in_naive(family.k_v_ + family.k_d_ + tryp - family.deletions_["j_5p"]);
+  family.cdr3_length_ = tryp_in_naive - cyst + 3;
+  return family;
+}
+
+// ----------------------------------------------------------------------------------------
+// instead of a bernoulli draw at every position, skip ahead a geometrically-distributed number of positions to the next mutation (much faster for small <mut_freq>)
+string Simulator::Mutate(const string &seq, double mut_freq) {
+  string bases("ACGT"), mutated(seq);
+  if(mut_freq <= 0.)
+    return mutated;
+  geometric_distribution<size_t> n_unmutated(min(1., mut_freq));  // number of positions before the next mutation
+  for(size_t ipos=n_unmutated(rng_); ipos<mutated.size(); ipos += 1 + n_unmutated(rng_)) {
+    char &ch(mutated[ipos]);
+    if(bases.find(ch) == string::npos)  // don't mutate ambiguous bases
+      continue;
+    char newch(ch);
+    while(newch == ch)
+      newch = bases[Uniform(0, 3)];
+    ch = newch;
+  }
+  return mutated;
+}
+
+// ----------------------------------------------------------------------------------------
+// set the family's mutation frequency to the mean observed fraction of positions that differ from the naive sequence
+void Simulator::SetMutFreq(SimulatedFamily &family) {
+  size_t n_mutated(0);
+  for(auto &seq : family.seqs_)
+    for(size_t ipos=0; ipos<seq.size(); ++ipos)
+      if(seq[ipos] != family.naive_seq_[ipos])
+	++n_mutated;
+  family.mut_freq_ = family.n_seqs() == 0 ? 0. : double(n_mutated) / (family.n_seqs() * family.naive_seq_.size());
+}
+
+// ----------------------------------------------------------------------------------------
+void Simulator::AddStarTreeSeqs(SimulatedFamily &family, size_t n_seqs, double mut_freq) {
+  for(size_t is=0; is<n_seqs; ++is) {
+    family.seqs_.push_back(Mutate(family.naive_seq_, mut_freq));
+    family.names_.push_back(family.name_ + "-" + to_string(n_seqs_++));
+  }
+  SetMutFreq(family);
+}
+
+// ----------------------------------------------------------------------------------------
+void Simulator::AddTreeSeqs(SimulatedFamily &family, size_t n_seqs, double mut_freq) {
+  if(n_seqs > 0)
+    AddSubtreeSeqs(family, family.naive_seq_, n_seqs, mut_freq);
+  SetMutFreq(family);
+}
+
+// ----------------------------------------------------------------------------------------
+// Mutate <seq> along a branch that uses up a random fraction (up to half) of the remaining <depth>, then split the leaves at a uniformly random point between the two
+// subtrees below it. So the tree's more or less ultrametric, and each leaf gets about <depth> mutations per position from the naive sequence (a bit fewer, since some hit the same position).
+void Simulator::AddSubtreeSeqs(SimulatedFamily &family, const string &seq, size_t n_leaves, double depth) {
+  if(n_leaves == 1) {
+    family.seqs_.push_back(Mutate(seq, depth));
+    family.names_.push_back(family.name_ + "-" + to_string(n_seqs_++));
+    return;
+  }
+  uniform_real_distribution<double> fraction(0., 0.5);
+  double branch_length(depth * fraction(rng_));
+  string ancestor(Mutate(seq, branch_length));
+  size_t n_left(Uniform(1, n_leaves - 1));
+  AddSubtreeSeqs(family, ancestor, n_left, depth - branch_length);
+  AddSubtreeSeqs(family, ancestor, n_leaves - n_left, depth - branch_length);
+}
+
+// ----------------------------------------------------------------------------------------
+KBounds Simulator::GetKBounds(SimulatedFamily &family, size_t half_width) {
+  KSet kmin(max(size_t(1), family.k_v_ > half_width ? family.k_v_ - half_width : 1), max(size_t(1), family.k_d_ > half_width ? family.k_d_ - half_width : 1));
+  KSet kmax(family.k_v_ + half_width + 1, family.k_d_ + half_width + 1);  // NOTE max is exclusive
+  return KBounds(kmin, kmax);
+}
+
+// ----------------------------------------------------------------------------------------
+vector<string> Simulator::OnlyGenes(SimulatedFamily &family, size_t n_extra) {
+  vector<string> only_genes;
+  for(auto &region : gl_.regions_) {
+    vector<string> others;
+    for(auto &gene : available_genes_[region])
+      if(gene != family.genes_[region])
+	others.push_back(gene);
+    shuffle(others.begin(), others.end(), rng_);
+    only_genes.push_back(family.genes_[region]);
+    for(size_t ig=0; ig<n_extra && ig<others.size(); ++ig)
+      only_genes.push_back(others[ig]);
+  }
+  return only_genes;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t Simulator::LeftPadding(SimulatedFamily &family) {
+  return max_cyst_ - gl_.cyst_positions_[family.genes_["v"]];
+}
+
+// ----------------------------------------------------------------------------------------
+// Glomerator needs all the sequences in a cdr3 length class to be the same length, so (like partis's partitiondriver) we pad with ambiguous bases such that the
+// cysteines line up. Partis pads to the longest sequence in each class, but that would mean keeping every family in memory, so instead we pad to the longest
+// possible one, i.e. using the largest cysteine position and the longest j 3' end among the available genes. Since the bit after the cysteine is the cdr3 plus
+// the rest of j, that makes every padded sequence with a given cdr3 length the same length.
+string Simulator::PadSeq(SimulatedFamily &family, const string &seq, string ambig_base) {
+  if(ambig_base.size() != 1)
+    throw runtime_error("ambiguous base has to be a single character, but got " + ambig_base);
+  string &jgene(family.genes_["j"]);
+  size_t j_3p(gl_.seqs_[jgene].size() - gl_.tryp_positions_[jgene]);
+  return string(LeftPadding(family), ambig_base[0]) + seq + string(max_j_3p_ - j_3p, ambig_base[0]);
+}
+
+// ----------------------------------------------------------------------------------------
+void Simulator::WriteInputHeader(ostream &os) {
+  os << "names seqs k_v_min k_v_max k_d_min k_d_max only_genes mut_freq cdr3_length" << endl;
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE each family gets its own only_genes and k bounds, which isn't what partis does (it gets them per-sequence from sw), but it's close enough for timing
+void Simulator::WriteInputLines(ostream &os, SimulatedFamily &family, size_t k_half_width, size_t n_extra_genes, string ambig_base) {
+  KBounds kb(GetKBounds(family, k_half_width));
+  kb.vmin += LeftPadding(family);
+  kb.vmax += LeftPadding(family);
+  vector<string> only_gene_list(OnlyGenes(family, n_extra_genes));
+  string only_genes(JoinStrings(only_gene_list, ":"));
+  for(size_t is=0; is<family.n_seqs(); ++is)
+    os << family.names_[is] << " " << PadSeq(family, family.seqs_[is], ambig_base) << " " << kb.vmin << " " << kb.vmax << " " << kb.dmin << " " << kb.dmax << " " << only_genes << " " << family.mut_freq_ << " " << family.cdr3_length_ << "\n";
+}
+
+// ----------------------------------------------------------------------------------------
+void Simulator::WriteInputFile(string fname, vector<SimulatedFamily> &families, size_t k_half_width, size_t n_extra_genes, string ambig_base) {
+  ofstream ofs(fname);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open simulated input file " + fname);
+  WriteInputHeader(ofs);
+  for(auto &family : families)
+    WriteInputLines(ofs, family, k_half_width, n_extra_genes, ambig_base);
+  ofs.close();
+}
+
+// ----------------------------------------------------------------------------------------
+map<string, vector<string> > GenesWithHmms(GermLines &gl, string hmmdir) {
+  map<string, vector<string> > genes;
+  for(auto &region : gl.regions_) {
+    for(auto &gene : gl.names_[region]) {
+      ifstream ifs(hmmdir + "/" + gl.SanitizeName(gene) + ".yaml");
+      if(ifs.is_open())
+	genes[region].push_back(gene);
+    }
+    if(genes[region].size() == 0)
+      throw runtime_error("no hmms for any " + region + " genes in " + hmmdir);
+  }
+  return genes;
+}
+
+}
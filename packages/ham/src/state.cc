@@ -1,4 +1,7 @@
 #include "state.h"
+#include "hmmbundle.h"
+
+#include <algorithm>
 
 namespace ham {
 
@@ -8,6 +11,7 @@ State::State() :
   germline_nuc_(""),
   ambiguous_emission_logprob_(-INFINITY),
   ambiguous_char_(""),
+  has_ambiguous_(false),
   trans_to_end_(nullptr),
   index_(SIZE_MAX)
 {
@@ -34,6 +38,7 @@ void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
     ambiguous_emission_logprob_ = log(node["extras"]["ambiguous_emission_prob"].as<double>());
   if(node["extras"]["ambiguous_char"])
     ambiguous_char_ = node["extras"]["ambiguous_char"].as<string>();
+  has_ambiguous_ = ambiguous_char_ != "";
 
   double total(0.0); // make sure things add to 1.0
   for(YAML::const_iterator it = node["transitions"].begin(); it != node["transitions"].end(); ++it) {
@@ -70,6 +75,30 @@ void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
   emission_.Parse(node["emissions"], track);
 }
 
+// ----------------------------------------------------------------------------------------
+void State::Load(HMMBundle &bundle, size_t istate, vector<string> &state_names, Track *track) {
+  const HMMBundleState &bst(bundle.state(istate));
+  name_ = bundle.String(bst.name);
+  germline_nuc_ = bundle.String(bst.germline_nuc);
+  ambiguous_char_ = bundle.String(bst.ambiguous_char);
+  has_ambiguous_ = ambiguous_char_ != "";
+  ambiguous_emission_logprob_ = bst.ambiguous_emission_logprob;
+
+  for(size_t it=bst.first_transition; it<bst.first_transition + bst.n_transitions; ++it) {
+    const HMMBundleTransition &btrans(bundle.transition(it));
+    if(btrans.to_state >= state_names.size())
+      throw runtime_error("transition to out-of-range state " + to_string(btrans.to_state) + " from " + name_ + " in hmm bundle " + bundle.fname());
+    transitions_->push_back(new Transition(state_names[btrans.to_state], btrans.log_prob, true));
+  }
+  if(bst.flags & HAS_END_TRANSITION)
+    trans_to_end_ = new Transition("end", bst.end_transition_logprob, true);
+
+  if(bst.flags & HAS_EMISSIONS) {
+    const double *log_probs(bundle.emissions(bst));
+    emission_.Load(track, vector<double>(log_probs, log_probs + bundle.n_symbols()));
+  }
+}
+
 // ----------------------------------------------------------------------------------------
 void State::RescaleOverallMuteFreq(double factor) {
   if(germline_nuc_ == ambiguous_char_ || germline_nuc_ == "")  // if the germline state is N, or if this state has no germline (most likely fv or jf insertion)
@@ -120,18 +149,22 @@ void State::UnRescaleOverallMuteFreq() {
 }
 
 // ----------------------------------------------------------------------------------------
-double State::EmissionLogprob(uint8_t ch) {
-  if(ambiguous_char_ != "" && ch == emission_.track()->ambiguous_index())
-    return ambiguous_emission_logprob_;
-  else
-    return emission_.score(ch);
-}
-
-// ----------------------------------------------------------------------------------------
-double State::EmissionLogprob(Sequences *seqs, size_t pos) {
+double State::EmissionLogprob(SequencesView *seqs, size_t pos) {
   double logprob(0.);  // multiplying probabilities, so initial prob value should be 1.
+  if(seqs->has_profile()) {  // same thing, but with each symbol's log prob multiplied by the number of sequences that have it
+    uint32_t *counts = seqs->profile(pos);
+    size_t n_symbols(seqs->n_profile_symbols());
+    for(size_t isym=0; isym<n_symbols; ++isym) {
+      if(counts[isym] == 0)
+	continue;
+      uint8_t ch = isym == n_symbols - 1 ? emission_.track()->ambiguous_index() : uint8_t(isym);
+      logprob = AddWithMinusInfinities(logprob, counts[isym] * EmissionLogprob(ch));
+    }
+    return logprob;
+  }
+
   for(size_t iseq=0; iseq<seqs->n_seqs(); ++iseq)
-    logprob = AddWithMinusInfinities(logprob, EmissionLogprob((*seqs->get_ptr(iseq))[pos]));
+    logprob = AddWithMinusInfinities(logprob, EmissionLogprob(seqs->value(iseq, pos)));
 
 // // ----------------------------------------------------------------------------------------
 //   // potential way of accounting for shared mutations (i.e. moving off the star-tree assumption). The main practical problem it attempts to fix is over-long insertions/deletions. Unfortunately in this form it fixes this problem but, in aggregate, casues other inaccuracies that overshadow it.
@@ -178,40 +211,36 @@ void State::Print() {
 }
 
 // ----------------------------------------------------------------------------------------
-//! Get the log probability transitioning to end from the state.
-double State::end_transition_logprob() {
-  if(trans_to_end_ == nullptr)
+// On initial import of the states the allowed transitions are pushed onto <transitions_> in
+// the order written in the model file. But later on we need to look them up by to-state <index_>, so here we sort them by that.
+// NOTE this used to expand <transitions_> to a vector of length <n_states> with nullptr for missing transitions, but that's n_states^2 pointers per model
+// (40MB for a typical set of igh hmms), which adds up when there's one copy of every model in each of many processes.
+void State::ReorderTransitions(map<string, State*> &state_indices) {
+  for(size_t i = 0; i < transitions_->size(); ++i)
+    assert(state_indices.count((*transitions_)[i]->to_state_name()));
+  sort(transitions_->begin(), transitions_->end(), [](Transition *a, Transition *b) { return a->to_state()->index() < b->to_state()->index(); });
+}
+
+// ----------------------------------------------------------------------------------------
+double State::transition_logprob(size_t to_state) {
+  auto it = lower_bound(transitions_->begin(), transitions_->end(), to_state, [](Transition *trans, size_t ist) { return trans->to_state()->index() < ist; });
+  if(it == transitions_->end() || (*it)->to_state()->index() != to_state)
     return -INFINITY;
-  return trans_to_end_->log_prob();
+  return (*it)->log_prob();
 }
 
 // ----------------------------------------------------------------------------------------
-// On initial import of the states the allowed transitions are pushed onto <transitions_> in
-// the order written in the model file. But later on we need them to be in the order specified by <index_>, in a vector of length <n_states>.
-// So here we make a new vector <fixed_transitions> with the proper ordering and length <n_states> (each set to nullptr by default), and replace <transitions_> with this
-// new vector.
-void State::ReorderTransitions(map<string, State*> &state_indices) {
-  size_t n_states(state_indices.size());
-  vector<Transition*> *fixed_transitions = new vector<Transition*>(n_states - 1, nullptr);  // subtract 1 because initial state is kept separate
-
-  // find the proper place for the transition and put it in the correct position
-  for(size_t i = 0; i < transitions_->size(); ++i) {  // reminder: transitions_ and fixed_transitions are not the same length
-    Transition* tmp_trans = (*transitions_)[i];
-    string to_state_name(tmp_trans->to_state_name());
-    assert(state_indices.count(to_state_name));
-    State *to_state(state_indices[to_state_name]);
-    (*fixed_transitions)[to_state->index()] = tmp_trans;
+void State::SortStateIndices() {
+  for(auto *indices : {&to_state_indices_, &from_state_indices_}) {
+    sort(indices->begin(), indices->end());
+    indices->erase(unique(indices->begin(), indices->end()), indices->end());
   }
-
-  delete transitions_;
-  transitions_ = fixed_transitions;
 }
 
 // ----------------------------------------------------------------------------------------
-void State::SetFromStateIndices() {
-  for(size_t istate=0; istate<from_states_.size(); ++istate)
-    if(from_states_[istate])
-      from_state_indices_.push_back(istate);
+void State::SetFromStateLogprobs(vector<State*> &states) {
+  for(auto &istate : from_state_indices_)
+    from_state_logprobs_.push_back(states[istate]->transition_logprob(index_));
 }
 
 }
@@ -1,4 +1,10 @@
 #include "text.h"
+
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
@@ -76,4 +82,50 @@ vector<double> Floatify(vector<string> strlist) {
   return floatlist;
 }
 
+// ----------------------------------------------------------------------------------------
+// 64-bit FNV-1a, followed by the splitmix64 finalizer so nearby strings/seeds give very different values
+uint64_t StableHash(const string &str, uint64_t seed) {
+  uint64_t hval(14695981039346656037ULL ^ seed);
+  for(auto &ch : str) {
+    hval ^= uint64_t((unsigned char)ch);
+    hval *= 1099511628211ULL;
+  }
+  hval ^= hval >> 30;
+  hval *= 0xbf58476d1ce4e5b9ULL;
+  hval ^= hval >> 27;
+  hval *= 0x94d049bb133111ebULL;
+  hval ^= hval >> 31;
+  return hval;
+}
+
+// ----------------------------------------------------------------------------------------
+string JsonString(const string &str) {
+  string return_str("\"");
+  for(auto &ch : str) {
+    if(ch == '"' || ch == '\\') {
+      return_str += '\\';
+      return_str += ch;
+    } else if((unsigned char)ch < 0x20) {
+      char buffer[10];
+      sprintf(buffer, "\\u%04x", (unsigned)(unsigned char)ch);
+      return_str += buffer;
+    } else {
+      return_str += ch;
+    }
+  }
+  return return_str + "\"";
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE we build with -Ofast, which includes -ffinite-math-only, so the compiler assumes std::isnan() and std::isinf() are false and removes them. So instead we
+// look at the bits: nan and inf are the only doubles whose exponent is all ones.
+string JsonDouble(double val) {
+  uint64_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  if(((bits >> 52) & 0x7ff) == 0x7ff)
+    return "null";
+  char buffer[50];
+  sprintf(buffer, "%.6g", val);
+  return string(buffer);
+}
 }
@@ -8,6 +8,7 @@ Track::Track(string name, vector<string> symbols, string ambiguous_char) :
   ambiguous_char_(ambiguous_char)
 {
   AddSymbols(symbols);
+  UpdateCharIndices();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -15,6 +16,22 @@ void Track::AddSymbol(string symbol) {
   assert(alphabet_.size() < max_alphabet_size_);  // cannot (at the moment) have more than 255 symbols in an alphabet
   alphabet_.push_back(symbol);
   symbol_indices_[symbol] = alphabet_.size() - 1;
+  UpdateCharIndices();
+}
+
+// ----------------------------------------------------------------------------------------
+void Track::UpdateCharIndices() {
+  single_char_symbols_ = ambiguous_char_.size() <= 1;
+  for(size_t ich=0; ich<256; ++ich)
+    char_indices_[ich] = invalid_index_;
+  for(size_t is=0; is<alphabet_.size(); ++is) {
+    if(alphabet_[is].size() != 1)
+      single_char_symbols_ = false;
+    else
+      char_indices_[(uint8_t)alphabet_[is][0]] = is;
+  }
+  if(ambiguous_char_.size() == 1)  // NOTE overrides a symbol with the same character, same as in symbol_index()
+    char_indices_[(uint8_t)ambiguous_char_[0]] = ambiguous_index_;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -25,6 +42,8 @@ void Track::AddSymbols(vector<string> &symbols) {
 
 // ----------------------------------------------------------------------------------------
 uint8_t Track::symbol_index(const string &symbol) {
+  if(single_char_symbols_ && symbol.size() == 1 && char_indices_[(uint8_t)symbol[0]] != invalid_index_)
+    return char_indices_[(uint8_t)symbol[0]];
   // TODO I don't think I'm using this ambiguous treatment any more? in any case ambiguous_char_ doesn't seem to always be set
   if(ambiguous_char_ != "" && symbol == ambiguous_char_)
     return ambiguous_index_;  // NOTE a.t.m. this is hardcoded to 254
@@ -33,6 +52,30 @@ uint8_t Track::symbol_index(const string &symbol) {
   return symbol_indices_[symbol];
 }
 
+// ----------------------------------------------------------------------------------------
+// NOTE the lookup loop has no branches (we check for invalid characters afterwards), so the compiler can vectorize it on targets with byte shuffles/gathers
+void Track::Digitize(const string &undigitized, uint8_t *digitized) {
+  if(!single_char_symbols_) {  // fall back to one map lookup per symbol
+    for(size_t ich=0; ich<undigitized.size(); ++ich)
+      digitized[ich] = symbol_index(undigitized.substr(ich, 1));
+    return;
+  }
+
+  const uint8_t *chars((const uint8_t*)undigitized.data());
+  size_t n_invalid(0);
+  for(size_t ich=0; ich<undigitized.size(); ++ich) {
+    uint8_t index(char_indices_[chars[ich]]);
+    digitized[ich] = index;
+    n_invalid += (index == invalid_index_);
+  }
+  if(n_invalid > 0) {  // go back and find the first bad one, so we throw the same error as symbol_index()
+    for(size_t ich=0; ich<undigitized.size(); ++ich) {
+      if(digitized[ich] == invalid_index_)
+	symbol_index(undigitized.substr(ich, 1));
+    }
+  }
+}
+
 // ----------------------------------------------------------------------------------------
 string Track::Stringify() {
   string return_str;
@@ -43,4 +86,11 @@ string Track::Stringify() {
   return return_str;
 }
 
+// ----------------------------------------------------------------------------------------
+// NOTE binary query files store digitized sequences, so changing the symbols or their order here means old ones won't read correctly (their headers have the symbols, so QueryFileReader will complain)
+Track NucleotideTrack(string ambiguous_char) {
+  vector<string> characters {"A", "C", "G", "T"};
+  return Track("NUKES", characters, ambiguous_char);
+}
+
 }
@@ -2,9 +2,9 @@
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Transition::Transition(string to_state, double prob) :
+Transition::Transition(string to_state, double prob, bool is_log_prob) :
   to_state_name_(to_state),
-  log_prob_(log(prob))
+  log_prob_(is_log_prob ? prob : log(prob))
 {
   to_state_ = nullptr;
 }
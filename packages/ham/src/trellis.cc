@@ -24,23 +24,14 @@ string Trellis::SizeString() {
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequence seq, Trellis *cached_trellis) :
-  hmm_(hmm),
-  cached_trellis_(cached_trellis),
-  scoring_current_(hmm_->n_states(), -INFINITY),
-  scoring_previous_(hmm_->n_states(), -INFINITY)
-{
-  seqs_.AddSeq(seq);
-  Init();
-}
-
-// ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis) :
+Trellis::Trellis(Model* hmm, SequencesView seqs, Trellis *cached_trellis) :
   hmm_(hmm),
   seqs_(seqs),
   cached_trellis_(cached_trellis),
   scoring_current_(hmm_->n_states(), -INFINITY),
-  scoring_previous_(hmm_->n_states(), -INFINITY)
+  scoring_previous_(hmm_->n_states(), -INFINITY),
+  current_states_(hmm_->n_states(), 0),
+  next_states_(hmm_->n_states(), 0)
 {
   Init();
 }
@@ -65,6 +56,7 @@ void Trellis::Init() {
   forward_log_probs_pointer_ = nullptr;
   viterbi_indices_pointer_ = nullptr;
   swap_ptr_ = nullptr;
+  n_cells_ = 0;
 
   ending_viterbi_log_prob_ = -INFINITY;
   ending_viterbi_pointer_ = -1;
@@ -86,52 +78,45 @@ void Trellis::Dump() {
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
+template <bool VITERBI, int N_SEQS> void Trellis::MiddleVals(vector<double> *scoring_previous, vector<double> *scoring_current, size_t position) {
+  for(size_t i_st_current = current_begin_; i_st_current < current_end_; ++i_st_current) {
+    if(!current_states_[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
       continue;
+    ++n_cells_;
 
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+    State *state(hmm_->state(i_st_current));
+    double emission_val = state->EmissionLogprob<N_SEQS>(&seqs_, position);
     if(emission_val == -INFINITY)
       continue;
 
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
+    vector<size_t> &from_indices(*state->from_state_indices());  // list of states from which we could've arrived at <i_st_current>
+    vector<double> &from_logprobs(*state->from_state_logprobs());
+    double &current_val((*scoring_current)[i_st_current]);
+    bool reached(false);  // did we get here from any previous state that was really needed?
+    for(size_t ifrom = 0; ifrom < from_indices.size(); ++ifrom) {
+      size_t i_st_previous(from_indices[ifrom]);
       if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
 	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
-      if(dpval > (*scoring_current)[i_st_current]) {
-	(*scoring_current)[i_st_current] = dpval;  // save this value as the best value we've so far come across
-	(*traceback_table_pointer_)[position][i_st_current] = i_st_previous;  // and mark which state it came from for later traceback NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+      double dpval = (*scoring_previous)[i_st_previous] + emission_val + from_logprobs[ifrom];
+      if(VITERBI) {
+	if(dpval > current_val) {
+	  current_val = dpval;  // save this value as the best value we've so far come across
+	  (*traceback_table_pointer_)[position][i_st_current] = i_st_previous;  // and mark which state it came from for later traceback NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+	}
+	CacheViterbiVals(position, dpval, i_st_current);
+      } else {
+	current_val = AddInLogSpace(dpval, current_val);
+	CacheForwardVals(position, dpval, i_st_current);
       }
-      CacheViterbiVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
-    }
-  }
-}
-
-// ----------------------------------------------------------------------------------------
-void Trellis::MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
-      continue;
-
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    if(emission_val == -INFINITY)
-      continue;
-
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
-      if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
-	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
-      (*scoring_current)[i_st_current] = AddInLogSpace(dpval, (*scoring_current)[i_st_current]);
-      CacheForwardVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
+      reached = true;
     }
+    if(reached)  // NOTE we only want to include <state>'s to-states if we got here from a previous state that was really needed
+      AddNextStates(state);
   }
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states) {
+void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current) {
   // swap <scoring_current> and <scoring_previous>, and set <scoring_current> values to -INFINITY
   swap_ptr_ = scoring_previous;
   scoring_previous = scoring_current;
@@ -139,10 +124,14 @@ void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&sc
   scoring_current->assign(hmm_->n_states(), -INFINITY);
   swap_ptr_ = nullptr;
 
-  // swap the <current_states> and <next_states> bitsets (ie set current_states to the states to which we can transition from *any* of the previous states)
-  current_states.reset();
-  current_states |= next_states;
-  next_states.reset();
+  // swap <current_states_> and <next_states_> (ie set current_states_ to the states to which we can transition from *any* of the previous states)
+  if(current_begin_ < current_end_)
+    fill(current_states_.begin() + current_begin_, current_states_.begin() + current_end_, 0);
+  current_states_.swap(next_states_);
+  current_begin_ = next_begin_;
+  current_end_ = next_end_;
+  next_begin_ = hmm_->n_states();
+  next_end_ = 0;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -179,51 +168,10 @@ void Trellis::Viterbi() {
   viterbi_log_probs_pointer_ = &viterbi_log_probs_;
   viterbi_indices_pointer_ = &viterbi_indices_;
 
-  traceback_table_ = int_2D(seqs_.GetSequenceLength(), vector<int16_t>(hmm_->n_states(), -1));
+  traceback_table_ = int_2D(seqs_.GetSequenceLength(), vector<TracebackIndex>(hmm_->n_states(), -1));
   traceback_table_pointer_ = &traceback_table_;
 
-  vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
-  vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
-  scoring_current->assign(scoring_current->size(), -INFINITY);
-  scoring_previous->assign(scoring_previous->size(), -INFINITY);
-  bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
-
-  // first calculate log probs for first position in sequence
-  size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
-      continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
-    if(dpval == -INFINITY)
-      continue;
-    (*scoring_current)[i_st_current] = dpval;
-    CacheViterbiVals(position, dpval, i_st_current);
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
-  }
-
-
-  // then loop over the rest of the sequence
-  for(size_t position = 1; position < seqs_.GetSequenceLength(); ++position) {
-    SwapColumns(scoring_previous, scoring_current, current_states, next_states);
-    MiddleViterbiVals(scoring_previous, scoring_current, current_states, next_states, position);
-  }
-
-  SwapColumns(scoring_previous, scoring_current, current_states, next_states);
-
-  // NOTE now that I've got the chunk caching info, it may be possible to remove this
-  // calculate ending probability and get final traceback pointer
-  ending_viterbi_pointer_ = -1;
-  ending_viterbi_log_prob_ = -INFINITY;
-  for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
-    if((*scoring_previous)[st_previous] == -INFINITY)
-      continue;
-    double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
-    if(dpval > ending_viterbi_log_prob_) {
-      ending_viterbi_log_prob_ = dpval;  // NOTE should *not* be replaced by last entry in viterbi_log_probs_, since that does not include the ending transition
-      ending_viterbi_pointer_ = st_previous;
-    }
-  }
+  FillTable<true>();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -238,42 +186,78 @@ void Trellis::Forward() {
   forward_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
   forward_log_probs_pointer_ = &forward_log_probs_;
 
+  FillTable<false>();
+}
+
+// ----------------------------------------------------------------------------------------
+template <bool VITERBI> void Trellis::FillTable() {
+  if(seqs_.n_seqs() == 1 && !seqs_.has_profile())
+    FillTable<VITERBI, 1>();
+  else if(seqs_.n_seqs() == 2 && !seqs_.has_profile())
+    FillTable<VITERBI, 2>();
+  else
+    FillTable<VITERBI, 0>();
+}
+
+// ----------------------------------------------------------------------------------------
+// fill the dp table (for viterbi, also the traceback table), and the chunk caching vectors (which Viterbi() and Forward() have already sized)
+template <bool VITERBI, int N_SEQS> void Trellis::FillTable() {
   vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
   vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
   scoring_current->assign(scoring_current->size(), -INFINITY);
   scoring_previous->assign(scoring_previous->size(), -INFINITY);
-  bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
+  current_states_.assign(hmm_->n_states(), 0);
+  next_states_.assign(hmm_->n_states(), 0);
+  current_begin_ = next_begin_ = hmm_->n_states();
+  current_end_ = next_end_ = 0;
 
   // first calculate log probs for first position in sequence
   size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
-    if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
-      continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+  for(auto &i_st_current : *hmm_->initial_to_states()) {  // only the states to which we can transition from <init>
+    ++n_cells_;
+    State *state(hmm_->state(i_st_current));
+    double emission_val = state->EmissionLogprob<N_SEQS>(&seqs_, position);
     double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
     if(dpval == -INFINITY)
       continue;
     (*scoring_current)[i_st_current] = dpval;
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next column. This leaves <next_states> set to the OR of all states to which we can transition from if start from a state to which we can transition from <init>
-    CacheForwardVals(position, dpval, i_st_current);
+    if(VITERBI)
+      CacheViterbiVals(position, dpval, i_st_current);
+    else
+      CacheForwardVals(position, dpval, i_st_current);
+    AddNextStates(state);  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
   }
 
   // then loop over the rest of the sequence
   for(position = 1; position < seqs_.GetSequenceLength(); ++position) {
-    SwapColumns(scoring_previous, scoring_current, current_states, next_states);
-    MiddleForwardVals(scoring_previous, scoring_current, current_states, next_states, position);
+    SwapColumns(scoring_previous, scoring_current);
+    MiddleVals<VITERBI, N_SEQS>(scoring_previous, scoring_current, position);
   }
 
-  SwapColumns(scoring_previous, scoring_current, current_states, next_states);
+  SwapColumns(scoring_previous, scoring_current);
 
-  ending_forward_log_prob_ = -INFINITY;
+  // NOTE now that I've got the chunk caching info, it may be possible to remove this
+  // calculate ending probability (and, for viterbi, get final traceback pointer)
+  if(VITERBI) {
+    ending_viterbi_pointer_ = -1;
+    ending_viterbi_log_prob_ = -INFINITY;
+  } else {
+    ending_forward_log_prob_ = -INFINITY;
+  }
   for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
     if((*scoring_previous)[st_previous] == -INFINITY)
       continue;
     double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
-    if(dpval == -INFINITY)
-      continue;
-    ending_forward_log_prob_ = AddInLogSpace(ending_forward_log_prob_, dpval);
+    if(VITERBI) {
+      if(dpval > ending_viterbi_log_prob_) {
+	ending_viterbi_log_prob_ = dpval;  // NOTE should *not* be replaced by last entry in viterbi_log_probs_, since that does not include the ending transition
+	ending_viterbi_pointer_ = st_previous;
+      }
+    } else {
+      if(dpval == -INFINITY)
+	continue;
+      ending_forward_log_prob_ = AddInLogSpace(ending_forward_log_prob_, dpval);
+    }
   }
 }
 
@@ -286,7 +270,7 @@ void Trellis::Traceback(TracebackPath& path) {
   path.set_score(ending_viterbi_log_prob_);
   path.push_back(ending_viterbi_pointer_);  // push back the state that led to END state
 
-  int16_t pointer(ending_viterbi_pointer_);
+  TracebackIndex pointer(ending_viterbi_pointer_);
   for(size_t position = seqs_.GetSequenceLength() - 1; position > 0; position--) {
     pointer = (*traceback_table_pointer_)[position][pointer];  // NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
     if(pointer == -1) {